@@ -0,0 +1,123 @@
+/* a benchmark of list parsing
+ *
+ * lists of 10000 items are counted and iterated with list_parser, walked
+ * with looplist from a script and accessed with at all over, reporting
+ * the throughput in items (or lookups) per second; one list has plain
+ * words only, the other has some quoted and bracketed items mixed in
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <string>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static constexpr int NUM_ITEMS = 10000;
+static constexpr int NUM_LOOKUPS = 1000;
+
+static std::string gen_list(bool mixed) {
+    std::mt19937 rng{1234};
+    std::string ret;
+    for (int i = 0; i < NUM_ITEMS; ++i) {
+        if (i) {
+            ret += ((rng() % 8) ? " " : "\n    ");
+        }
+        auto item = "item" + std::to_string(rng() % 100000);
+        switch (mixed ? (rng() % 8) : 0) {
+            case 1:
+                ret += "\"" + item + " quoted\"";
+                break;
+            case 2:
+                ret += "[" + item + " [nested]]";
+                break;
+            default:
+                ret += item;
+                break;
+        }
+    }
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2) {
+        std::fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    long iters = 200;
+    if (argc == 2) {
+        iters = std::strtol(argv[1], nullptr, 10);
+        if (iters <= 0) {
+            std::fprintf(stderr, "error: invalid iteration count\n");
+            return 1;
+        }
+    }
+
+    cs::state gcs;
+    cs::std_init_all(gcs);
+
+    gcs.new_command("nop", "...", [](auto &, auto, auto &) {});
+
+    using clock = std::chrono::steady_clock;
+
+    auto report = [iters](
+        char const *what, char const *lname, auto start, std::size_t n
+    ) {
+        std::chrono::duration<double> secs = clock::now() - start;
+        double rate = double(n) * double(iters) / secs.count();
+        std::printf("%s (%s): %.1f Mitems/s\n", what, lname, rate / 1e6);
+    };
+
+    for (bool mixed: {false, true}) {
+        auto list = gen_list(mixed);
+        auto lname = mixed ? "mixed" : "words";
+        std::size_t n = 0;
+
+        auto start = clock::now();
+        for (long i = 0; i < iters; ++i) {
+            n = cs::list_parser{gcs, list}.count();
+        }
+        report("count", lname, start, n);
+
+        std::size_t len = 0;
+        start = clock::now();
+        for (long i = 0; i < iters; ++i) {
+            for (cs::list_parser p{gcs, list}; p.parse();) {
+                len += p.raw_item().size();
+            }
+        }
+        report("parse", lname, start, n);
+
+        try {
+            gcs.assign_value("bench_list", cs::any_value{list, gcs});
+            auto code = gcs.compile("looplist x $bench_list [nop $x]");
+            start = clock::now();
+            for (long i = 0; i < iters; ++i) {
+                code.call(gcs);
+            }
+            report("looplist", lname, start, n);
+
+            auto lookups = gcs.compile(
+                "loop i " + std::to_string(NUM_LOOKUPS) +
+                " [nop (at $bench_list (* $i 10))]"
+            );
+            start = clock::now();
+            for (long i = 0; i < iters; ++i) {
+                lookups.call(gcs);
+            }
+            report("at", lname, start, NUM_LOOKUPS);
+        } catch (cs::error const &e) {
+            std::fprintf(stderr, "error: %s\n", e.what().data());
+            return 1;
+        }
+        if (!len) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+/* a benchmark of conversions of strings to numbers
+ *
+ * string values holding numbers of a few kinds are converted with
+ * get_integer and get_float over and over, reporting the throughput in
+ * megabytes of input per second for each kind
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static constexpr int NUM_VALUES = 4096;
+
+struct workload {
+    char const *name;
+    bool is_float;
+    std::string (*gen)(std::mt19937 &rng);
+};
+
+static std::string gen_digits(std::mt19937 &rng, char const *set, int len) {
+    std::string ret;
+    for (int i = 0; i < len; ++i) {
+        ret += set[rng() % std::char_traits<char>::length(set)];
+    }
+    return ret;
+}
+
+static workload const workloads[] = {
+    {"short integers", false, [](std::mt19937 &rng) {
+        return std::to_string(rng() % 10000);
+    }},
+    {"long integers", false, [](std::mt19937 &rng) {
+        return gen_digits(rng, "0123456789", 18);
+    }},
+    {"hex integers", false, [](std::mt19937 &rng) {
+        return "0x" + gen_digits(rng, "0123456789abcdefABCDEF", 16);
+    }},
+    {"short floats", true, [](std::mt19937 &rng) {
+        return gen_digits(rng, "0123456789", 3) + "." +
+            gen_digits(rng, "0123456789", 2);
+    }},
+    {"long floats", true, [](std::mt19937 &rng) {
+        return gen_digits(rng, "0123456789", 8) + "." +
+            gen_digits(rng, "0123456789", 8);
+    }},
+    {"exponent floats", true, [](std::mt19937 &rng) {
+        return gen_digits(rng, "0123456789", 1) + "." +
+            gen_digits(rng, "0123456789", 6) + "e-" +
+            std::to_string(rng() % 20);
+    }},
+};
+
+int main(int argc, char **argv) {
+    if (argc > 2) {
+        std::fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    long iters = 500;
+    if (argc == 2) {
+        iters = std::strtol(argv[1], nullptr, 10);
+        if (iters <= 0) {
+            std::fprintf(stderr, "error: invalid iteration count\n");
+            return 1;
+        }
+    }
+
+    cs::state gcs;
+
+    using clock = std::chrono::steady_clock;
+
+    std::mt19937 rng{1234};
+    for (auto &wl: workloads) {
+        std::vector<cs::any_value> vals;
+        std::size_t nbytes = 0;
+        for (int i = 0; i < NUM_VALUES; ++i) {
+            auto str = wl.gen(rng);
+            nbytes += str.size();
+            vals.emplace_back(str, gcs);
+        }
+        /* accumulated so that the conversions are not optimized out */
+        volatile double sink = 0.0;
+        auto start = clock::now();
+        for (long i = 0; i < iters; ++i) {
+            for (auto &v: vals) {
+                if (wl.is_float) {
+                    sink = sink + double(v.get_float());
+                } else {
+                    sink = sink + double(v.get_integer());
+                }
+            }
+        }
+        std::chrono::duration<double> secs = clock::now() - start;
+        double mbs = double(nbytes) * double(iters) / secs.count() / 1e6;
+        std::printf("%s: %.1f MB/s\n", wl.name, mbs);
+    }
+
+    return 0;
+}
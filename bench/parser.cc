@@ -0,0 +1,102 @@
+/* a benchmark of the script parser
+ *
+ * a large config-like corpus is generated (alias definitions with nested
+ * blocks, comments, strings, variable assignments and command calls) and
+ * compiled over and over without being run, reporting the throughput in
+ * megabytes of source per second
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static std::string gen_corpus(std::size_t size) {
+    std::mt19937 rng{1234};
+    static char const *const words[] = {
+        "ui_text", "ui_button", "ui_image", "bind", "setting", "menu_item",
+        "weapon", "sound", "texture", "model", "player", "server"
+    };
+    auto word = [&rng]() {
+        return std::string{words[rng() % std::size(words)]};
+    };
+    std::string ret;
+    for (std::size_t n = 0; ret.size() < size; ++n) {
+        auto name = word() + "_" + std::to_string(n);
+        ret += "// " + name + ": generated definition number ";
+        ret += std::to_string(n) + ", with a comment of some length\n";
+        ret += name + " = [\n";
+        for (unsigned i = 0, e = 2 + rng() % 6; i < e; ++i) {
+            ret += "    " + word() + " \"" + word() + " label ^\"";
+            ret += std::to_string(rng() % 1000) + "^\"\" [\n";
+            ret += "        " + word() + "_var = (+ $arg1 ";
+            ret += std::to_string(rng() % 100) + ")\n";
+            ret += "        if (> $arg2 0) [nop $arg2] [nop \"none\"]";
+            ret += " // inline comment\n";
+            ret += "    ]\n";
+        }
+        ret += "]\n";
+        ret += "nop " + name + " " + std::to_string(rng() % 10000);
+        ret += " 0.5 \"a string argument\"\n\n";
+    }
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 3) {
+        std::fprintf(stderr, "usage: %s [size in kB] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    long size = 2048;
+    if (argc >= 2) {
+        size = std::strtol(argv[1], nullptr, 10);
+        if (size <= 0) {
+            std::fprintf(stderr, "error: invalid size\n");
+            return 1;
+        }
+    }
+
+    long iters = 20;
+    if (argc == 3) {
+        iters = std::strtol(argv[2], nullptr, 10);
+        if (iters <= 0) {
+            std::fprintf(stderr, "error: invalid iteration count\n");
+            return 1;
+        }
+    }
+
+    cs::state gcs;
+    cs::std_init_all(gcs);
+
+    gcs.new_command("nop", "...", [](auto &, auto, auto &) {});
+
+    auto corpus = gen_corpus(std::size_t(size) * 1024);
+
+    using clock = std::chrono::steady_clock;
+
+    try {
+        /* warmup */
+        gcs.compile(corpus, "corpus");
+        auto start = clock::now();
+        for (long i = 0; i < iters; ++i) {
+            gcs.compile(corpus, "corpus");
+        }
+        std::chrono::duration<double> secs = clock::now() - start;
+        double mbs = double(corpus.size()) * double(iters) / secs.count();
+        std::printf(
+            "%zu bytes: %.1f MB/s\n", corpus.size(), mbs / 1e6
+        );
+    } catch (cs::error const &e) {
+        std::fprintf(stderr, "error: %s\n", e.what().data());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+/* a rudimentary benchmark runner for cubescript files
+ *
+ * the file is compiled once and then executed the given number of times
+ * (after a short warmup), reporting the average time per iteration and
+ * the instruction throughput of the VM
+ *
+ * the instructions are counted by builds with opcode statistics, which
+ * the runner reports; the count does not depend on how instructions are
+ * dispatched, so it can be given to the runner of other builds (such as
+ * the switch and computed goto ones) for them to report the throughput
+ */
+
+#ifdef _MSC_VER
+/* avoid silly complaints about fopen */
+#  define _CRT_SECURE_NO_WARNINGS 1
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <string_view>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static bool read_file(char const *fname, std::unique_ptr<char[]> &buf, long &len) {
+    FILE *f = std::fopen(fname, "rb");
+    if (!f) {
+        return false;
+    }
+
+    std::fseek(f, 0, SEEK_END);
+    len = std::ftell(f);
+    std::fseek(f, 0, SEEK_SET);
+
+    buf = std::make_unique<char[]>(len + 1);
+    if (!buf) {
+        std::fclose(f);
+        return false;
+    }
+
+    if (std::fread(buf.get(), 1, len, f) != std::size_t(len)) {
+        std::fclose(f);
+        return false;
+    }
+
+    buf[len] = '\0';
+    std::fclose(f);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if ((argc < 2) || (argc > 4)) {
+        std::fprintf(
+            stderr, "usage: %s file [iterations [instructions]]\n", argv[0]
+        );
+        return 1;
+    }
+
+    long iters = 100;
+    if (argc >= 3) {
+        iters = std::strtol(argv[2], nullptr, 10);
+        if (iters <= 0) {
+            std::fprintf(stderr, "error: invalid iteration count\n");
+            return 1;
+        }
+    }
+
+    /* instructions per iteration, if not counted by the build */
+    double ninsts = 0;
+    if (argc == 4) {
+        ninsts = std::strtod(argv[3], nullptr);
+        if (ninsts <= 0) {
+            std::fprintf(stderr, "error: invalid instruction count\n");
+            return 1;
+        }
+    }
+
+    std::unique_ptr<char[]> buf;
+    long len;
+    if (!read_file(argv[1], buf, len)) {
+        std::fprintf(stderr, "error: could not read '%s'\n", argv[1]);
+        return 1;
+    }
+
+    cs::state gcs;
+    cs::std_init_all(gcs);
+
+    /* sink for the workloads, so that they have a command to call that
+     * does not do anything (and does not pollute the output)
+     */
+    gcs.new_command("nop", "...", [](auto &, auto, auto &) {});
+
+    using clock = std::chrono::steady_clock;
+
+    try {
+        auto code = gcs.compile(
+            std::string_view{buf.get(), std::size_t(len)}, argv[1]
+        );
+        /* warmup */
+        for (long i = 0; i < (iters / 10 + 1); ++i) {
+            code.call(gcs);
+        }
+        auto ndisp = gcs.dispatch_count();
+        auto start = clock::now();
+        for (long i = 0; i < iters; ++i) {
+            code.call(gcs);
+        }
+        std::chrono::duration<double> secs = clock::now() - start;
+        if (auto n = gcs.dispatch_count() - ndisp; n) {
+            ninsts = double(n) / double(iters);
+        }
+        std::printf(
+            "%s: %ld iterations in %.3f ms (%.3f us/iteration, "
+            "%.1f iterations/s)\n", argv[1], iters, secs.count() * 1000.0,
+            secs.count() * 1e6 / double(iters), double(iters) / secs.count()
+        );
+        if (ninsts > 0) {
+            std::printf(
+                "%s: %.0f instructions/iteration, %.1f M instructions/s\n",
+                argv[1], ninsts, ninsts * double(iters) / secs.count() / 1e6
+            );
+        } else {
+            std::printf(
+                "%s: instructions not counted (pass the count from a build "
+                "with opcode_stats)\n", argv[1]
+            );
+        }
+    } catch (cs::error const &e) {
+        std::fprintf(stderr, "error: %s\n", e.what().data());
+        return 1;
+    }
+
+    return 0;
+}
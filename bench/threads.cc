@@ -0,0 +1,133 @@
+/* a multithreaded scaling benchmark
+ *
+ * the same workload is run on 1, 2, 4 ... threads (created with
+ * new_thread on one state) at once, each on its own OS thread, reporting
+ * the total throughput; the workload only reads shared variables and
+ * calls shared commands, which does not need any synchronization on the
+ * side of the script, plus the host looks up idents by name in between,
+ * so ideally the throughput scales with the number of threads
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <string_view>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+/* every instruction in the loop looks up an ident by index, and the
+ * strings are all interned by the same pool
+ */
+static constexpr std::string_view workload = R"(
+local s t
+s = 0
+loop i 1000 [
+    s = (+ $s $bench_a)
+    nop $bench_b $s
+    s = (- $s $bench_b)
+    t = (concatword $bench_str (mod $i 16))
+    nop $t $bench_str
+]
+)";
+
+/* looked up by name from the host after each run of the workload */
+static constexpr std::string_view names[] = {
+    "bench_a", "bench_b", "nop", "loop", "local", "+", "-", "s", "i",
+    "no_such_ident"
+};
+
+static void lookup_names(cs::state &cs) {
+    for (int i = 0; i < 100; ++i) {
+        for (auto name: names) {
+            static_cast<void>(cs.get_ident(name));
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc > 3) {
+        std::fprintf(stderr, "usage: %s [max threads] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    long maxthr = 16;
+    if (argc >= 2) {
+        maxthr = std::strtol(argv[1], nullptr, 10);
+        if (maxthr <= 0) {
+            std::fprintf(stderr, "error: invalid thread count\n");
+            return 1;
+        }
+    }
+
+    long iters = 200;
+    if (argc == 3) {
+        iters = std::strtol(argv[2], nullptr, 10);
+        if (iters <= 0) {
+            std::fprintf(stderr, "error: invalid iteration count\n");
+            return 1;
+        }
+    }
+
+    cs::state gcs;
+    cs::std_init_all(gcs);
+
+    gcs.new_command("nop", "...", [](auto &, auto, auto &) {});
+    gcs.new_var("bench_a", cs::integer_type(3));
+    gcs.new_var("bench_b", cs::integer_type(2));
+    gcs.new_var("bench_str", std::string_view{"str"});
+
+    using clock = std::chrono::steady_clock;
+
+    double base = 0.0;
+    for (long nthr = 1; nthr <= maxthr; nthr *= 2) {
+        /* threads and code are set up front, each thread compiling its
+         * own, as bytecode references are not meant to be shared
+         */
+        std::vector<std::unique_ptr<cs::state>> threads;
+        std::vector<cs::bcode_ref> code;
+        for (long i = 0; i < nthr; ++i) {
+            /* constructed in place, as threads keep their address */
+            threads.emplace_back(new cs::state{gcs.new_thread()});
+        }
+        try {
+            for (auto &th: threads) {
+                code.push_back(th->compile(workload, "threads"));
+                code.back().call(*th);
+            }
+        } catch (cs::error const &e) {
+            std::fprintf(stderr, "error: %s\n", e.what().data());
+            return 1;
+        }
+        std::vector<std::thread> workers;
+        auto start = clock::now();
+        for (long i = 0; i < nthr; ++i) {
+            workers.emplace_back([&th = *threads[i], &c = code[i], iters]() {
+                for (long j = 0; j < iters; ++j) {
+                    c.call(th);
+                    lookup_names(th);
+                }
+            });
+        }
+        for (auto &w: workers) {
+            w.join();
+        }
+        std::chrono::duration<double> secs = clock::now() - start;
+        double rate = double(nthr * iters) / secs.count();
+        if (nthr == 1) {
+            base = rate;
+        }
+        std::printf(
+            "%ld thread(s): %.1f iterations/s (%.2fx one thread)\n",
+            nthr, rate, rate / base
+        );
+        /* references go away before their threads */
+        code.clear();
+    }
+
+    return 0;
+}
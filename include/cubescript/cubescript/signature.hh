@@ -0,0 +1,311 @@
+/** @file signature.hh
+ *
+ * @brief Internal command signature deduction.
+ *
+ * There is no public API in this file.
+ *
+ * @copyright See COPYING.md in the project tree for further information.
+ */
+
+#ifndef LIBCUBESCRIPT_CUBESCRIPT_SIGNATURE_HH
+#define LIBCUBESCRIPT_CUBESCRIPT_SIGNATURE_HH
+
+#include <cstddef>
+#include <utility>
+#include <string_view>
+#include <type_traits>
+
+#include "value.hh"
+
+namespace cubescript {
+
+struct state;
+
+namespace internal {
+
+/** @private */
+template<typename T>
+inline constexpr bool sig_always_false = false;
+
+/* how a single C++ parameter type is passed to a command: the format
+ * character to register it with, and how to get it out of the value
+ * once the VM has coerced it accordingly
+ */
+
+/** @private */
+template<typename T, typename = void>
+struct sig_arg {
+    static_assert(
+        sig_always_false<T>, "unsupported command parameter type"
+    );
+};
+
+/** @private */
+template<typename T>
+struct sig_arg<T, std::enable_if_t<
+    std::is_integral_v<T> && !std::is_same_v<T, bool>
+>> {
+    static constexpr char format = 'i';
+    static T get(state &, any_value &v) {
+        return T(v.get_integer());
+    }
+};
+
+/** @private */
+template<>
+struct sig_arg<bool> {
+    static constexpr char format = 'a';
+    static bool get(state &, any_value &v) {
+        return v.get_bool();
+    }
+};
+
+/** @private */
+template<typename T>
+struct sig_arg<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static constexpr char format = 'f';
+    static T get(state &, any_value &v) {
+        return T(v.get_float());
+    }
+};
+
+/* the VM forces the argument to a string, so the view points into
+ * a string the argument itself keeps alive for the length of the call
+ */
+
+/** @private */
+template<>
+struct sig_arg<std::string_view> {
+    static constexpr char format = 's';
+    static std::string_view get(state &cs, any_value &v) {
+        return v.get_string(cs);
+    }
+};
+
+/** @private */
+template<>
+struct sig_arg<string_ref> {
+    static constexpr char format = 's';
+    static string_ref get(state &cs, any_value &v) {
+        return v.get_string(cs);
+    }
+};
+
+/** @private */
+template<>
+struct sig_arg<bcode_ref> {
+    static constexpr char format = 'b';
+    static bcode_ref get(state &, any_value &v) {
+        return v.get_code();
+    }
+};
+
+/** @private */
+template<>
+struct sig_arg<ident &> {
+    static constexpr char format = 'v';
+    static ident &get(state &cs, any_value &v) {
+        return v.get_ident(cs);
+    }
+};
+
+/** @private */
+template<>
+struct sig_arg<any_value> {
+    static constexpr char format = 'a';
+    static any_value &get(state &, any_value &v) {
+        return v;
+    }
+};
+
+/** @private */
+template<typename T>
+struct sig_param: sig_arg<std::remove_cv_t<std::remove_reference_t<T>>> {};
+
+/** @private */
+template<>
+struct sig_param<ident &>: sig_arg<ident &> {};
+
+/* boxing of the return value */
+
+/** @private */
+template<typename T>
+inline void sig_set_result(state &cs, any_value &res, T &&v) {
+    using U = std::remove_cv_t<std::remove_reference_t<T>>;
+    if constexpr (std::is_same_v<U, bool>) {
+        res.set_integer(integer_type(v));
+    } else if constexpr (std::is_integral_v<U>) {
+        res.set_integer(integer_type(v));
+    } else if constexpr (std::is_floating_point_v<U>) {
+        res.set_float(float_type(v));
+    } else if constexpr (std::is_same_v<U, string_ref>) {
+        res.set_string(v);
+    } else if constexpr (std::is_convertible_v<U, std::string_view>) {
+        res.set_string(std::string_view{v}, cs);
+    } else if constexpr (std::is_same_v<U, bcode_ref>) {
+        res.set_code(v);
+    } else if constexpr (std::is_same_v<U, any_value>) {
+        res = std::forward<T>(v);
+    } else {
+        static_assert(
+            sig_always_false<U>, "unsupported command result type"
+        );
+    }
+}
+
+/* a parameter list, optionally starting with the thread and optionally
+ * ending with a span, which makes the command variadic
+ */
+
+/** @private */
+template<bool S, bool V, typename ...A>
+struct sig_params {
+    static constexpr std::size_t nfixed = sizeof...(A);
+
+    static constexpr std::size_t flen = nfixed + (V ? 3 : 0);
+
+    static constexpr auto make_format() {
+        struct fmt_buf {
+            char buf[flen + 1];
+        } ret{};
+        char const fixed[] = {sig_param<A>::format..., '\0'};
+        for (std::size_t i = 0; i < nfixed; ++i) {
+            ret.buf[i] = fixed[i];
+        }
+        for (std::size_t i = nfixed; i < flen; ++i) {
+            ret.buf[i] = '.';
+        }
+        return ret;
+    }
+
+    static constexpr auto fbuf = make_format();
+
+    static constexpr std::string_view format{fbuf.buf, flen};
+
+    template<typename R, typename F, std::size_t ...I>
+    static void call(
+        F &f, state &cs, span_type<any_value> args, any_value &res,
+        std::index_sequence<I...>
+    ) {
+        auto invoke = [&]() -> decltype(auto) {
+            if constexpr (S && V) {
+                return f(
+                    cs, sig_param<A>::get(cs, args[I])...,
+                    args.subspan(nfixed)
+                );
+            } else if constexpr (S) {
+                return f(cs, sig_param<A>::get(cs, args[I])...);
+            } else if constexpr (V) {
+                return f(
+                    sig_param<A>::get(cs, args[I])..., args.subspan(nfixed)
+                );
+            } else {
+                return f(sig_param<A>::get(cs, args[I])...);
+            }
+        };
+        if constexpr (std::is_void_v<R>) {
+            invoke();
+        } else {
+            sig_set_result(cs, res, invoke());
+        }
+    }
+};
+
+/** @private */
+template<bool S, typename P, typename ...A>
+struct sig_split;
+
+/** @private */
+template<bool S, typename ...P>
+struct sig_split<S, sig_params<S, false, P...>> {
+    using type = sig_params<S, false, P...>;
+};
+
+/** @private */
+template<bool S, typename ...P, typename A, typename ...B>
+struct sig_split<S, sig_params<S, false, P...>, A, B...> {
+    using type = std::conditional_t<
+        (sizeof...(B) == 0) && std::is_same_v<
+            std::remove_cv_t<std::remove_reference_t<A>>,
+            span_type<any_value>
+        >,
+        sig_params<S, true, P...>,
+        typename sig_split<S, sig_params<S, false, P..., A>, B...>::type
+    >;
+};
+
+/** @private */
+template<typename ...A>
+struct sig_args {
+    using type = typename sig_split<
+        false, sig_params<false, false>, A...
+    >::type;
+};
+
+/** @private */
+template<typename ...A>
+struct sig_args<state &, A...> {
+    using type = typename sig_split<true, sig_params<true, false>, A...>::type;
+};
+
+/* deduction of the return and parameter types of a callable */
+
+/** @private */
+template<typename R, typename ...A>
+struct sig_func {
+    using result = R;
+    using params = typename sig_args<A...>::type;
+};
+
+/** @private */
+template<typename F>
+struct signature: signature<decltype(&F::operator())> {};
+
+/** @private */
+template<typename R, typename ...A>
+struct signature<R (*)(A...)>: sig_func<R, A...> {};
+
+/** @private */
+template<typename R, typename ...A>
+struct signature<R (*)(A...) noexcept>: sig_func<R, A...> {};
+
+/** @private */
+template<typename R, typename C, typename ...A>
+struct signature<R (C::*)(A...)>: sig_func<R, A...> {};
+
+/** @private */
+template<typename R, typename C, typename ...A>
+struct signature<R (C::*)(A...) const>: sig_func<R, A...> {};
+
+/** @private */
+template<typename R, typename C, typename ...A>
+struct signature<R (C::*)(A...) noexcept>: sig_func<R, A...> {};
+
+/** @private */
+template<typename R, typename C, typename ...A>
+struct signature<R (C::*)(A...) const noexcept>: sig_func<R, A...> {};
+
+/** @private */
+template<typename F>
+struct sig_command {
+    using sig = signature<std::decay_t<F>>;
+    using params = typename sig::params;
+
+    static constexpr std::string_view format = params::format;
+
+    /* mutable lambdas have a non-const call operator */
+    mutable std::decay_t<F> func;
+
+    void operator()(
+        state &cs, span_type<any_value> args, any_value &res
+    ) const {
+        params::template call<typename sig::result>(
+            func, cs, args, res, std::make_index_sequence<params::nfixed>{}
+        );
+    }
+};
+
+} /* namespace internal */
+} /* namespace cubescript */
+
+#endif /* LIBCUBESCRIPT_CUBESCRIPT_SIGNATURE_HH */
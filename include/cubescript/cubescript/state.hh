@@ -20,6 +20,7 @@
 #include "callable.hh"
 #include "ident.hh"
 #include "value.hh"
+#include "signature.hh"
 
 namespace cubescript {
 
@@ -389,6 +390,47 @@ struct LIBCUBESCRIPT_EXPORT state {
         );
     }
 
+    /** @brief Register a command with a deduced argument list
+     *
+     * Like the other new_command(), but the argument list is deduced from
+     * the signature of `f` at compile time, and so is the code to convert
+     * the arguments and the result. This works with plain functions and
+     * with lambdas and other function objects that have a single,
+     * non-template call operator.
+     *
+     * The parameter types are mapped as follows:
+     *
+     * * integral types - `i`
+     * * floating point types - `f`
+     * * `bool` - `a`, evaluated as a boolean (like any_value::get_bool())
+     * * `std::string_view` and cubescript::string_ref - `s`
+     * * cubescript::bcode_ref - `b`
+     * * `ident &` - `v`
+     * * cubescript::any_value - `a`
+     *
+     * The first parameter may be a `state &`, in which case it receives the
+     * thread and is not a part of the argument list. The last parameter may
+     * be a `span_type<any_value>`, in which case the command is variadic
+     * (`...`) and it receives the remaining arguments.
+     *
+     * The result may be `void` (the command returns none), an integral
+     * or floating point type, `bool` (returned as an integer), a string
+     * type, cubescript::bcode_ref or cubescript::any_value.
+     *
+     * For example, `int(state &, int, float, std::string_view)` results in
+     * an argument list of `ifs` and an integer result.
+     *
+     * @throw cubescript::error upon redefinition or invalid name
+     */
+    template<typename F>
+    command &new_command(std::string_view name, F &&f) {
+        using cmd = internal::sig_command<F>;
+        return new_command(
+            name, cmd::format,
+            command_func{cmd{std::forward<F>(f)}, callable_alloc, this}
+        );
+    }
+
     /** @brief Compile a string.
      *
      * This compiles the given string, optionally using `source` as a filename
@@ -401,6 +443,18 @@ struct LIBCUBESCRIPT_EXPORT state {
         std::string_view v, std::string_view source = std::string_view{}
     );
 
+    /** @brief Compile a string with the given optimization level.
+     *
+     * Like compile(), but with `opt_level` overriding the thread's
+     * optimization level (see opt_level()) for this compilation.
+     *
+     * @return a bytecode reference
+     * @throw cubescript::error on compilation failure
+     */
+    bcode_ref compile(
+        std::string_view v, std::string_view source, int opt_level
+    );
+
     /** @brief Get if the thread is in override mode
      *
      * If the thread is in override mode, any assigned alias or variable will
@@ -440,13 +494,17 @@ struct LIBCUBESCRIPT_EXPORT state {
     /** @brief Get the maximum call depth of the VM
      *
      * If zero, it is unlimited, otherwise it specifies how much the VM is
-     * allowed to recurse. By default, it is 1024.
+     * allowed to recurse. By default, it is 65536.
+     *
+     * Calls to aliases and nested blocks do not use the native stack, so
+     * the limit can be raised freely; code that is called from commands
+     * does, and is limited separately.
      */
     std::size_t max_call_depth() const;
 
     /** @brief Set the maximum call depth ov the VM
      *
-     * If zero, it is unlimited (the default is 1024). You can limit how much
+     * If zero, it is unlimited (the default is 65536). You can limit how much
      * the VM is allowed to recurse if you have specific constraints to adhere
      * to.
      *
@@ -454,6 +512,34 @@ struct LIBCUBESCRIPT_EXPORT state {
      */
     std::size_t max_call_depth(std::size_t v);
 
+    /** @brief Get the optimization level of the compiler
+     *
+     * At level 0, code is compiled as is. At level 1 (the default), calls
+     * to pure commands with constant arguments are evaluated at compile
+     * time and the bytecode is run through a peephole optimizer, which
+     * simplifies redundant instruction sequences and threads jumps.
+     */
+    int opt_level() const;
+
+    /** @brief Set the optimization level of the compiler
+     *
+     * This affects all code compiled by the thread from now on, including
+     * code compiled at runtime (such as strings called as code).
+     *
+     * @return the old value
+     */
+    int opt_level(int v);
+
+    /** @brief Get the number of instructions the VM has dispatched
+     *
+     * This counts the bytecode instructions run by the interpreter in this
+     * thread so far, which is useful to compare the instruction throughput
+     * of different builds. The instructions are only counted when the
+     * library is built with opcode statistics (the `opcode_stats` option),
+     * otherwise this is always zero.
+     */
+    std::size_t dispatch_count() const;
+
 private:
     friend struct state_p;
 
@@ -152,6 +152,11 @@ private:
  * a single reference to such string. By providing a reference counting
  * mechanism, it is possible to manage strings in a memory-safe manner.
  *
+ * The exception are intermediate results (such as results of commands and
+ * string coercions of numbers), which are not interned until they are
+ * stored in an alias or a variable, as most of them are gone right away.
+ * References to these work the same otherwise.
+ *
  * There is also no such thing as a null reference in this case. If you
  * have a string reference, it always points to a valid string no matter
  * what.
@@ -251,15 +256,15 @@ struct LIBCUBESCRIPT_EXPORT string_ref {
 
     /** @brief Check if the string equals another.
      *
-     * This is effectively a `data() == s.data()` address comparison, and
-     * therefore always has constant time complexity.
+     * For interned strings, this is effectively a `data() == s.data()`
+     * address comparison, and therefore has constant time complexity;
+     * intermediate strings that are not interned are compared by contents.
      */
     bool operator==(string_ref const &s) const;
 
     /** @brief Check if the string does not equal another.
      *
-     * This is effectively a `data() != s.data()` address comparison, and
-     * therefore always has constant time complexity.
+     * The opposite of the equality comparison.
      */
     bool operator!=(string_ref const &s) const;
 
@@ -537,6 +542,8 @@ struct LIBCUBESCRIPT_EXPORT any_value {
     ident &force_ident(state &cs);
 
 private:
+    friend struct any_value_p;
+
     union {
         integer_type i;
         float_type f;
@@ -2,6 +2,10 @@
 #include "cs_state.hh"
 #include "cs_vm.hh"
 
+#if LIBCUBESCRIPT_VM_JIT
+#  include "cs_jit.hh"
+#endif
+
 namespace cubescript {
 
 /* public API impls */
@@ -48,7 +52,10 @@ LIBCUBESCRIPT_EXPORT bcode_ref::operator bool() const {
 
 LIBCUBESCRIPT_EXPORT any_value bcode_ref::call(state &cs) const {
     any_value ret{};
-    vm_exec(state_p{cs}.ts(), p_code->raw(), ret);
+    auto &ts = state_p{cs}.ts();
+    if (!vm_exec(ts, p_code->raw(), ret)) {
+        raise_loop_ctl(ts);
+    }
     return ret;
 }
 
@@ -58,7 +65,14 @@ LIBCUBESCRIPT_EXPORT loop_state bcode_ref::call_loop(
     auto &ts = state_p{cs}.ts();
     ++ts.loop_level;
     try {
-        ret = call(cs);
+        /* the loop body is not run through call(), as break and continue
+         * are passed through the VM without unwinding, only those coming
+         * through code outside the VM (e.g. commands) arrive as exceptions
+         */
+        if (!vm_exec(ts, p_code->raw(), ret)) {
+            --ts.loop_level;
+            return std::exchange(ts.loop_ctl, loop_state::NORMAL);
+        }
     } catch (break_exception) {
         --ts.loop_level;
         return loop_state::BREAK;
@@ -69,6 +83,7 @@ LIBCUBESCRIPT_EXPORT loop_state bcode_ref::call_loop(
         --ts.loop_level;
         throw;
     }
+    --ts.loop_level;
     return loop_state::NORMAL;
 }
 
@@ -82,6 +97,9 @@ LIBCUBESCRIPT_EXPORT loop_state bcode_ref::call_loop(state &cs) const {
 struct bcode_hdr {
     internal_state *cs; /* needed to construct the allocator */
     std::size_t asize; /* alloc size of the bytecode block */
+#if LIBCUBESCRIPT_VM_JIT
+    bcode_jit jit; /* native code and hit count */
+#endif
     bcode bc; /* BC_INST_START + refcount */
 };
 
@@ -94,6 +112,10 @@ std::uint32_t *bcode_alloc(internal_state *cs, std::size_t sz) {
     std::memcpy(&hdr, &p, sizeof(hdr));
     hdr->cs = cs;
     hdr->asize = sz + hdrs - 1;
+#if LIBCUBESCRIPT_VM_JIT
+    hdr->jit.block = nullptr;
+    hdr->jit.hits = 0;
+#endif
     return p + hdrs - 1;
 }
 
@@ -102,6 +124,11 @@ static inline void bcode_free(std::uint32_t *bc) {
     auto *rp = bc + 1 - (sizeof(bcode_hdr) / sizeof(std::uint32_t));
     bcode_hdr *hdr;
     std::memcpy(&hdr, &rp, sizeof(hdr));
+#if LIBCUBESCRIPT_VM_JIT
+    if (hdr->jit.block) {
+        jit_free(hdr->jit.block);
+    }
+#endif
     std_allocator<std::uint32_t>{hdr->cs}.deallocate(rp, hdr->asize);
 }
 
@@ -154,6 +181,29 @@ void bcode_unref(std::uint32_t *code) {
     }
 }
 
+#if LIBCUBESCRIPT_VM_JIT
+bcode_jit *bcode_get_jit(
+    internal_state *cs, std::uint32_t *code,
+    std::uint32_t *&start, std::size_t &len
+) {
+    void *cp = code, *eb = cs->empty, *ee = cs->empty + VAL_ANY;
+    if (!std::less<void *>{}(cp, eb) && std::less<void *>{}(cp, ee)) {
+        return nullptr;
+    }
+    /* like in bcode_addref */
+    if ((code[-1] & BC_INST_OP_MASK) == BC_INST_OFFSET) {
+        start = code - std::ptrdiff_t(code[-1] >> 8);
+    } else {
+        start = code - 1;
+    }
+    auto *rp = start + 1 - (sizeof(bcode_hdr) / sizeof(std::uint32_t));
+    bcode_hdr *hdr;
+    std::memcpy(&hdr, &rp, sizeof(hdr));
+    len = hdr->asize - std::size_t(start - rp);
+    return &hdr->jit;
+}
+#endif
+
 /* empty fallbacks */
 
 static std::uint32_t emptyrets[VAL_ANY] = {
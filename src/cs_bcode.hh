@@ -51,7 +51,9 @@ constexpr std::size_t bc_store_size = (
  * preserves the type, except where mentioned
  */
 enum {
-    /* noop */
+    /* noop; the one starting an allocation holds its refcount in D, and
+     * has M set to BC_START_DOARGS if the code may run doargs
+     */
     BC_INST_START = 0,
     BC_INST_OFFSET,
     /* set R to null/true/false according to M */
@@ -133,7 +135,8 @@ enum {
     BC_INST_LOOKUP,
     /* lookup an unknown ident with the name being given by the string on
      * top of the stack; if a var or a set alias, update top of the stack
-     * to the ident's value (according to M), else raise error
+     * to the ident's value (according to M), else raise error; a lookup
+     * cache word follows the instruction (see BC_INST_CALL_U)
      */
     BC_INST_LOOKUP_U,
     /* concatenate D values on top of the stack together, with topmost value
@@ -150,13 +153,18 @@ enum {
     BC_INST_ALIAS_U,
     /* call alias with index D and arg count following the instruction, pop
      * the arguments off the stack (top being last); if unknown, raise error,
-     * store result in R according to M
+     * store result in R according to M; the count may be marked with
+     * BC_CALL_TAIL
      */
     BC_INST_CALL,
     /* given argument count D, pop the arguments off the stack (top being last)
      * and then pop one more value (that being the ident name); look up the
      * ident (raise error if non-existent) and then call according to its
      * type (vars behave as in PRINT); store result in R according to M
+     *
+     * the instruction is followed by a lookup cache word, which is zero
+     * initially and is updated by the VM to hold the index of the last
+     * ident looked up by the instruction plus one
      */
     BC_INST_CALL_U,
     /* call builtin command with index D; arguments are popped off the stack,
@@ -168,6 +176,49 @@ enum {
      */
     BC_INST_COM_V,
 
+    /* superinstructions; these are never emitted directly by the parser,
+     * the code generator fuses common instruction sequences into them
+     */
+
+    /* BC_INST_COM followed by BC_INST_RESULT_ARG; push the result */
+    BC_INST_COM_ARG,
+    /* BC_INST_COM_V followed by BC_INST_RESULT_ARG; push the result */
+    BC_INST_COM_V_ARG,
+    /* BC_INST_CALL followed by BC_INST_RESULT_ARG; push the result */
+    BC_INST_CALL_ARG,
+    /* set alias with index D to R, leaving R null */
+    BC_INST_ALIAS_RESULT,
+    /* BC_INST_VAL or BC_INST_VAL_INT follows, set alias with index D
+     * to its value without going through the stack
+     */
+    BC_INST_ALIAS_VAL,
+    /* conditional jump like BC_INST_JUMP_B, but test R instead of popping
+     * a value off the stack; R is null afterwards
+     */
+    BC_INST_JUMP_B_R,
+    /* native arithmetic or comparison D (one of BC_MATH_*) on the two
+     * topmost values on the stack, which are popped, the topmost being
+     * the right operand; the result goes in R according to M
+     */
+    BC_INST_MATH,
+    /* BC_INST_MATH followed by BC_INST_RESULT_ARG; the result replaces
+     * the operands on the stack
+     */
+    BC_INST_MATH_ARG,
+    /* a loop builtin (BC_LOOP_* in the word following the instruction),
+     * taking its arguments off the stack the same way the command does;
+     * the code of the loop (its condition, if any, followed by its body)
+     * follows up to D words past the instruction, and is run in a frame
+     * of its own, which stays for the whole loop and restarts the code
+     * on each iteration; R is null according to M once the loop is done
+     */
+    BC_INST_LOOP,
+    /* ends the condition of a loop; if R is false, the loop is done,
+     * otherwise R is cleared and the body is run, skipping the two words
+     * following the instruction
+     */
+    BC_INST_LOOP_COND,
+
     /* opcode mask */
     BC_INST_OP_MASK = 0x3F,
     /* type mask shift */
@@ -181,11 +232,109 @@ enum {
     BC_RET_INT    = VAL_INT << BC_INST_RET,
     BC_RET_FLOAT  = VAL_FLOAT << BC_INST_RET,
 
-    /* BC_INST_JUMP_B, BC_INST_JUMP_RESULT */
+    /* BC_INST_JUMP_B, BC_INST_JUMP_B_R, BC_INST_JUMP_RESULT */
     BC_INST_FLAG_TRUE = 1 << BC_INST_RET,
     BC_INST_FLAG_FALSE = 0 << BC_INST_RET
 };
 
+/* operations of BC_INST_MATH; these implement the builtin commands given
+ * next to them when called with two arguments, and have to behave the same
+ */
+enum {
+    BC_MATH_NONE = 0,
+    BC_MATH_ADD,  /* + */
+    BC_MATH_SUB,  /* - */
+    BC_MATH_MUL,  /* * */
+    BC_MATH_DIV,  /* div */
+    BC_MATH_MOD,  /* mod */
+    BC_MATH_EQ,   /* = */
+    BC_MATH_NE,   /* != */
+    BC_MATH_LT,   /* < */
+    BC_MATH_GT,   /* > */
+    BC_MATH_LE,   /* <= */
+    BC_MATH_GE,   /* >= */
+    BC_MATH_ADDF, /* +f */
+    BC_MATH_SUBF, /* -f */
+    BC_MATH_MULF, /* *f */
+    BC_MATH_DIVF, /* divf */
+    BC_MATH_EQF,  /* =f */
+    BC_MATH_NEF,  /* !=f */
+    BC_MATH_LTF,  /* <f */
+    BC_MATH_GTF,  /* >f */
+    BC_MATH_LEF,  /* <=f */
+    BC_MATH_GEF   /* >=f */
+};
+
+/* set in the argument count of BC_INST_CALL in tail position, i.e. when
+ * nothing but exits of inline code (BC_INST_ENTER_RESULT) and jumps are
+ * left to run after it until the end of the code, with nothing forced
+ */
+enum {
+    BC_CALL_TAIL = 1 << 30
+};
+
+/* the mask of BC_INST_START for code that may run doargs at its own
+ * level, which tail calls must not be made into, as doargs needs the
+ * level of the caller; besides doargs itself, that is any code compiled
+ * at runtime (BC_INST_COMPILE, BC_INST_COND), any call of an ident only
+ * known at runtime (BC_INST_CALL_U), either of which may be doargs, and
+ * any call of a command that is not pure, which may compile and run code
+ * of its own (like assert does with its string argument)
+ */
+enum {
+    BC_START_DOARGS = BC_INST_RET_MASK
+};
+
+/* kinds of BC_INST_LOOP, made up of the following flags; the loop ident
+ * is always the first argument, followed by the offset (BC_LOOP_ADD),
+ * then the step (BC_LOOP_MUL) and the count, except for plain loop*
+ * which has the count first; BC_LOOP_COND ones end their condition with
+ * BC_INST_LOOP_COND
+ */
+enum {
+    BC_LOOP_NONE = 0,
+    BC_LOOP_NUM  = 1 << 0, /* runs a number of times */
+    BC_LOOP_ADD  = 1 << 1, /* starting at an offset */
+    BC_LOOP_MUL  = 1 << 2, /* with a step */
+    BC_LOOP_COND = 1 << 3, /* while a condition holds */
+    BC_LOOP_LIST = 1 << 4  /* once per item of a list */
+};
+
+/* the number of words taken up by the instruction at ip along with the
+ * data following it (not including the code of BC_INST_BLOCK and
+ * BC_INST_LOOP)
+ */
+inline std::size_t bcode_insn_len(std::uint32_t const *ip) {
+    std::uint32_t op = *ip;
+    switch (op & BC_INST_OP_MASK) {
+        case BC_INST_VAL:
+            switch (op & BC_INST_RET_MASK) {
+                case BC_RET_STRING:
+                    return (op >> 8) / sizeof(std::uint32_t) + 2;
+                case BC_RET_INT:
+                    return bc_store_size<integer_type> + 1;
+                case BC_RET_FLOAT:
+                    return bc_store_size<float_type> + 1;
+                default:
+                    break;
+            }
+            return 1;
+        case BC_INST_CALL:
+        case BC_INST_CALL_ARG:
+        case BC_INST_CALL_U:
+        case BC_INST_LOOKUP_U:
+        case BC_INST_COM_V:
+        case BC_INST_COM_V_ARG:
+        case BC_INST_LOOP:
+            return 2;
+        case BC_INST_ALIAS_VAL:
+            return bcode_insn_len(ip + 1) + 1;
+        default:
+            break;
+    }
+    return 1;
+}
+
 std::uint32_t *bcode_alloc(internal_state *cs, std::size_t sz);
 
 void bcode_addref(std::uint32_t *code);
@@ -200,6 +349,27 @@ empty_block *bcode_init_empty(internal_state *cs);
 void bcode_free_empty(internal_state *cs, empty_block *empty);
 bcode *bcode_get_empty(empty_block *empty, std::size_t val);
 
+#if LIBCUBESCRIPT_VM_JIT
+struct jit_block;
+
+/* JIT state of a bytecode allocation, kept in its header (see cs_jit.hh) */
+struct bcode_jit {
+    /* native code for the whole allocation, once compiled */
+    jit_block *block;
+    /* how many times a block of code in it has been entered */
+    std::uint32_t hits;
+};
+
+/* code must be the start of a block of code; the JIT state of the
+ * allocation it is in is returned, along with the allocation's first
+ * word and its length, or null for the builtin empty blocks
+ */
+bcode_jit *bcode_get_jit(
+    internal_state *cs, std::uint32_t *code,
+    std::uint32_t *&start, std::size_t &len
+);
+#endif
+
 struct bcode_p {
     bcode_p(bcode_ref const &r): br{const_cast<bcode_ref *>(&r)} {}
 
@@ -6,6 +6,7 @@
 
 #include "cs_ident.hh"
 #include "cs_parser.hh"
+#include "cs_vm.hh"
 
 namespace cubescript {
 
@@ -24,7 +25,15 @@ std::uint32_t gen_state::peek(std::size_t idx) const {
     return code[idx];
 }
 
+std::size_t gen_state::last_op() const {
+    return lastop;
+}
+
 bcode_ref gen_state::steal_ref() {
+    if (opt_level > 0) {
+        optimize();
+        mark_tail_calls();
+    }
     auto *cp = bcode_alloc(ts.istate, code.size());
     std::memcpy(cp, code.data(), code.size() * sizeof(std::uint32_t));
     bcode *b;
@@ -34,36 +43,354 @@ bcode_ref gen_state::steal_ref() {
 }
 
 void gen_state::gen_pop() {
-    code.push_back(BC_INST_POP);
+    emit(BC_INST_POP);
 }
 
 void gen_state::gen_dup(int ltype) {
-    code.push_back(BC_INST_DUP | ret_code(ltype));
+    emit(BC_INST_DUP | ret_code(ltype));
 }
 
 void gen_state::gen_result(int ltype) {
-    code.push_back(BC_INST_RESULT | ret_code(ltype));
+    emit(BC_INST_RESULT | ret_code(ltype));
 }
 
 void gen_state::gen_push_result(int ltype) {
-    code.push_back(BC_INST_RESULT_ARG | ret_code(ltype));
+    /* a folded call can push its value right away, forced if needed */
+    if ((lastop != no_op) && (lastop == foldres)) {
+        auto rc = std::uint32_t(ret_code(ltype));
+        code.resize(foldres);
+        lastop = foldval;
+        foldres = no_op;
+        if (rc && (rc != (code[foldval] & BC_INST_RET_MASK))) {
+            emit(BC_INST_FORCE | rc);
+        }
+        return;
+    }
+    /* calls leave their result in R; when the result is to be pushed on
+     * the stack right away, turn the call into a variant that does it
+     */
+    if (lastop != no_op) {
+        auto inst = code[lastop];
+        auto rc = std::uint32_t(ret_code(ltype));
+        auto irc = inst & BC_INST_RET_MASK;
+        std::uint32_t nop = 0;
+        switch (inst & BC_INST_OP_MASK) {
+            case BC_INST_COM:
+                nop = BC_INST_COM_ARG;
+                break;
+            case BC_INST_COM_V:
+                nop = BC_INST_COM_V_ARG;
+                break;
+            case BC_INST_CALL:
+                nop = BC_INST_CALL_ARG;
+                break;
+            case BC_INST_MATH:
+                nop = BC_INST_MATH_ARG;
+                break;
+            default:
+                break;
+        }
+        /* forcing twice the same way is the same as forcing once */
+        if (nop && (!irc || (irc == rc))) {
+            code[lastop] = (
+                inst & ~(BC_INST_OP_MASK | BC_INST_RET_MASK)
+            ) | nop | rc;
+            return;
+        }
+    }
+    emit(BC_INST_RESULT_ARG | ret_code(ltype));
+}
+
+/* turn a call that pushes its result back into one that leaves it in R */
+bool gen_state::unfuse_result(std::size_t pos) {
+    if (pos == no_op) {
+        return false;
+    }
+    auto inst = code[pos];
+    std::uint32_t nop = 0;
+    switch (inst & BC_INST_OP_MASK) {
+        case BC_INST_COM_ARG:
+            nop = BC_INST_COM;
+            break;
+        case BC_INST_COM_V_ARG:
+            nop = BC_INST_COM_V;
+            break;
+        case BC_INST_CALL_ARG:
+            nop = BC_INST_CALL;
+            break;
+        case BC_INST_MATH_ARG:
+            nop = BC_INST_MATH;
+            break;
+        default:
+            return false;
+    }
+    code[pos] = (inst & ~BC_INST_OP_MASK) | nop;
+    return true;
+}
+
+/* a peephole pass over the finished code, run by steal_ref
+ *
+ * jumps to unconditional jumps are made to go to the final target right
+ * away, jumps to the next instruction are dropped, and instruction pairs
+ * the generator does not see while emitting are simplified:
+ *
+ * - calls pushing their result followed by BC_INST_RESULT leave it in R
+ * - BC_INST_RESULT_ARG followed by BC_INST_RESULT without forcing is a no-op
+ * - BC_INST_FORCE of a value that was just pushed with that type is a no-op
+ *
+ * pairs are never merged across a jump target or a block boundary; once
+ * something is dropped, the code is compacted and jumps, block lengths
+ * and block offsets are adjusted accordingly
+ */
+void gen_state::optimize() {
+    enum {
+        OPT_TARGET = 1 << 0,
+        OPT_DROP   = 1 << 1
+    };
+    std::size_t len = code.size();
+    auto target = [this](std::size_t i) {
+        return i + 1 + (code[i] >> 8);
+    };
+    auto is_jump = [](std::uint32_t op) {
+        switch (op & BC_INST_OP_MASK) {
+            case BC_INST_JUMP:
+            case BC_INST_JUMP_B:
+            case BC_INST_JUMP_B_R:
+            case BC_INST_JUMP_RESULT:
+                return true;
+            default:
+                break;
+        }
+        return false;
+    };
+    /* per word, only set for the first word of instructions */
+    valbuf<unsigned char> flags{ts.istate};
+    flags.resize(len + 1, 0);
+    /* find the targets and thread the jumps; jumps only go forward */
+    for (std::size_t i = 1; i < len; i += bcode_insn_len(&code[i])) {
+        auto op = code[i];
+        if (is_jump(op)) {
+            auto t = target(i);
+            while ((t < len) && (
+                (code[t] & BC_INST_OP_MASK) == BC_INST_JUMP
+            )) {
+                t = target(t);
+            }
+            code[i] = (op & ~(~std::uint32_t(0) << 8)) | std::uint32_t(
+                (t - i - 1) << 8
+            );
+            flags[t] |= OPT_TARGET;
+        } else if (
+            ((op & BC_INST_OP_MASK) == BC_INST_BLOCK) ||
+            ((op & BC_INST_OP_MASK) == BC_INST_LOOP)
+        ) {
+            /* the code starts past the offset or the loop kind */
+            flags[i + 2] |= OPT_TARGET;
+            flags[target(i)] |= OPT_TARGET;
+        } else if ((op & BC_INST_OP_MASK) == BC_INST_LOOP_COND) {
+            /* the loop body, past the dead words */
+            flags[i + 3] |= OPT_TARGET;
+        }
+    }
+    /* find what to drop */
+    bool dropped = false;
+    std::size_t prev = no_op;
+    for (std::size_t i = 1; i < len; i += bcode_insn_len(&code[i])) {
+        auto op = code[i];
+        auto rc = op & BC_INST_RET_MASK;
+        if (flags[i] & OPT_TARGET) {
+            prev = no_op;
+        }
+        if (
+            ((op & BC_INST_OP_MASK) == BC_INST_JUMP) && (target(i) == (i + 1))
+        ) {
+            flags[i] |= OPT_DROP;
+            dropped = true;
+            continue;
+        }
+        if (prev == no_op) {
+            prev = i;
+            continue;
+        }
+        auto pop = code[prev];
+        auto prc = pop & BC_INST_RET_MASK;
+        switch (op & BC_INST_OP_MASK) {
+            case BC_INST_RESULT: {
+                std::uint32_t nop = 0;
+                switch (pop & BC_INST_OP_MASK) {
+                    case BC_INST_COM_ARG:
+                        nop = BC_INST_COM;
+                        break;
+                    case BC_INST_COM_V_ARG:
+                        nop = BC_INST_COM_V;
+                        break;
+                    case BC_INST_CALL_ARG:
+                        nop = BC_INST_CALL;
+                        break;
+                    case BC_INST_MATH_ARG:
+                        nop = BC_INST_MATH;
+                        break;
+                    case BC_INST_RESULT_ARG:
+                        if (!prc && !rc) {
+                            flags[prev] |= OPT_DROP;
+                            flags[i] |= OPT_DROP;
+                            dropped = true;
+                            prev = no_op;
+                            continue;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                /* forcing twice the same way is the same as forcing once */
+                if (nop && (!prc || !rc || (prc == rc))) {
+                    code[prev] = (pop & ~(
+                        BC_INST_OP_MASK | BC_INST_RET_MASK
+                    )) | nop | (rc ? rc : prc);
+                    flags[i] |= OPT_DROP;
+                    dropped = true;
+                    continue;
+                }
+                break;
+            }
+            case BC_INST_FORCE:
+                switch (pop & BC_INST_OP_MASK) {
+                    case BC_INST_VAL:
+                    case BC_INST_VAL_INT:
+                    case BC_INST_DUP:
+                    case BC_INST_RESULT_ARG:
+                    case BC_INST_FORCE:
+                    case BC_INST_LOOKUP:
+                    case BC_INST_LOOKUP_U:
+                    case BC_INST_CONC:
+                    case BC_INST_CONC_W:
+                    case BC_INST_VAR:
+                    case BC_INST_COM_ARG:
+                    case BC_INST_COM_V_ARG:
+                    case BC_INST_CALL_ARG:
+                    case BC_INST_MATH_ARG:
+                        if (rc && (prc == rc)) {
+                            flags[i] |= OPT_DROP;
+                            dropped = true;
+                            continue;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            default:
+                break;
+        }
+        prev = i;
+    }
+    if (!dropped) {
+        return;
+    }
+    /* new position of every word; dropped ones get the next one's */
+    valbuf<std::uint32_t> npos{ts.istate};
+    npos.resize(len + 1);
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < len;) {
+        std::size_t ilen = bcode_insn_len(&code[i]);
+        bool drop = (flags[i] & OPT_DROP);
+        for (std::size_t j = 0; j < ilen; ++j) {
+            npos[i + j] = std::uint32_t(n + (drop ? 0 : j));
+        }
+        if (!drop) {
+            n += ilen;
+        }
+        i += ilen;
+    }
+    npos[len] = std::uint32_t(n);
+    /* compact, nothing is ever moved forward */
+    for (std::size_t i = 0; i < len;) {
+        auto op = code[i];
+        std::size_t ilen = bcode_insn_len(&code[i]);
+        if (flags[i] & OPT_DROP) {
+            i += ilen;
+            continue;
+        }
+        std::uint32_t data = op >> 8;
+        if (is_jump(op) || (
+            ((op & BC_INST_OP_MASK) == BC_INST_BLOCK) ||
+            ((op & BC_INST_OP_MASK) == BC_INST_LOOP)
+        )) {
+            data = npos[target(i)] - npos[i] - 1;
+        } else if ((op & BC_INST_OP_MASK) == BC_INST_OFFSET) {
+            data = npos[i] + 1;
+        }
+        code[npos[i]] = (op & ~(~std::uint32_t(0) << 8)) | (data << 8);
+        for (std::size_t j = 1; j < ilen; ++j) {
+            code[npos[i] + j] = code[i + j];
+        }
+        i += ilen;
+    }
+    code.resize(n);
+    lastop = no_op;
+}
+
+/* run after the peephole pass, see BC_CALL_TAIL; whether the code is run
+ * as an alias and thus whether the call can actually reuse the frame is
+ * only known by the VM
+ */
+void gen_state::mark_tail_calls() {
+    std::size_t len = code.size();
+    auto is_tail = [this, len](std::size_t i) {
+        while (i < len) {
+            auto op = code[i];
+            switch (op & BC_INST_OP_MASK) {
+                case BC_INST_JUMP:
+                    i += 1 + (op >> 8);
+                    break;
+                case BC_INST_EXIT:
+                    if (op & BC_INST_RET_MASK) {
+                        return false;
+                    }
+                    if ((i + 1) == len) {
+                        return true;
+                    }
+                    ++i;
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return false;
+    };
+    for (std::size_t i = 1; i < len; i += bcode_insn_len(&code[i])) {
+        auto op = code[i];
+        if (
+            ((op & BC_INST_OP_MASK) == BC_INST_CALL) &&
+            !(op & BC_INST_RET_MASK) && is_tail(i + 2)
+        ) {
+            code[i + 1] |= BC_CALL_TAIL;
+        }
+    }
 }
 
 void gen_state::gen_force(int ltype) {
-    code.push_back(BC_INST_FORCE | ret_code(ltype, BC_RET_STRING));
+    emit(BC_INST_FORCE | ret_code(ltype, BC_RET_STRING));
 }
 
 void gen_state::gen_not(int ltype) {
-    code.push_back(BC_INST_NOT | ret_code(ltype));
+    emit(BC_INST_NOT | ret_code(ltype));
 }
 
-bool gen_state::gen_if(std::size_t tpos, std::size_t fpos, int ltype) {
+bool gen_state::gen_if(
+    std::size_t cpos, std::size_t tpos, std::size_t fpos, int ltype
+) {
     auto inst1 = code[tpos];
     auto op1 = inst1 & ~BC_INST_RET_MASK;
-    auto tlen = std::uint32_t(fpos - tpos - 1);
+    auto tlen = std::uint32_t((fpos ? fpos : count()) - tpos - 1);
+    /* when the condition is a call, test its result directly in R */
+    auto jop = BC_INST_JUMP_B;
     if (!fpos) {
         if (is_block(tpos, fpos)) {
-            code[tpos] = (tlen << 8) | BC_INST_JUMP_B | BC_INST_FLAG_FALSE;
+            if (unfuse_result(cpos)) {
+                jop = BC_INST_JUMP_B_R;
+            }
+            code[tpos] = (tlen << 8) | jop | BC_INST_FLAG_FALSE;
             code[tpos + 1] = BC_INST_ENTER_RESULT;
             code[tpos + tlen] = (
                 code[tpos + tlen] & ~BC_INST_RET_MASK
@@ -76,8 +403,11 @@ bool gen_state::gen_if(std::size_t tpos, std::size_t fpos, int ltype) {
         auto flen = std::uint32_t(count() - fpos - 1);
         if (is_block(fpos)) {
             if (is_block(tpos, fpos)) {
+                if (unfuse_result(cpos)) {
+                    jop = BC_INST_JUMP_B_R;
+                }
                 code[tpos] = (std::uint32_t(fpos - tpos) << 8)
-                    | BC_INST_JUMP_B | BC_INST_FLAG_FALSE;
+                    | jop | BC_INST_FLAG_FALSE;
                 code[tpos + 1] = BC_INST_ENTER_RESULT;
                 code[tpos + tlen] = (
                     code[tpos + tlen] & ~BC_INST_RET_MASK
@@ -109,7 +439,7 @@ void gen_state::gen_and_or(bool is_or, std::size_t start, int ltype) {
     } else {
         op = (BC_INST_JUMP_RESULT | BC_INST_FLAG_FALSE);
     }
-    code.push_back(op);
+    emit(op);
     std::size_t end = count();
     while ((start + 1) < end) {
         uint32_t len = code[start] >> 8;
@@ -123,28 +453,28 @@ void gen_state::gen_and_or(bool is_or, std::size_t start, int ltype) {
 }
 
 void gen_state::gen_val_null() {
-    code.push_back(BC_INST_VAL_INT | BC_RET_NULL);
+    emit(BC_INST_VAL_INT | BC_RET_NULL);
 }
 
 void gen_state::gen_result_null(int ltype) {
-    code.push_back(BC_INST_NULL | ret_code(ltype));
+    emit(BC_INST_NULL | ret_code(ltype));
 }
 
 void gen_state::gen_result_true(int ltype) {
-    code.push_back(BC_INST_TRUE | ret_code(ltype));
+    emit(BC_INST_TRUE | ret_code(ltype));
 }
 
 void gen_state::gen_result_false(int ltype) {
-    code.push_back(BC_INST_FALSE | ret_code(ltype));
+    emit(BC_INST_FALSE | ret_code(ltype));
 }
 
 void gen_state::gen_val_integer(integer_type v) {
     if (v >= -0x800000 && v <= 0x7FFFFF) {
-        code.push_back(BC_INST_VAL_INT | BC_RET_INT | (v << 8));
+        emit(BC_INST_VAL_INT | BC_RET_INT | (v << 8));
     } else {
         std::uint32_t u[bc_store_size<integer_type>] = {0};
         std::memcpy(u, &v, sizeof(v));
-        code.push_back(BC_INST_VAL | BC_RET_INT);
+        emit(BC_INST_VAL | BC_RET_INT);
         code.append(u, u + bc_store_size<integer_type>);
     }
 }
@@ -155,13 +485,13 @@ void gen_state::gen_val_integer(std::string_view v) {
 
 void gen_state::gen_val_float(float_type v) {
     if (std::floor(v) == v && v >= -0x800000 && v <= 0x7FFFFF) {
-        code.push_back(
+        emit(
             BC_INST_VAL_INT | BC_RET_FLOAT | (integer_type(std::floor(v)) << 8)
         );
     } else {
         std::uint32_t u[bc_store_size<float_type>] = {0};
         std::memcpy(u, &v, sizeof(v));
-        code.push_back(BC_INST_VAL | BC_RET_FLOAT);
+        emit(BC_INST_VAL | BC_RET_FLOAT);
         code.append(u, u + bc_store_size<float_type>);
     }
 }
@@ -178,10 +508,10 @@ void gen_state::gen_val_string(std::string_view v) {
             auto c = static_cast<unsigned char>(v[i]);
             op |= std::uint32_t(c) << ((i + 1) * 8);
         }
-        code.push_back(op);
+        emit(op);
         return;
     }
-    code.push_back(BC_INST_VAL | BC_RET_STRING | std::uint32_t(vsz << 8));
+    emit(BC_INST_VAL | BC_RET_STRING | std::uint32_t(vsz << 8));
     std::uint32_t *wp;
     auto *sp = v.data();
     std::memcpy(&wp, &sp, sizeof(wp));
@@ -220,6 +550,7 @@ static void gen_str_filter(
 }
 
 void gen_state::gen_val_string_unescape(std::string_view v) {
+    lastop = code.size();
     gen_str_filter(code, ts, v, [&v](auto *buf) {
         auto *wbuf = unescape_string(buf, v);
         return std::size_t(wbuf - buf);
@@ -227,6 +558,7 @@ void gen_state::gen_val_string_unescape(std::string_view v) {
 }
 
 void gen_state::gen_val_block(std::string_view v) {
+    lastop = code.size();
     gen_str_filter(code, ts, v, [&v, this](auto *buf) {
         auto *str = v.data();
         auto *send = v.data() + v.size();
@@ -289,7 +621,7 @@ void gen_state::gen_val_ident() {
 }
 
 void gen_state::gen_val_ident(ident &i) {
-    code.push_back(BC_INST_IDENT | (i.index() << 8));
+    emit(BC_INST_IDENT | (i.index() << 8));
 }
 
 void gen_state::gen_val_ident(std::string_view v) {
@@ -335,39 +667,70 @@ void gen_state::gen_val(
 }
 
 void gen_state::gen_lookup_var(ident &id, int ltype) {
-    code.push_back(
+    emit(
         BC_INST_VAR | ret_code(ltype) | (id.index() << 8)
     );
 }
 
 void gen_state::gen_lookup_alias(ident &id, int ltype, int dtype) {
-    code.push_back(
+    emit(
         BC_INST_LOOKUP | ret_code(ltype, ret_code(dtype)) | (id.index() << 8)
     );
 }
 
 void gen_state::gen_lookup_ident(int ltype) {
-    code.push_back(BC_INST_LOOKUP_U | ret_code(ltype));
+    emit(BC_INST_LOOKUP_U | ret_code(ltype));
+    /* lookup cache */
+    code.push_back(0);
 }
 
 void gen_state::gen_assign_alias(ident &id) {
-    code.push_back(BC_INST_ALIAS | (id.index() << 8));
+    auto idx = std::uint32_t(id.index() << 8);
+    if (lastop != no_op) {
+        auto inst = code[lastop];
+        switch (inst & BC_INST_OP_MASK) {
+            case BC_INST_VAL:
+            case BC_INST_VAL_INT:
+                /* a literal, assign it without pushing it first; the
+                 * literal is always the last thing in the buffer and
+                 * nothing refers past its start yet, so this is safe
+                 */
+                code.insert(lastop, BC_INST_ALIAS_VAL | idx);
+                ++lastop;
+                return;
+            case BC_INST_RESULT_ARG:
+                if (!(inst & BC_INST_RET_MASK)) {
+                    code[lastop] = BC_INST_ALIAS_RESULT | idx;
+                    return;
+                }
+                break;
+            default:
+                if (unfuse_result(lastop)) {
+                    emit(BC_INST_ALIAS_RESULT | idx);
+                    return;
+                }
+                break;
+        }
+    }
+    emit(BC_INST_ALIAS | idx);
 }
 
 void gen_state::gen_assign() {
-    code.push_back(BC_INST_ALIAS_U);
+    emit(BC_INST_ALIAS_U);
 }
 
 void gen_state::gen_compile(bool cond) {
+    /* the code may be anything, doargs included */
+    code[0] |= BC_START_DOARGS;
     if (cond) {
-        code.push_back(BC_INST_COND);
+        emit(BC_INST_COND);
     } else {
-        code.push_back(BC_INST_COMPILE);
+        emit(BC_INST_COMPILE);
     }
 }
 
 void gen_state::gen_ident_lookup() {
-    code.push_back(BC_INST_IDENT_U);
+    emit(BC_INST_IDENT_U);
 }
 
 void gen_state::gen_concat(std::size_t concs, bool space, int ltype) {
@@ -375,11 +738,11 @@ void gen_state::gen_concat(std::size_t concs, bool space, int ltype) {
         return;
     }
     if (space) {
-        code.push_back(
+        emit(
             BC_INST_CONC | ret_code(ltype) | std::uint32_t(concs << 8)
         );
     } else {
-        code.push_back(
+        emit(
             BC_INST_CONC_W | ret_code(ltype) | std::uint32_t(concs << 8)
         );
     }
@@ -388,39 +751,162 @@ void gen_state::gen_concat(std::size_t concs, bool space, int ltype) {
 void gen_state::gen_command_call(
     ident &id, int comt, int ltype, std::uint32_t nargs
 ) {
-    code.push_back(comt | ret_code(ltype) | (id.index() << 8));
+    /* only pure commands are sure not to run any code of their own */
+    if (!(ident_p{id}.impl().p_flags & IDENT_FLAG_PURE)) {
+        code[0] |= BC_START_DOARGS;
+    }
+    emit(comt | ret_code(ltype) | (id.index() << 8));
     if (comt != BC_INST_COM) {
         code.push_back(nargs);
     }
 }
 
+/* a call to a pure command whose arguments (starting at apos) are all
+ * literals is run right away and replaced with its result, which is left
+ * in R like the call would; false if the call cannot be folded, in which
+ * case nothing is changed
+ */
+bool gen_state::gen_command_fold(
+    command_impl &id, std::size_t apos, std::uint32_t nargs, int ltype
+) {
+    if ((opt_level < 1) || !(id.p_flags & IDENT_FLAG_PURE)) {
+        return false;
+    }
+    auto &cs = *ts.pstate;
+    valbuf<any_value> args{ts.istate};
+    auto *end = code.data() + code.size();
+    for (auto *ip = code.data() + apos; ip != end;) {
+        switch (*ip & BC_INST_OP_MASK) {
+            case BC_INST_VAL:
+            case BC_INST_VAL_INT:
+                break;
+            default:
+                return false;
+        }
+        ip = vm_get_literal(cs, *ip, ip + 1, args.emplace_back());
+    }
+    if (args.size() != nargs) {
+        return false;
+    }
+    any_value res{};
+    try {
+        id.call_id(ts, span_type<any_value>{args.data(), args.size()}, res);
+    } catch (error const &) {
+        /* leave it to be raised at runtime */
+        return false;
+    }
+    switch (res.type()) {
+        case value_type::NONE:
+        case value_type::INTEGER:
+        case value_type::FLOAT:
+        case value_type::STRING:
+            break;
+        default:
+            /* not a literal */
+            return false;
+    }
+    /* force it like the VM would */
+    switch (ltype) {
+        case VAL_STRING:
+            res.force_string(cs);
+            break;
+        case VAL_INT:
+            res.force_integer();
+            break;
+        case VAL_FLOAT:
+            res.force_float();
+            break;
+        default:
+            break;
+    }
+    code.resize(apos);
+    switch (res.type()) {
+        case value_type::INTEGER:
+            gen_val_integer(res.get_integer());
+            break;
+        case value_type::FLOAT:
+            gen_val_float(res.get_float());
+            break;
+        case value_type::STRING:
+            gen_val_string(res.get_string(cs));
+            break;
+        default:
+            gen_val_null();
+            break;
+    }
+    foldval = lastop;
+    emit(BC_INST_RESULT);
+    foldres = lastop;
+    return true;
+}
+
+void gen_state::gen_math(std::uint32_t mop, int ltype) {
+    emit(BC_INST_MATH | ret_code(ltype) | (mop << 8));
+}
+
+/* a loop builtin whose code is given as literal blocks, the body being
+ * the last thing emitted, starting at bpos, and the condition (if the
+ * loop has one) right before it at cpos; the blocks are turned into the
+ * code of BC_INST_LOOP in place, with the BC_INST_BLOCK and BC_INST_OFFSET
+ * of the body becoming dead words skipped by BC_INST_LOOP_COND
+ */
+bool gen_state::gen_loop(
+    std::uint32_t kind, std::size_t cpos, std::size_t bpos, int ltype
+) {
+    if ((bpos == no_op) || !is_block(bpos)) {
+        return false;
+    }
+    std::size_t first = bpos;
+    if (kind & BC_LOOP_COND) {
+        if ((cpos == no_op) || !is_block(cpos, bpos)) {
+            return false;
+        }
+        code[bpos - 1] = BC_INST_LOOP_COND;
+        code[bpos] = BC_INST_OFFSET | std::uint32_t((bpos + 1) << 8);
+        first = cpos;
+    }
+    auto end = count();
+    code[first] = BC_INST_LOOP | ret_code(ltype) | std::uint32_t(
+        (end - first - 1) << 8
+    );
+    code[first + 1] = kind;
+    code[end - 1] = BC_INST_EXIT;
+    lastop = first;
+    return true;
+}
+
 void gen_state::gen_alias_call(ident &id, std::uint32_t nargs) {
-    code.push_back(BC_INST_CALL | (id.index() << 8));
+    emit(BC_INST_CALL | (id.index() << 8));
     code.push_back(nargs);
 }
 
 void gen_state::gen_call(std::uint32_t nargs) {
-    code.push_back(BC_INST_CALL_U | (nargs << 8));
+    /* the ident may be doargs */
+    code[0] |= BC_START_DOARGS;
+    emit(BC_INST_CALL_U | (nargs << 8));
+    /* lookup cache */
+    code.push_back(0);
 }
 
 void gen_state::gen_local(std::uint32_t nargs) {
-    code.push_back(BC_INST_LOCAL | (nargs << 8));
+    emit(BC_INST_LOCAL | (nargs << 8));
 }
 
 void gen_state::gen_do(bool args, int ltype) {
     if (args) {
-        code.push_back(BC_INST_DO_ARGS | ret_code(ltype));
+        code[0] |= BC_START_DOARGS;
+        emit(BC_INST_DO_ARGS | ret_code(ltype));
     } else {
-        code.push_back(BC_INST_DO | ret_code(ltype));
+        emit(BC_INST_DO | ret_code(ltype));
     }
 }
 
 void gen_state::gen_break() {
-    code.push_back(BC_INST_BREAK | BC_INST_FLAG_FALSE);
+    emit(BC_INST_BREAK | BC_INST_FLAG_FALSE);
 }
 
 void gen_state::gen_continue() {
-    code.push_back(BC_INST_BREAK | BC_INST_FLAG_TRUE);
+    emit(BC_INST_BREAK | BC_INST_FLAG_TRUE);
 }
 
 void gen_state::gen_main(std::string_view v, std::string_view src) {
@@ -430,9 +916,9 @@ void gen_state::gen_main(std::string_view v, std::string_view src) {
     auto psrc = ts.source;
     ts.source = src;
     try {
-        code.push_back(BC_INST_START);
+        emit(BC_INST_START);
         ps.parse_block(VAL_ANY);
-        code.push_back(BC_INST_EXIT);
+        emit(BC_INST_EXIT);
     } catch (...) {
         ts.source = psrc;
         throw;
@@ -442,26 +928,26 @@ void gen_state::gen_main(std::string_view v, std::string_view src) {
 
 void gen_state::gen_main_null() {
     code.reserve(code.size() + 4);
-    code.push_back(BC_INST_START);
+    emit(BC_INST_START);
     gen_val_null();
     gen_result();
-    code.push_back(BC_INST_EXIT);
+    emit(BC_INST_EXIT);
 }
 
 void gen_state::gen_main_integer(integer_type v) {
     code.reserve(code.size() + bc_store_size<integer_type> + 3);
-    code.push_back(BC_INST_START);
+    emit(BC_INST_START);
     gen_val_integer(v);
     gen_result();
-    code.push_back(BC_INST_EXIT);
+    emit(BC_INST_EXIT);
 }
 
 void gen_state::gen_main_float(float_type v) {
     code.reserve(code.size() + bc_store_size<float_type> + 3);
-    code.push_back(BC_INST_START);
+    emit(BC_INST_START);
     gen_val_float(v);
     gen_result();
-    code.push_back(BC_INST_EXIT);
+    emit(BC_INST_EXIT);
 }
 
 bool gen_state::is_block(std::size_t idx, std::size_t epos) const {
@@ -474,19 +960,19 @@ bool gen_state::is_block(std::size_t idx, std::size_t epos) const {
 }
 
 void gen_state::gen_block() {
-    code.push_back(BC_INST_EMPTY);
+    emit(BC_INST_EMPTY);
 }
 
 std::pair<std::size_t, std::string_view> gen_state::gen_block(
     std::string_view v, std::size_t line, int ltype, int term
 ) {
     auto csz = code.size();
-    code.push_back(BC_INST_BLOCK);
+    emit(BC_INST_BLOCK);
     /* encodes the offset from the start of the bytecode block
      * this is used for refcounting (subtract the offset, get to
      * the start of the original allocation, i.e. BC_INST_START)
      */
-    code.push_back(BC_INST_OFFSET | std::uint32_t((csz + 2) << 8));
+    emit(BC_INST_OFFSET | std::uint32_t((csz + 2) << 8));
     auto ret_line = line;
     if (!v.empty()) {
         parser_state ps{ts, *this};
@@ -498,13 +984,13 @@ std::pair<std::size_t, std::string_view> gen_state::gen_block(
         ret_line = ps.current_line;
     }
     if (code.size() > (csz + 2)) {
-        code.push_back(BC_INST_EXIT | ret_code(ltype));
+        emit(BC_INST_EXIT | ret_code(ltype));
         /* encode the block size in BC_INST_BLOCK */
         code[csz] |= (std::uint32_t(code.size() - csz - 1) << 8);
     } else {
         /* empty code */
         code.resize(csz);
-        code.push_back(BC_INST_EMPTY | ret_code(ltype));
+        emit(BC_INST_EMPTY | ret_code(ltype));
     }
     return std::make_pair(ret_line, v);
 }
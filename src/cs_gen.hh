@@ -18,11 +18,15 @@ struct gen_state {
 
     gen_state() = delete;
     gen_state(thread_state &tsr):
-        ts{tsr}, code{tsr.istate}
+        ts{tsr}, opt_level{tsr.opt_level}, code{tsr.istate}
     {}
 
+    /* 0 disables optimizations (folding, peephole) */
+    int opt_level;
+
     std::size_t count() const;
     std::uint32_t peek(std::size_t idx) const;
+    std::size_t last_op() const;
 
     bcode_ref steal_ref();
 
@@ -33,7 +37,9 @@ struct gen_state {
     void gen_force(int ltype);
 
     void gen_not(int ltype = 0);
-    bool gen_if(std::size_t tpos, std::size_t fpos, int ltype = 0);
+    bool gen_if(
+        std::size_t cpos, std::size_t tpos, std::size_t fpos, int ltype = 0
+    );
     void gen_and_or(bool is_or, std::size_t start, int ltype = 0);
 
     void gen_val_null();
@@ -76,6 +82,15 @@ struct gen_state {
     void gen_command_call(
         ident &id, int comt, int ltype = 0, std::uint32_t nargs = 0
     );
+    bool gen_command_fold(
+        command_impl &id, std::size_t apos, std::uint32_t nargs,
+        int ltype = 0
+    );
+    void gen_math(std::uint32_t mop, int ltype = 0);
+    bool gen_loop(
+        std::uint32_t kind, std::size_t cpos, std::size_t bpos,
+        int ltype = 0
+    );
     void gen_alias_call(ident &id, std::uint32_t nargs = 0);
     void gen_call(std::uint32_t nargs = 0);
 
@@ -100,8 +115,25 @@ struct gen_state {
         int ltype = VAL_NULL, int term = '\0'
     );
 
+    static constexpr std::size_t no_op = std::size_t(-1);
+
 private:
+    void emit(std::uint32_t op) {
+        lastop = code.size();
+        code.push_back(op);
+    }
+
+    bool unfuse_result(std::size_t pos);
+
+    void optimize();
+    void mark_tail_calls();
+
     valbuf<std::uint32_t> code;
+    /* position of the last instruction (as opposed to data) in code */
+    std::size_t lastop = no_op;
+    /* the last folded call, its value and the BC_INST_RESULT after it */
+    std::size_t foldval = no_op;
+    std::size_t foldres = no_op;
 };
 
 } /* namespace cubescript */
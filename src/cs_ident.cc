@@ -114,7 +114,9 @@ void var_value::steal_value(any_value &v, state &cs) {
         }
         case value_type::STRING: {
             auto sv = v.force_string(cs);
-            var_store<char const *>(p_stor, str_managed_ref(sv.data()));
+            var_store<char const *>(
+                p_stor, str_managed_intern(str_managed_ref(sv.data()))
+            );
             return;
         }
         default:
@@ -182,6 +184,7 @@ alias_impl::alias_impl(
     ident_impl{ident_type::ALIAS, name, fl}, p_initial{}
 {
     p_initial.val_s.set_string(a, cs);
+    any_value_p{p_initial.val_s}.intern();
 }
 
 alias_impl::alias_impl(state &, string_ref name, integer_type a, int fl):
@@ -206,14 +209,19 @@ alias_impl::alias_impl(state &, string_ref name, any_value v, int fl):
     ident_impl{ident_type::ALIAS, name, fl}, p_initial{}
 {
     p_initial.val_s = v.get_plain();
+    any_value_p{p_initial.val_s}.intern();
 }
 
 command_impl::command_impl(
-    string_ref name, string_ref args, int nargs, command_func f
+    string_ref name, string_ref args, int nargs,
+    command_plan const &plan, command_func f
 ):
     ident_impl{ident_type::COMMAND, name, 0},
-    p_cargs{args}, p_cb_cftv{std::move(f)}, p_numargs{nargs}
-{}
+    p_cargs{args}, p_cb_cftv{std::move(f)}, p_numargs{nargs}, p_plan{plan}
+{
+    /* the argument types are the format string itself */
+    p_plan.steps = p_cargs.data();
+}
 
 void var_changed(thread_state &ts, builtin_var &id, any_value &oldval) {
     auto *cid = ts.istate->cmd_var_changed;
@@ -285,6 +293,7 @@ void alias_stack::set_arg(alias *a, thread_state &ts, any_value &v) {
 }
 
 void alias_stack::set_alias(alias *a, thread_state &ts, any_value &v) {
+    any_value_p{v}.intern();
     node->val_s = std::move(v);
     node->code = bcode_ref{};
     flags = ts.ident_flags;
@@ -467,7 +476,9 @@ LIBCUBESCRIPT_EXPORT any_value alias::call(
     auto nargs = args.size();
     auto &ast = ts.get_astack(this);
     if (ast.node->val_s.type() != value_type::NONE) {
-        return exec_alias(ts, this, &args[0], nargs, ast);
+        auto ret = exec_alias(ts, this, &args[0], nargs, ast);
+        raise_loop_ctl(ts);
+        return ret;
     }
     return any_value{};
 }
@@ -490,10 +501,10 @@ LIBCUBESCRIPT_EXPORT any_value command::call(
     }
     auto nargs = args.size();
     auto &ts = state_p{cs}.ts();
-    if (nargs < std::size_t(cimpl.arg_count())) {
+    if (nargs < cimpl.p_plan.nfixed) {
         auto &targs = ts.vmstack;
         auto osz = targs.size();
-        targs.resize(osz + cimpl.arg_count());
+        targs.resize(osz + cimpl.p_plan.nfixed);
         try {
             for (std::size_t i = 0; i < nargs; ++i) {
                 targs[osz + i] = args[i];
@@ -544,6 +555,7 @@ LIBCUBESCRIPT_EXPORT bool alias_local::set(any_value val) {
     if (!p_alias) {
         return false;
     }
+    any_value_p{val}.intern();
     static_cast<alias_stack *>(p_sp)->node->val_s = std::move(val);
     return true;
 }
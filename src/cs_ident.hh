@@ -70,7 +70,11 @@ enum {
     IDENT_FLAG_READONLY   = 1 << 2,
     IDENT_FLAG_OVERRIDE   = 1 << 3,
     IDENT_FLAG_OVERRIDDEN = 1 << 4,
-    IDENT_FLAG_PERSIST    = 1 << 5
+    IDENT_FLAG_PERSIST    = 1 << 5,
+    /* commands whose result only depends on their arguments and which
+     * have no side effects; calls with literal arguments get folded
+     */
+    IDENT_FLAG_PURE       = 1 << 6
 };
 
 struct ident_stack {
@@ -139,9 +143,23 @@ struct alias_impl: ident_impl, alias {
     ident_stack p_initial;
 };
 
+/* a command's format string, compiled once by state::new_command so that
+ * neither calls (exec_command) nor the parser have to interpret it again:
+ * the first nfixed characters of the format are the argument types, the
+ * last nrep of these repeat for as long as there are arguments left, and
+ * a variadic command takes whatever arguments remain after that
+ */
+struct command_plan {
+    char const *steps = nullptr;
+    std::size_t nfixed = 0;
+    std::size_t nrep = 0;
+    bool variadic = false;
+};
+
 struct command_impl: ident_impl, command {
     command_impl(
-        string_ref name, string_ref args, int numargs, command_func func
+        string_ref name, string_ref args, int numargs,
+        command_plan const &plan, command_func func
     );
 
     void call_id(
@@ -151,6 +169,11 @@ struct command_impl: ident_impl, command {
     string_ref p_cargs;
     command_func p_cb_cftv;
     int p_numargs;
+    command_plan p_plan;
+    /* for builtins compiled into BC_INST_MATH, the operation */
+    std::uint32_t p_mathop = 0;
+    /* for loop builtins compiled into BC_INST_LOOP, the kind of loop */
+    std::uint32_t p_loop = 0;
 };
 
 bool ident_is_used_arg(ident const *id, thread_state &ts);
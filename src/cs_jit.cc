@@ -0,0 +1,252 @@
+#include "cs_jit.hh"
+#include "cs_bcode.hh"
+#include "cs_thread.hh"
+
+#include <cstring>
+#include <exception>
+#include <initializer_list>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace cubescript {
+
+/* the generated code is laid out as follows:
+ *
+ * entry:    push rbx            ; keeps the thread state, also aligns
+ *           mov rbx, rdi        ; the stack for the helper calls
+ *           jmp rsi             ; the instruction to start with
+ * leave:    pop rbx
+ *           ret                 ; eax is the status
+ *
+ * followed by the instructions in bytecode order, each being one of:
+ *
+ *           mov rdi, rbx        ; plain instructions
+ *           mov rsi, ip
+ *           mov rax, helper
+ *           call rax
+ *           test eax, eax
+ *           jnz leave
+ *
+ *           ...                 ; conditional jumps
+ *           call rax
+ *           test eax, eax
+ *           jz next
+ *           cmp eax, JIT_JUMP
+ *           je target
+ *           jmp leave
+ * next:
+ *
+ *           jmp target          ; BC_INST_JUMP
+ *
+ * with BC_INST_BLOCK being a plain instruction (which pushes the block)
+ * followed by a jump past the block, whose code is compiled too, as it
+ * may be run on its own; BC_INST_START and BC_INST_OFFSET emit nothing
+ */
+
+using jit_entry = int (*)(thread_state *ts, unsigned char *resume);
+
+struct jit_block {
+    internal_state *cs;
+    /* executable memory */
+    unsigned char *mem;
+    std::size_t msize;
+    /* the bytecode allocation it was compiled from */
+    std::uint32_t *start;
+    std::size_t len;
+    /* offset into mem of each instruction, by its offset from start */
+    std::uint32_t *map;
+};
+
+static constexpr std::uint32_t JIT_NO_OFFSET = ~std::uint32_t(0);
+
+static constexpr std::size_t JIT_LEAVE = 6;
+
+/* number of words taken up by the instruction at ip, or 0 if it would
+ * not fit in the end of the code
+ */
+static std::size_t jit_insn_len(std::uint32_t *ip, std::uint32_t *end) {
+    if (((*ip & BC_INST_OP_MASK) == BC_INST_ALIAS_VAL) && ((ip + 1) >= end)) {
+        return 0;
+    }
+    std::size_t n = bcode_insn_len(ip);
+    if (std::size_t(end - ip) < n) {
+        return 0;
+    }
+    return n;
+}
+
+struct jit_emitter {
+    jit_emitter(internal_state *cs): buf{cs}, fixups{cs} {}
+
+    void put(std::initializer_list<unsigned char> bytes) {
+        for (auto b: bytes) {
+            buf.push_back(b);
+        }
+    }
+
+    void put32(std::uint32_t v) {
+        for (std::size_t i = 0; i < 4; ++i) {
+            buf.push_back((v >> (i * 8)) & 0xFF);
+        }
+    }
+
+    template<typename T>
+    void put64(T v) {
+        static_assert(sizeof(T) == 8);
+        std::uint64_t u;
+        std::memcpy(&u, &v, sizeof(u));
+        for (std::size_t i = 0; i < 8; ++i) {
+            buf.push_back((u >> (i * 8)) & 0xFF);
+        }
+    }
+
+    /* rel32 to the given position in the code */
+    void rel32(std::size_t pos) {
+        put32(std::uint32_t(pos - (buf.size() + 4)));
+    }
+
+    /* rel32 to the given instruction, filled in once compiled */
+    void rel32_insn(std::size_t idx) {
+        fixups.push_back(fixup{buf.size(), idx});
+        put32(0);
+    }
+
+    void call(std::uint32_t *ip, jit_helper f) {
+        put({0x48, 0x89, 0xDF});       /* mov rdi, rbx */
+        put({0x48, 0xBE}); put64(ip);  /* mov rsi, ip */
+        put({0x48, 0xB8}); put64(f);   /* mov rax, f */
+        put({0xFF, 0xD0});             /* call rax */
+        put({0x85, 0xC0});             /* test eax, eax */
+    }
+
+    struct fixup {
+        std::size_t pos;
+        std::size_t idx;
+    };
+
+    valbuf<unsigned char> buf;
+    valbuf<fixup> fixups;
+};
+
+jit_block *jit_compile(
+    internal_state *cs, std::uint32_t *start, std::size_t len,
+    jit_helper const *helpers
+) {
+    if ((len < 2) || (len >= JIT_NO_OFFSET)) {
+        return nullptr;
+    }
+    auto *end = start + len;
+    std::uint32_t *map = std_allocator<std::uint32_t>{cs}.allocate(len);
+    for (std::size_t i = 0; i < len; ++i) {
+        map[i] = JIT_NO_OFFSET;
+    }
+    jit_emitter e{cs};
+    e.put({0x53});             /* push rbx */
+    e.put({0x48, 0x89, 0xFB}); /* mov rbx, rdi */
+    e.put({0xFF, 0xE6});       /* jmp rsi */
+    e.put({0x5B});             /* leave: pop rbx */
+    e.put({0xC3});             /* ret */
+    bool ok = true;
+    /* the allocation starts with BC_INST_START, which is its refcount */
+    for (std::uint32_t *ip = start + 1; ip < end;) {
+        std::size_t n = jit_insn_len(ip, end);
+        if (!n) {
+            ok = false;
+            break;
+        }
+        std::size_t idx = std::size_t(ip - start);
+        map[idx] = std::uint32_t(e.buf.size());
+        std::uint32_t op = *ip;
+        switch (op & BC_INST_OP_MASK) {
+            case BC_INST_START:
+            case BC_INST_OFFSET:
+                break;
+            case BC_INST_JUMP:
+                e.put({0xE9}); /* jmp target */
+                e.rel32_insn(idx + 1 + (op >> 8));
+                break;
+            case BC_INST_JUMP_B:
+            case BC_INST_JUMP_B_R:
+            case BC_INST_JUMP_RESULT:
+                e.call(ip, helpers[op & BC_INST_OP_MASK]);
+                e.put({0x74, 14});             /* jz next */
+                e.put({0x83, 0xF8, JIT_JUMP}); /* cmp eax, JIT_JUMP */
+                e.put({0x0F, 0x84});           /* je target */
+                e.rel32_insn(idx + 1 + (op >> 8));
+                e.put({0xE9});                 /* jmp leave */
+                e.rel32(JIT_LEAVE);
+                break;
+            case BC_INST_BLOCK:
+                e.call(ip, helpers[BC_INST_BLOCK]);
+                e.put({0x0F, 0x85});           /* jnz leave */
+                e.rel32(JIT_LEAVE);
+                e.put({0xE9});                 /* jmp past the block */
+                e.rel32_insn(idx + 1 + (op >> 8));
+                break;
+            default:
+                e.call(ip, helpers[op & BC_INST_OP_MASK]);
+                e.put({0x0F, 0x85});           /* jnz leave */
+                e.rel32(JIT_LEAVE);
+                break;
+        }
+        ip += n;
+    }
+    /* jumps only go forward, and must land on an instruction */
+    for (std::size_t i = 0; ok && (i < e.fixups.size()); ++i) {
+        auto &fx = e.fixups[i];
+        if ((fx.idx >= len) || (map[fx.idx] == JIT_NO_OFFSET)) {
+            ok = false;
+            break;
+        }
+        auto rel = std::uint32_t(map[fx.idx] - (fx.pos + 4));
+        for (std::size_t j = 0; j < 4; ++j) {
+            e.buf[fx.pos + j] = (rel >> (j * 8)) & 0xFF;
+        }
+    }
+    void *mem = MAP_FAILED;
+    std::size_t psize = std::size_t(sysconf(_SC_PAGESIZE));
+    std::size_t msize = (e.buf.size() + psize - 1) / psize * psize;
+    if (ok) {
+        mem = mmap(
+            nullptr, msize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+        );
+    }
+    if (mem == MAP_FAILED) {
+        std_allocator<std::uint32_t>{cs}.deallocate(map, len);
+        return nullptr;
+    }
+    std::memcpy(mem, e.buf.data(), e.buf.size());
+    if (mprotect(mem, msize, PROT_READ | PROT_EXEC)) {
+        munmap(mem, msize);
+        std_allocator<std::uint32_t>{cs}.deallocate(map, len);
+        return nullptr;
+    }
+    auto *b = std_allocator<jit_block>{cs}.allocate(1);
+    b->cs = cs;
+    b->mem = static_cast<unsigned char *>(mem);
+    b->msize = msize;
+    b->start = start;
+    b->len = len;
+    b->map = map;
+    return b;
+}
+
+void jit_free(jit_block *b) {
+    munmap(b->mem, b->msize);
+    std_allocator<std::uint32_t>{b->cs}.deallocate(b->map, b->len);
+    std_allocator<jit_block>{b->cs}.deallocate(b, 1);
+}
+
+int jit_run(thread_state &ts, jit_block *b, std::uint32_t *code) {
+    jit_entry f;
+    std::memcpy(&f, &b->mem, sizeof(f));
+    int ret = f(&ts, b->mem + b->map[code - b->start]);
+    if (ret == JIT_ERROR) {
+        std::rethrow_exception(std::exchange(ts.jit_error, nullptr));
+    }
+    return ret;
+}
+
+} /* namespace cubescript */
@@ -0,0 +1,66 @@
+#ifndef LIBCUBESCRIPT_JIT_HH
+#define LIBCUBESCRIPT_JIT_HH
+
+#include <cubescript/cubescript.hh>
+
+#include <cstdint>
+#include <cstddef>
+
+namespace cubescript {
+
+struct thread_state;
+struct internal_state;
+
+/* a baseline JIT for x86-64, enabled at build time (the jit option)
+ *
+ * once a bytecode allocation gets hot (see vm_jit_enter), it is compiled
+ * as a whole into native code: every instruction becomes a call to its
+ * helper (vm_jit_ops in cs_vm.cc, which shares its code with vm_exec),
+ * and jumps become native jumps, which gets rid of instruction dispatch
+ * and decoding; the native code keeps no state of its own across
+ * instructions, everything is in the thread state and the VM frames
+ * just like when interpreting, so it can be entered at any instruction
+ * and handed back to the interpreter at any instruction
+ *
+ * helpers return one of the following; anything other than JIT_NEXT
+ * leaves the native code, with ts.jit_code set to where the interpreter
+ * is to continue
+ */
+enum {
+    /* go on with the next instruction */
+    JIT_NEXT = 0,
+    /* BC_INST_EXIT was run, leave the current frame */
+    JIT_EXIT,
+    /* a frame running other code was pushed, run that code */
+    JIT_PUSH,
+    /* the instruction has no helper, interpret it */
+    JIT_INTERP,
+    /* an exception was raised, it is stored in ts.jit_error */
+    JIT_ERROR,
+    /* a conditional jump is taken, for jump instructions only */
+    JIT_JUMP
+};
+
+/* helpers take the address of the instruction, indexed by opcode */
+using jit_helper = int (*)(thread_state &ts, std::uint32_t *ip);
+
+struct jit_block;
+
+/* compile the allocation of the given length, starting with its
+ * BC_INST_START; null if it cannot be compiled
+ */
+jit_block *jit_compile(
+    internal_state *cs, std::uint32_t *start, std::size_t len,
+    jit_helper const *helpers
+);
+
+void jit_free(jit_block *b);
+
+/* run the native code of the block starting with the instruction at
+ * code, returning the status that has made it leave; errors are thrown
+ */
+int jit_run(thread_state &ts, jit_block *b, std::uint32_t *code);
+
+} /* namespace cubescript */
+
+#endif /* LIBCUBESCRIPT_JIT_HH */
@@ -0,0 +1,147 @@
+#include <cubescript/cubescript.hh>
+
+#include <iterator>
+
+#include "cs_list.hh"
+#include "cs_strman.hh"
+#include "cs_thread.hh"
+
+namespace cubescript {
+
+list_cache::~list_cache() {
+    /* indexes of strings that are still around when the state goes */
+    for (auto &p: indexes) {
+        cstate->destroy(p.second);
+    }
+}
+
+list_index *list_cache::get(char const *str) {
+    mtx_guard l{p_mtx};
+    auto it = indexes.find(str);
+    if (it != indexes.end()) {
+        return it->second;
+    }
+    auto *idx = cstate->create<list_index>(cstate);
+    indexes.emplace(str, idx);
+    str_managed_set_indexed(str);
+    return idx;
+}
+
+void list_cache::drop(char const *str) {
+    list_index *idx;
+    {
+        mtx_guard l{p_mtx};
+        auto it = indexes.find(str);
+        if (it == indexes.end()) {
+            return;
+        }
+        idx = it->second;
+        indexes.erase(it);
+    }
+    cstate->destroy(idx);
+}
+
+list_indexer::list_indexer(state &cs, string_ref const &str):
+    p_state{&cs}, p_str{str}, p_list{str}
+{
+    auto *istate = state_p{cs}.ts().istate;
+    p_own = str_managed_transient(p_str.data());
+    if (p_own) {
+        p_index = istate->create<list_index>(istate);
+    } else {
+        p_index = istate->lists->get(p_str.data());
+    }
+}
+
+list_indexer::~list_indexer() {
+    if (p_own) {
+        state_p{*p_state}.ts().istate->destroy(p_index);
+    }
+}
+
+/* parse items until there are at least the given number, or no more */
+void list_indexer::fill(std::size_t nitems) {
+    auto &idx = *p_index;
+    if (idx.done || (idx.items.size() >= nitems)) {
+        return;
+    }
+    char const *base = p_list.data();
+    list_parser p{*p_state, p_list.substr(idx.pos)};
+    while (idx.items.size() < nitems) {
+        /* where the item starts, to tell it apart from a stale one */
+        p.skip_until_item();
+        char const *beg = p.input().data();
+        if (!p.parse()) {
+            idx.done = true;
+            break;
+        }
+        auto q = p.quoted_item();
+        list_item it;
+        if (!q.data() || (q.data() < beg)) {
+            /* the parser has hit the end within a bracketed item, and
+             * left the previous item as the current one
+             */
+            if (idx.items.empty()) {
+                it = list_item{0, 0, 0, false};
+            } else {
+                it = idx.items.back();
+            }
+        } else {
+            it.qbeg = std::size_t(q.data() - base);
+            it.qend = it.qbeg + q.size();
+            it.quoted = (p.raw_item().data() != q.data());
+        }
+        idx.pos = it.next = std::size_t(p.input().data() - base);
+        idx.items.push_back(it);
+    }
+    /* where the failed parse has left the parser */
+    idx.pos = std::size_t(p.input().data() - base);
+}
+
+bool list_indexer::get(std::size_t idx, list_item &ret) {
+    mtx_guard l{p_index->mtx};
+    fill(idx + 1);
+    if (idx >= p_index->items.size()) {
+        return false;
+    }
+    ret = p_index->items[idx];
+    return true;
+}
+
+std::size_t list_indexer::count() {
+    mtx_guard l{p_index->mtx};
+    fill(std::size_t(-1));
+    return p_index->items.size();
+}
+
+std::size_t list_indexer::after(std::size_t nitems) {
+    if (!nitems) {
+        return 0;
+    }
+    mtx_guard l{p_index->mtx};
+    fill(nitems);
+    if (nitems <= p_index->items.size()) {
+        return p_index->items[nitems - 1].next;
+    }
+    /* parsing has failed, after skipping to where the next item was
+     * to be; if this is not done yet, it will be
+     */
+    return p_index->pos;
+}
+
+std::size_t list_indexer::skip(std::size_t pos) const {
+    list_parser p{*p_state, p_list.substr(pos)};
+    p.skip_until_item();
+    return std::size_t(p.input().data() - p_list.data());
+}
+
+string_ref list_indexer::get_item(list_item const &it) const {
+    if ((it.qbeg != it.qend) && (p_list[it.qbeg] == '"')) {
+        charbuf buf{*p_state};
+        unescape_string(std::back_inserter(buf), raw_item(it));
+        return string_ref{*p_state, buf.str()};
+    }
+    return string_ref{*p_state, raw_item(it)};
+}
+
+} /* namespace cubescript */
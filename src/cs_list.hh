@@ -0,0 +1,130 @@
+#ifndef LIBCUBESCRIPT_LIST_HH
+#define LIBCUBESCRIPT_LIST_HH
+
+#include <cubescript/cubescript.hh>
+
+#include <cstddef>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+#include "cs_std.hh"
+#include "cs_lock.hh"
+
+namespace cubescript {
+
+/* an item of an indexed list, as offsets into the list string */
+struct list_item {
+    /* the item including its quotes or brackets, if any */
+    std::size_t qbeg, qend;
+    /* where the parser looks for the next item */
+    std::size_t next;
+    /* the quotes or brackets are not a part of the raw item */
+    bool quoted;
+};
+
+/* the items of a list string, as far as it has been parsed so far; the
+ * list is only parsed as far as it is accessed, so that errors in the
+ * list are raised exactly when parsing it item by item would raise them
+ */
+struct list_index {
+    list_index(internal_state *cs): items{cs} {}
+
+    mutex_type mtx{};
+    valbuf<list_item> items;
+    /* where parsing continues */
+    std::size_t pos = 0;
+    /* there are no more items past the parsed ones */
+    bool done = false;
+};
+
+/* indexes of list strings, kept around until the strings are gone
+ *
+ * lists are commonly stored in aliases and accessed by index over and
+ * over (at, sublist, listsplice...), which would parse all the items
+ * before the accessed one every time; interned strings are the same
+ * string if and only if they have the same address, so they are used as
+ * the keys, and the index of a string is dropped when the last reference
+ * to the string is (see string_pool::internal_unref)
+ */
+struct list_cache {
+    using allocator_type = std_allocator<
+        std::pair<char const * const, list_index *>
+    >;
+
+    list_cache(internal_state *cs): cstate{cs}, indexes{allocator_type{cs}} {}
+    ~list_cache();
+
+    list_cache(list_cache const &) = delete;
+    list_cache &operator=(list_cache const &) = delete;
+
+    /* the index of the given interned string, made if it has none yet */
+    list_index *get(char const *str);
+
+    /* drops the index of a string that is going away */
+    void drop(char const *str);
+
+    internal_state *cstate;
+    mutex_type p_mtx{};
+    std::unordered_map<
+        char const *, list_index *, std::hash<char const *>,
+        std::equal_to<char const *>, allocator_type
+    > indexes;
+};
+
+/* indexed access to a list, going through the cached index of the list
+ * string if it is interned, and through an index of its own otherwise
+ * (transient strings are not worth keeping an index for)
+ */
+struct list_indexer {
+    list_indexer(state &cs, string_ref const &str);
+    ~list_indexer();
+
+    list_indexer(list_indexer const &) = delete;
+    list_indexer &operator=(list_indexer const &) = delete;
+
+    std::string_view list() const {
+        return p_list;
+    }
+
+    /* the item at the given index, parsing the list as far as needed;
+     * false if the list has no such item
+     */
+    bool get(std::size_t idx, list_item &ret);
+
+    /* the number of items, which parses the whole list */
+    std::size_t count();
+
+    /* where the parser is after trying to parse the given number of
+     * items, like list_parser::input() would be
+     */
+    std::size_t after(std::size_t nitems);
+
+    /* where the next item starts, like list_parser::skip_until_item() */
+    std::size_t skip(std::size_t pos) const;
+
+    std::string_view raw_item(list_item const &it) const {
+        std::size_t q = it.quoted;
+        return p_list.substr(it.qbeg + q, it.qend - it.qbeg - q * 2);
+    }
+
+    std::string_view quoted_item(list_item const &it) const {
+        return p_list.substr(it.qbeg, it.qend - it.qbeg);
+    }
+
+    /* like list_parser::get_item() */
+    string_ref get_item(list_item const &it) const;
+
+private:
+    void fill(std::size_t nitems);
+
+    state *p_state;
+    string_ref p_str;
+    std::string_view p_list;
+    list_index *p_index;
+    bool p_own;
+};
+
+} /* namespace cubescript */
+
+#endif
@@ -55,6 +55,38 @@ struct atomic_type {
     T operator++(int) {
         return p_v++;
     }
+
+    T fetch_add(T v) {
+        return std::exchange(p_v, p_v + v);
+    }
+
+    T fetch_sub(T v) {
+        return std::exchange(p_v, p_v - v);
+    }
+
+    bool compare_exchange_weak(T &expected, T v) {
+        if (p_v == expected) {
+            p_v = v;
+            return true;
+        }
+        expected = p_v;
+        return false;
+    }
+};
+
+template<typename T>
+struct atomic_ref_type {
+    atomic_ref_type(T &v): p_v{v} {}
+
+    T load() const {
+        return p_v;
+    }
+
+    void store(T v) {
+        p_v = v;
+    }
+
+    T &p_v;
 };
 
 #else
@@ -62,6 +94,8 @@ struct atomic_type {
 using mutex_type = std::mutex;
 template<typename T>
 using atomic_type = std::atomic<T>;
+template<typename T>
+using atomic_ref_type = std::atomic_ref<T>;
 
 #endif
 
@@ -1,12 +1,18 @@
 #include <cubescript/cubescript.hh>
 
+#include <cassert>
 #include <cmath>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <bit>
 #include <limits>
 #include <iterator>
 
 #include "cs_parser.hh"
 #include "cs_error.hh"
+#include "cs_scan.hh"
 
 namespace cubescript {
 
@@ -25,13 +31,18 @@ LIBCUBESCRIPT_EXPORT char const *parse_string(
     char const *orig = beg++;
     ++nl;
     while (beg != end) {
+        /* get to the next character that means anything in a string */
+        beg = scan_find(beg, end, "\r\n\"^\\");
+        if (beg == end) {
+            break;
+        }
         switch (*beg) {
             case '\r':
             case '\n':
             case '\"':
                 goto end;
-            case '^':
-            case '\\': {
+            default: {
+                /* ^ or \ */
                 bool needn = (*beg == '\\');
                 if (++beg == end) {
                     goto end;
@@ -47,12 +58,9 @@ LIBCUBESCRIPT_EXPORT char const *parse_string(
                 } else {
                     ++beg;
                 }
-                continue;
-            }
-            default:
                 break;
+            }
         }
-        ++beg;
     }
 end:
     nlines = nl;
@@ -70,8 +78,7 @@ LIBCUBESCRIPT_EXPORT char const *parse_word(
     char const *it = str.data();
     char const *end = it + str.size();
     for (; it != end; ++it) {
-        std::string_view chrs{"\"/;()[] \t\r\n"};
-        it = std::find_first_of(it, end, chrs.begin(), chrs.end());
+        it = scan_find(it, end, "\"/;()[] \t\r\n");
         if (it == end) {
             return it;
         }
@@ -144,7 +151,86 @@ static inline bool p_check_neg(char const *&input) {
     return neg;
 }
 
+/* SWAR digit parsing: runs of digits are checked and converted 8 at a time
+ * as a single 64-bit word, the first character being in the lowest byte;
+ * on big endian platforms this is not used and everything goes digit by
+ * digit (which is always what happens for the last few digits anyway)
+ */
+
+static constexpr bool p_swar = (std::endian::native == std::endian::little);
+
+static constexpr std::uint64_t p_swar_bcast(unsigned char c) {
+    return std::uint64_t(c) * 0x0101010101010101ULL;
+}
+
+/* loads the next 8 characters, if there are as many left */
+static inline bool p_swar_load(
+    char const *beg, char const *end, std::uint64_t &v
+) {
+    if (!p_swar || ((end - beg) < 8)) {
+        return false;
+    }
+    std::memcpy(&v, beg, sizeof(v));
+    return true;
+}
+
+/* the high bit of every byte that is within the given range is set;
+ * all bytes have to be ASCII, so that nothing carries across bytes
+ */
+static inline std::uint64_t p_swar_in_range(
+    std::uint64_t v, unsigned char lo, unsigned char hi
+) {
+    auto ge = v + p_swar_bcast(0x80 - lo);
+    auto gt = v + p_swar_bcast(0x7F - hi);
+    return ge & ~gt & p_swar_bcast(0x80);
+}
+
+static inline bool p_swar_is_digits(std::uint64_t v) {
+    auto hi = p_swar_bcast(0xF0);
+    return (
+        (v & hi) | (((v + p_swar_bcast(0x06)) & hi) >> 4)
+    ) == p_swar_bcast(0x33);
+}
+
+/* the value of 8 decimal digits */
+static inline std::uint32_t p_swar_dec(std::uint64_t v) {
+    v -= p_swar_bcast('0');
+    v = (v * 10) + (v >> 8);
+    v = (
+        ((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+        (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))
+    ) >> 32;
+    return std::uint32_t(v);
+}
+
+/* the mask of letters if all 8 characters are hex digits, otherwise
+ * something with the lowest bit set (which no letter mask has)
+ */
+static inline std::uint64_t p_swar_xletters(std::uint64_t v) {
+    if (v & p_swar_bcast(0x80)) {
+        return 1;
+    }
+    auto digits = p_swar_in_range(v, '0', '9');
+    auto letters = p_swar_in_range(v | p_swar_bcast(0x20), 'a', 'f');
+    if ((digits | letters) != p_swar_bcast(0x80)) {
+        return 1;
+    }
+    return letters;
+}
+
+/* the value of 8 hex digits, given the mask of letters */
+static inline std::uint32_t p_swar_hex(std::uint64_t v, std::uint64_t lmask) {
+    /* the low nibbles, plus 9 for letters */
+    v = (v & p_swar_bcast(0x0F)) + (lmask >> 7) * 9;
+    /* pairs of nibbles into bytes, then bytes into the 32-bit result */
+    v = ((v & 0x000F000F000F000FULL) << 4) | ((v >> 8) & 0x000F000F000F000FULL);
+    v = ((v & 0x000000FF000000FFULL) << 8) | ((v >> 16) & 0x000000FF000000FFULL);
+    return std::uint32_t(((v & 0xFFFF) << 16) | ((v >> 32) & 0xFFFF));
+}
+
 integer_type parse_int(std::string_view input, std::string_view *endstr) {
+    /* the digits are accumulated with wraparound */
+    using uint_type = std::make_unsigned_t<integer_type>;
     char const *beg = input.begin();
     char const *end = input.end();
     char const *orig = beg;
@@ -154,35 +240,50 @@ integer_type parse_int(std::string_view input, std::string_view *endstr) {
         return integer_type(0);
     }
     bool neg = p_check_neg(beg);
-    integer_type ret = 0;
+    uint_type ret = 0;
     char const *past = beg;
+    std::uint64_t sv;
     if ((end - beg) >= 2) {
         std::string_view pfx = std::string_view{beg, 2};
         if ((pfx == "0x") || (pfx == "0X")) {
             beg += 2;
             past = beg;
+            while (p_swar_load(past, end, sv)) {
+                auto lmask = p_swar_xletters(sv);
+                if (lmask & 1) {
+                    break;
+                }
+                /* shifting by the full width would be undefined */
+                ret = uint_type((std::uint64_t(ret) << 16) << 16);
+                ret = uint_type(ret + p_swar_hex(sv, lmask));
+                past += 8;
+            }
             while ((past != end) && std::isxdigit(*past)) {
-                ret = ret * 16 + p_hexd_to_int(*past++);
+                ret = uint_type(ret * 16 + p_hexd_to_int(*past++));
             }
             goto done;
         } else if ((pfx == "0b") || (pfx == "0B")) {
             beg += 2;
             past = beg;
             while ((past != end) && ((*past == '0') || (*past == '1'))) {
-                ret = ret * 2 + (*past++ - '0');
+                ret = uint_type(ret * 2 + (*past++ - '0'));
             }
             goto done;
         }
     }
+    while (p_swar_load(past, end, sv) && p_swar_is_digits(sv)) {
+        ret = uint_type(ret * uint_type(100000000) + p_swar_dec(sv));
+        past += 8;
+    }
     while ((past != end) && std::isdigit(*past)) {
-        ret = ret * 10 + (*past++ - '0');
+        ret = uint_type(ret * 10 + (*past++ - '0'));
     }
 done:
     p_set_end((past == beg) ? orig : past, end, endstr);
     if (neg) {
-        return -ret;
+        return integer_type(uint_type(-ret));
     }
-    return ret;
+    return integer_type(ret);
 }
 
 template<bool Hex, char e1 = Hex ? 'p' : 'e', char e2 = Hex ? 'P' : 'E'>
@@ -211,30 +312,83 @@ static inline bool p_read_exp(char const *&beg, char const *end, integer_type &f
     return true;
 }
 
+/* powers of ten for the decimal exponents that come up in practice; these
+ * are computed with pow, so the results are exactly what calling it would
+ * give, without the cost
+ */
+static constexpr integer_type P_POW10_MAX = 64;
+
+static inline double p_pow10(integer_type n) {
+    static auto const tbl = []() {
+        std::array<double, P_POW10_MAX * 2 + 1> ret;
+        for (integer_type i = -P_POW10_MAX; i <= P_POW10_MAX; ++i) {
+            ret[i + P_POW10_MAX] = pow(10, i);
+        }
+        return ret;
+    }();
+    if ((n < -P_POW10_MAX) || (n > P_POW10_MAX)) {
+        return pow(10, n);
+    }
+    return tbl[n + P_POW10_MAX];
+}
+
 template<bool Hex>
 static inline bool parse_gen_float(
     char const *&beg, char const *end, std::string_view *endstr, float_type &ret
 ) {
-    auto read_digits = [&beg, end](double r, integer_type &n) {
+    /* the mantissa is accumulated as an integer for as long as a double
+     * holds it exactly, which is when accumulating it digit by digit in a
+     * double would give the same result; the rest goes into the double
+     */
+    constexpr integer_type max_exact = Hex ? 13 : 15;
+    std::uint64_t u = 0;
+    double r = 0.0;
+    integer_type nd = 0;
+    auto read_digits = [&beg, end, &u, &r, &nd](integer_type &n) {
+        std::uint64_t sv;
+        while (((nd + 8) <= max_exact) && p_swar_load(beg, end, sv)) {
+            if (Hex) {
+                auto lmask = p_swar_xletters(sv);
+                if (lmask & 1) {
+                    break;
+                }
+                u = (u << 32) + p_swar_hex(sv, lmask);
+            } else {
+                if (!p_swar_is_digits(sv)) {
+                    break;
+                }
+                u = u * 100000000 + p_swar_dec(sv);
+            }
+            n += 8;
+            nd += 8;
+            beg += 8;
+        }
         while (
             (beg != end) &&
             (Hex ? std::isxdigit(*beg) : std::isdigit(*beg))
         ) {
-            if (Hex) {
-                r = r * 16.0 + double(p_hexd_to_int(*beg));
+            auto d = Hex ? p_hexd_to_int(*beg) : (*beg - '0');
+            if (nd < max_exact) {
+                u = u * (Hex ? 16 : 10) + std::uint64_t(d);
             } else {
-                r = r * 10.0 + double(*beg - '0');
+                if (nd == max_exact) {
+                    r = double(u);
+                }
+                r = r * (Hex ? 16.0 : 10.0) + double(d);
             }
             ++n;
+            ++nd;
             ++beg;
         }
-        return r;
+        if (nd <= max_exact) {
+            r = double(u);
+        }
     };
     integer_type wn = 0, fn = 0;
-    double r = read_digits(0.0, wn);
+    read_digits(wn);
     if ((beg != end) && (*beg == '.')) {
         ++beg;
-        r = read_digits(r, fn);
+        read_digits(fn);
     }
     if (!wn && !fn) {
         return false;
@@ -247,7 +401,7 @@ static inline bool parse_gen_float(
     if (Hex) {
         ret = float_type(ldexp(r, fn * 4));
     } else {
-        ret = float_type(r * pow(10, fn));
+        ret = float_type(r * p_pow10(fn));
     }
     return true;
 }
@@ -341,33 +495,30 @@ std::string_view parser_state::read_macro_name() {
 
 /* advance the parser until we reach any of the given chars, then stop at it */
 char parser_state::skip_until(std::string_view chars) {
-    char c = current();
-    while (c && (chars.find(c) == std::string_view::npos)) {
-        next_char();
-        c = current();
-    }
-    return c;
+    /* zero characters stop it too, like the end of the input */
+    assert((chars.size() + 1) < SCAN_MAX_CHARS);
+    char set[SCAN_MAX_CHARS];
+    std::size_t n = chars.copy(set, chars.size());
+    set[n++] = '\0';
+    source = scan_find(
+        source, send, std::string_view{set, n}, &current_line
+    );
+    return current();
 }
 
 /* advance the parser until we reach the given character, then stop at it */
 char parser_state::skip_until(char cf) {
-    char c = current();
-    while (c && (c != cf)) {
-        next_char();
-        c = current();
-    }
-    return c;
-}
-
-static bool is_hspace(char c) {
-    return (c == ' ') || (c == '\t') || (c == '\r');
+    char set[] = {cf, '\0'};
+    source = scan_find(
+        source, send, std::string_view{set, sizeof(set)}, &current_line
+    );
+    return current();
 }
 
 void parser_state::skip_comments() {
     for (;;) {
-        for (char c = current(); is_hspace(c); c = current()) {
-            next_char();
-        }
+        /* horizontal whitespace */
+        source = scan_skip(source, send, " \t\r");
         if (current() == '\\') {
             char c = current(1);
             if ((c != '\r') && (c != '\n')) {
@@ -387,14 +538,7 @@ void parser_state::skip_comments() {
         if ((current() != '/') || (current(1) != '/')) {
             return;
         }
-        for (;;) {
-            auto c = current();
-            if (c && (c != '\n')) {
-                next_char();
-            } else {
-                break;
-            }
-        }
+        skip_until('\n');
     }
 }
 
@@ -507,30 +651,23 @@ lookup_id:
             return;
         case ident_type::COMMAND: {
             std::uint32_t comtype = BC_INST_COM, numargs = 0;
-            auto fmt = static_cast<command_impl &>(id).args();
-            for (char c: fmt) {
-                switch (c) {
+            auto &plan = static_cast<command_impl &>(id).p_plan;
+            for (std::size_t i = 0; i < plan.nfixed; ++i) {
+                switch (plan.steps[i]) {
                     case '$':
                         gs.gen_val_ident(id);
-                        ++numargs;
                         break;
                     case '#':
                         gs.gen_val_integer(-1);
-                        ++numargs;
-                        break;
-                    case '.':
-                        comtype = BC_INST_COM_V;
-                        break;
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
                         break;
                     default:
                         gs.gen_val_null();
-                        ++numargs;
                         break;
                 }
+                ++numargs;
+            }
+            if (plan.variadic) {
+                comtype = BC_INST_COM_V;
             }
             gs.gen_command_call(id, comtype, ltype, numargs);
             gs.gen_push_result(ltype);
@@ -925,13 +1062,19 @@ bool parser_state::parse_call_command(
     command_impl *id, ident &self, int rettype
 ) {
     std::uint32_t comtype = BC_INST_COM, numargs = 0, fakeargs = 0;
-    auto fmt = id->args();
+    auto &plan = id->p_plan;
+    auto apos = gs.count();
+    /* the last two block arguments, for loops */
+    auto cpos = gs.no_op, bpos = gs.no_op;
     bool more = true, rep = false;
-    for (auto it = fmt.begin(); it != fmt.end(); ++it) {
-        switch (*it) {
+    for (std::size_t i = 0; i < plan.nfixed; ++i) {
+        switch (plan.steps[i]) {
             case 's': /* string */
                 more = parse_cmd_arg(*this, 's', more, rep);
-                if (more && ((it + 1) == fmt.end())) {
+                if (
+                    more && ((i + 1) == plan.nfixed) &&
+                    !plan.nrep && !plan.variadic
+                ) {
                     int numconc = 1;
                     for (;;) {
                         more = parse_arg(VAL_STRING);
@@ -960,28 +1103,12 @@ bool parser_state::parse_call_command(
                 gs.gen_val_integer(numargs - fakeargs);
                 ++numargs;
                 break;
-            case '.': /* varargs */
-                it += 2; /* third will be skipped by the loop */
-                comtype = BC_INST_COM_V;
-                if (more) {
-                    for (;;) {
-                        more = parse_arg(VAL_ANY);
-                        if (!more) {
-                            break;
-                        }
-                        ++numargs;
-                    }
-                }
-                break;
-            case '1': case '2': case '3': case '4': /* vararg repetition */
-                if (more) {
-                    int numrep = *it - '0' + 1;
-                    it -= numrep;
-                    rep = true;
-                }
-                break;
             default:
-                more = parse_cmd_arg(*this, *it, more, rep);
+                if (plan.steps[i] == 'b') {
+                    cpos = bpos;
+                    bpos = gs.count();
+                }
+                more = parse_cmd_arg(*this, plan.steps[i], more, rep);
                 if (!more) {
                     if (!rep) {
                         ++fakeargs;
@@ -992,8 +1119,32 @@ bool parser_state::parse_call_command(
                 ++numargs;
                 break;
         }
+        /* vararg repetition */
+        if (((i + 1) == plan.nfixed) && plan.nrep && more) {
+            i -= plan.nrep;
+            rep = true;
+        }
+    }
+    if (plan.variadic) {
+        comtype = BC_INST_COM_V;
+        if (more) {
+            for (;;) {
+                more = parse_arg(VAL_ANY);
+                if (!more) {
+                    break;
+                }
+                ++numargs;
+            }
+        }
+    }
+    if (gs.gen_command_fold(*id, apos, numargs, rettype)) {
+        return more;
+    }
+    if (id->p_mathop && (numargs == 2)) {
+        gs.gen_math(id->p_mathop, rettype);
+    } else if (!id->p_loop || !gs.gen_loop(id->p_loop, cpos, bpos, rettype)) {
+        gs.gen_command_call(*id, comtype, rettype, numargs);
     }
-    gs.gen_command_call(*id, comtype, rettype, numargs);
     return more;
 }
 
@@ -1042,6 +1193,7 @@ bool parser_state::parse_id_if(ident &id, int ltype) {
         /* no condition: expr is nothing */
         gs.gen_result_null(ltype);
     } else {
+        auto cpos = gs.last_op();
         auto tpos = gs.count();
         /* true block */
         more = parse_arg(VAL_CODE);
@@ -1053,7 +1205,7 @@ bool parser_state::parse_id_if(ident &id, int ltype) {
             auto fpos = gs.count();
             /* false block */
             more = parse_arg(VAL_CODE);
-            if (!gs.gen_if(tpos, more ? fpos : 0)) {
+            if (!gs.gen_if(cpos, tpos, more ? fpos : 0)) {
                 /* can't fully compile: use a call */
                 gs.gen_command_call(id, BC_INST_COM, ltype);
             }
@@ -1217,12 +1369,12 @@ static bool parse_no_id(parser_state &ps, int term) {
 static bool parse_assign_var(
     parser_state &ps, command_impl *id, ident &var, int ltype
 ) {
-    auto fmt = id->args();
+    auto &plan = id->p_plan;
     std::uint32_t comtype = BC_INST_COM;
     std::uint32_t nargs = 0;
     bool more = true, got = false, rep = false;
-    for (auto it = fmt.begin(); it != fmt.end(); ++it) {
-        switch (*it) {
+    for (std::size_t i = 0; i < plan.nfixed; ++i) {
+        switch (plan.steps[i]) {
             case '$':
                 ps.gs.gen_val_ident(var);
                 ++nargs;
@@ -1231,26 +1383,10 @@ static bool parse_assign_var(
                 ps.gs.gen_val_integer(nargs);
                 ++nargs;
                 break;
-            case '.':
-                it += 2; /* third will be skipped by the loop */
-                comtype = BC_INST_COM_V;
-                if (more && !got) {
-                    more = ps.parse_arg(VAL_ANY);
-                    if (more) {
-                        got = true;
-                        ++nargs;
-                    }
-                }
-                break;
-            case '1': case '2': case '3': case '4':
-                if (more && !got) {
-                    int numrep = *it - '0' + 1;
-                    it -= numrep;
-                    rep = true;
-                }
-                break;
             default: {
-                auto gotarg = parse_cmd_arg(ps, *it, got ? false : more, rep);
+                auto gotarg = parse_cmd_arg(
+                    ps, plan.steps[i], got ? false : more, rep
+                );
                 if (!got) {
                     more = gotarg;
                 }
@@ -1261,6 +1397,19 @@ static bool parse_assign_var(
                 break;
             }
         }
+        if (((i + 1) == plan.nfixed) && plan.nrep && more && !got) {
+            i -= plan.nrep;
+            rep = true;
+        }
+    }
+    if (plan.variadic) {
+        comtype = BC_INST_COM_V;
+        if (more && !got) {
+            more = ps.parse_arg(VAL_ANY);
+            if (more) {
+                ++nargs;
+            }
+        }
     }
     ps.gs.gen_command_call(*id, comtype, ltype, nargs);
     return more;
@@ -1416,6 +1565,10 @@ void parser_state::parse_block(int ltype, int term) {
 
 /* list parser public implementation */
 
+static inline bool is_list_space(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
 LIBCUBESCRIPT_EXPORT bool list_parser::parse() {
     skip_until_item();
     if (p_input_beg == p_input_end) {
@@ -1437,9 +1590,8 @@ LIBCUBESCRIPT_EXPORT bool list_parser::parse() {
             int brak = 1;
             char const *ibeg = p_input_beg++;
             for (;;) {
-                std::string_view chrs{"\"/;()[]"};
-                p_input_beg = std::find_first_of(
-                    p_input_beg, p_input_end, chrs.begin(), chrs.end()
+                p_input_beg = scan_find(
+                    p_input_beg, p_input_end, "\"/;()[]"
                 );
                 if (p_input_beg == p_input_end) {
                     return true;
@@ -1456,8 +1608,8 @@ LIBCUBESCRIPT_EXPORT bool list_parser::parse() {
                             (p_input_beg != p_input_end) &&
                             (*p_input_beg == '/')
                         ) {
-                            p_input_beg = std::find(
-                                p_input_beg, p_input_end, '\n'
+                            p_input_beg = scan_find(
+                                p_input_beg, p_input_end, "\n"
                             );
                         }
                         break;
@@ -1504,7 +1656,20 @@ endblock:
 
 LIBCUBESCRIPT_EXPORT std::size_t list_parser::count() {
     size_t ret = 0;
-    while (parse()) {
+    for (;;) {
+        /* plain words up to the next character that may need the parser
+         * are counted in bulk, except the word that character is in
+         */
+        skip_until_item();
+        char const *sp = scan_find(p_input_beg, p_input_end, "\"/;()[]");
+        while ((sp != p_input_beg) && !is_list_space(sp[-1])) {
+            --sp;
+        }
+        ret += scan_count_words(p_input_beg, sp);
+        p_input_beg = sp;
+        if (!parse()) {
+            break;
+        }
         ++ret;
     }
     return ret;
@@ -1521,12 +1686,15 @@ LIBCUBESCRIPT_EXPORT string_ref list_parser::get_item() const {
 
 LIBCUBESCRIPT_EXPORT void list_parser::skip_until_item() {
     for (;;) {
-        while (p_input_beg != p_input_end) {
-            char c = *p_input_beg;
-            if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n')) {
-                ++p_input_beg;
-            } else {
-                break;
+        /* mostly a single space, which is not worth scanning in bulk */
+        if ((p_input_beg != p_input_end) && is_list_space(*p_input_beg)) {
+            if (
+                (++p_input_beg != p_input_end) &&
+                is_list_space(*p_input_beg)
+            ) {
+                p_input_beg = scan_skip(
+                    p_input_beg, p_input_end, " \t\r\n"
+                );
             }
         }
         if ((p_input_end - p_input_beg) < 2) {
@@ -1535,7 +1703,7 @@ LIBCUBESCRIPT_EXPORT void list_parser::skip_until_item() {
         if ((p_input_beg[0] != '/') || (p_input_beg[1]) != '/') {
             break;
         }
-        p_input_beg = std::find(p_input_beg, p_input_end, '\n');
+        p_input_beg = scan_find(p_input_beg, p_input_end, "\n");
     }
 }
 
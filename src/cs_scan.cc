@@ -0,0 +1,300 @@
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <bit>
+
+#include "cs_scan.hh"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(__x86_64__)
+#  define LIBCUBESCRIPT_SCAN_SSE2 1
+#  include <emmintrin.h>
+/* AVX2 code is built with a target attribute, so the rest of the library
+ * does not need to be built for it, and only runs if the CPU has it
+ */
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define LIBCUBESCRIPT_SCAN_AVX2 1
+#    include <immintrin.h>
+#  endif
+#endif
+
+namespace cubescript {
+
+/* byte by byte, for the tails and as the reference for everything else */
+template<bool Skip>
+static char const *scan_bytes(
+    char const *beg, char const *end, std::string_view chars,
+    std::size_t *nlines
+) {
+    for (; beg != end; ++beg) {
+        bool found = (chars.find(*beg) != std::string_view::npos);
+        if (found != Skip) {
+            break;
+        }
+        if (nlines && (*beg == '\n')) {
+            ++*nlines;
+        }
+    }
+    return beg;
+}
+
+static inline bool scan_is_white(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+/* white tells whether the character before beg is whitespace */
+static std::size_t scan_words_bytes(
+    char const *beg, char const *end, bool white
+) {
+    std::size_t ret = 0;
+    for (; beg != end; ++beg) {
+        bool w = scan_is_white(*beg);
+        ret += (white && !w);
+        white = w;
+    }
+    return ret;
+}
+
+/* the number of newlines in the part of a block before the first match,
+ * given as masks with a bit for every byte (or the high bit of it)
+ */
+template<typename T>
+static inline std::size_t scan_count_nl(T nlmask, T match) {
+    if (match) {
+        /* everything below the lowest set bit of the match */
+        nlmask &= T((match & (~match + 1)) - 1);
+    }
+    return std::size_t(std::popcount(nlmask));
+}
+
+/* 8 bytes in a 64-bit word, the first one being in the lowest byte */
+
+static constexpr std::uint64_t scan_bcast(unsigned char c) {
+    return std::uint64_t(c) * 0x0101010101010101ULL;
+}
+
+/* the high bit of every byte equal to c; unlike the usual trick for
+ * finding zero bytes, this has no false positives
+ */
+static inline std::uint64_t scan_swar_eq(std::uint64_t v, unsigned char c) {
+    auto x = v ^ scan_bcast(c);
+    auto lo = scan_bcast(0x7F);
+    return ~(((x & lo) + lo) | x | lo);
+}
+
+template<bool Skip>
+static char const *scan_swar(
+    char const *beg, char const *end, std::string_view chars,
+    std::size_t *nlines
+) {
+    if constexpr (std::endian::native == std::endian::little) {
+        while ((end - beg) >= 8) {
+            std::uint64_t v;
+            std::memcpy(&v, beg, sizeof(v));
+            std::uint64_t m = 0;
+            for (auto c: chars) {
+                m |= scan_swar_eq(v, static_cast<unsigned char>(c));
+            }
+            if (Skip) {
+                m = ~m & scan_bcast(0x80);
+            }
+            if (nlines) {
+                *nlines += scan_count_nl(scan_swar_eq(v, '\n'), m);
+            }
+            if (m) {
+                return beg + (std::countr_zero(m) / 8);
+            }
+            beg += 8;
+        }
+    }
+    return scan_bytes<Skip>(beg, end, chars, nlines);
+}
+
+/* words start where whitespace is followed by anything else; the masks
+ * of whitespace are shifted by a byte to compare every byte with the one
+ * before it, carrying the last one over to the next word
+ */
+[[maybe_unused]]
+static std::size_t scan_words_swar(char const *beg, char const *end) {
+    std::size_t ret = 0;
+    std::uint64_t carry = 0x80;
+    if constexpr (std::endian::native == std::endian::little) {
+        while ((end - beg) >= 8) {
+            std::uint64_t v;
+            std::memcpy(&v, beg, sizeof(v));
+            auto w = scan_swar_eq(v, ' ') | scan_swar_eq(v, '\t') |
+                scan_swar_eq(v, '\r') | scan_swar_eq(v, '\n');
+            auto starts = ~w & ((w << 8) | carry) & scan_bcast(0x80);
+            ret += std::size_t(std::popcount(starts));
+            carry = w >> 56;
+            beg += 8;
+        }
+    }
+    return ret + scan_words_bytes(beg, end, carry);
+}
+
+#if LIBCUBESCRIPT_SCAN_SSE2
+template<bool Skip>
+static char const *scan_sse2(
+    char const *beg, char const *end, std::string_view chars,
+    std::size_t *nlines
+) {
+    __m128i cv[SCAN_MAX_CHARS];
+    std::size_t nc = chars.size();
+    for (std::size_t i = 0; i < nc; ++i) {
+        cv[i] = _mm_set1_epi8(chars[i]);
+    }
+    __m128i nlv = _mm_set1_epi8('\n');
+    while ((end - beg) >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(beg));
+        auto eq = _mm_cmpeq_epi8(v, cv[0]);
+        for (std::size_t i = 1; i < nc; ++i) {
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, cv[i]));
+        }
+        auto m = std::uint32_t(_mm_movemask_epi8(eq));
+        if (Skip) {
+            m = ~m & 0xFFFF;
+        }
+        if (nlines) {
+            auto nlm = std::uint32_t(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(v, nlv))
+            );
+            *nlines += scan_count_nl(nlm, m);
+        }
+        if (m) {
+            return beg + std::countr_zero(m);
+        }
+        beg += 16;
+    }
+    return scan_bytes<Skip>(beg, end, chars, nlines);
+}
+
+static std::size_t scan_words_sse2(char const *beg, char const *end) {
+    std::size_t ret = 0;
+    std::uint32_t carry = 1;
+    while ((end - beg) >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(beg));
+        auto w = std::uint32_t(_mm_movemask_epi8(_mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))
+            ),
+            _mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))
+            )
+        )));
+        ret += std::size_t(std::popcount(~w & ((w << 1) | carry) & 0xFFFF));
+        carry = w >> 15;
+        beg += 16;
+    }
+    return ret + scan_words_bytes(beg, end, carry);
+}
+#endif
+
+#if LIBCUBESCRIPT_SCAN_AVX2
+template<bool Skip>
+__attribute__((target("avx2,popcnt")))
+static char const *scan_avx2(
+    char const *beg, char const *end, std::string_view chars,
+    std::size_t *nlines
+) {
+    __m256i cv[SCAN_MAX_CHARS];
+    std::size_t nc = chars.size();
+    for (std::size_t i = 0; i < nc; ++i) {
+        cv[i] = _mm256_set1_epi8(chars[i]);
+    }
+    __m256i nlv = _mm256_set1_epi8('\n');
+    while ((end - beg) >= 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(beg));
+        auto eq = _mm256_cmpeq_epi8(v, cv[0]);
+        for (std::size_t i = 1; i < nc; ++i) {
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(v, cv[i]));
+        }
+        auto m = std::uint32_t(_mm256_movemask_epi8(eq));
+        if (Skip) {
+            m = ~m;
+        }
+        if (nlines) {
+            auto nlm = std::uint32_t(
+                _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nlv))
+            );
+            *nlines += scan_count_nl(nlm, m);
+        }
+        if (m) {
+            return beg + std::countr_zero(m);
+        }
+        beg += 32;
+    }
+    /* the rest, if long enough, still goes 16 bytes at a time */
+    return scan_sse2<Skip>(beg, end, chars, nlines);
+}
+
+__attribute__((target("avx2,popcnt")))
+static std::size_t scan_words_avx2(char const *beg, char const *end) {
+    std::size_t ret = 0;
+    std::uint32_t carry = 1;
+    while ((end - beg) >= 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(beg));
+        auto w = std::uint32_t(_mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))
+            ),
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))
+            )
+        )));
+        ret += std::size_t(std::popcount(~w & ((w << 1) | carry)));
+        carry = w >> 31;
+        beg += 32;
+    }
+    return ret + scan_words_bytes(beg, end, carry);
+}
+#endif
+
+using scan_func = char const *(*)(
+    char const *, char const *, std::string_view, std::size_t *
+);
+
+struct scan_impl {
+    scan_func find, skip;
+    std::size_t (*words)(char const *, char const *);
+};
+
+static scan_impl const &scan_get_impl() {
+    static scan_impl const ret = []() -> scan_impl {
+#if LIBCUBESCRIPT_SCAN_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            return {scan_avx2<false>, scan_avx2<true>, scan_words_avx2};
+        }
+#endif
+#if LIBCUBESCRIPT_SCAN_SSE2
+        return {scan_sse2<false>, scan_sse2<true>, scan_words_sse2};
+#else
+        return {scan_swar<false>, scan_swar<true>, scan_words_swar};
+#endif
+    }();
+    return ret;
+}
+
+char const *scan_find(
+    char const *beg, char const *end, std::string_view chars,
+    std::size_t *nlines
+) {
+    assert(!chars.empty() && (chars.size() < SCAN_MAX_CHARS));
+    return scan_get_impl().find(beg, end, chars, nlines);
+}
+
+char const *scan_skip(
+    char const *beg, char const *end, std::string_view chars
+) {
+    assert(!chars.empty() && (chars.size() < SCAN_MAX_CHARS));
+    return scan_get_impl().skip(beg, end, chars, nullptr);
+}
+
+std::size_t scan_count_words(char const *beg, char const *end) {
+    return scan_get_impl().words(beg, end);
+}
+
+} /* namespace cubescript */
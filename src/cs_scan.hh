@@ -0,0 +1,45 @@
+#ifndef LIBCUBESCRIPT_SCAN_HH
+#define LIBCUBESCRIPT_SCAN_HH
+
+#include <cstddef>
+#include <string_view>
+
+namespace cubescript {
+
+/* bulk scanning of source text, used by the parsers
+ *
+ * the input is looked at 16 or 32 bytes at a time with SSE2 or AVX2 on
+ * x86 (AVX2 being used when the CPU supports it, which is checked once
+ * at runtime), and 8 bytes at a time in a 64-bit word elsewhere; every
+ * implementation gives the same results as going byte by byte
+ */
+
+/* the sets of characters to scan for must not be empty and must have
+ * fewer than this many
+ */
+static constexpr std::size_t SCAN_MAX_CHARS = 12;
+
+/* the first of the given characters in [beg, end), or end if there is
+ * none of them; when nlines is given, the number of newlines before the
+ * returned position is added to it
+ */
+char const *scan_find(
+    char const *beg, char const *end, std::string_view chars,
+    std::size_t *nlines = nullptr
+);
+
+/* the first character in [beg, end) that is not one of the given ones,
+ * or end if there is none
+ */
+char const *scan_skip(
+    char const *beg, char const *end, std::string_view chars
+);
+
+/* the number of words in [beg, end), which is taken to consist of only
+ * words and the whitespace (spaces, tabs, CRs and newlines) between them
+ */
+std::size_t scan_count_words(char const *beg, char const *end);
+
+} /* namespace cubescript */
+
+#endif
@@ -6,6 +6,7 @@
 #include "cs_state.hh"
 #include "cs_thread.hh"
 #include "cs_strman.hh"
+#include "cs_list.hh"
 #include "cs_vm.hh"
 #include "cs_parser.hh"
 #include "cs_error.hh"
@@ -15,24 +16,43 @@ namespace cubescript {
 
 internal_state::internal_state(alloc_func af, void *data):
     allocf{af}, aptr{data},
-    idents{allocator_type{this}},
-    identmap{nullptr},
-    identcap{1024}, /* realistic initial space */
+    idents{nullptr},
+    identmap{},
     argmap{},
     identnum{0},
+    lists{create<list_cache>(this)},
     strman{create<string_pool>(this)},
     empty{bcode_init_empty(this)}
 {
-    identmap = create_array<ident *>(identcap);
+    auto *tab = create<ident_table>();
+    tab->size = IDENTS_INIT;
+    tab->slots = create_array<atomic_type<ident *>>(tab->size);
+    tab->prev = nullptr;
+    idents.store(tab);
 }
 
 internal_state::~internal_state() {
-    for (auto &p: idents) {
-        destroy(&ident_p{*p.second}.impl());
+    /* every ident has a slot in the index table */
+    auto nids = identnum.load();
+    for (std::size_t i = 0; i < nids; ++i) {
+        std::size_t off;
+        auto seg = identmap_seg(i, off);
+        destroy(&ident_p{*identmap[seg].load()[off].load()}.impl());
     }
     bcode_free_empty(this, empty);
     destroy(strman);
-    destroy_array(identmap, identcap);
+    destroy(lists);
+    for (std::size_t i = 0; i < IDENTMAP_SEGS; ++i) {
+        if (auto *seg = identmap[i].load(); seg) {
+            destroy_array(seg, IDENTMAP_BASE << i);
+        }
+    }
+    for (auto *tab = idents.load(); tab;) {
+        auto *prev = tab->prev;
+        destroy_array(tab->slots, tab->size);
+        destroy(tab);
+        tab = prev;
+    }
 }
 
 void *internal_state::alloc(void *ptr, size_t os, size_t ns) {
@@ -51,31 +71,24 @@ static void *default_alloc(void *, void *p, size_t, size_t ns) {
     return std::realloc(p, ns);
 }
 
-ident *internal_state::lookup_ident(std::size_t idx) {
-    if (idx < MAX_ARGUMENTS) {
-        return argmap[idx];
-    }
-    mtx_guard l{ident_mtx};
-    return identmap[idx];
-}
-
-ident const *internal_state::lookup_ident(std::size_t idx) const {
-    if (idx < MAX_ARGUMENTS) {
-        return argmap[idx];
-    }
-    mtx_guard l{ident_mtx};
-    return identmap[idx];
-}
-
 void internal_state::foreach_ident(void (*f)(ident *, void *), void *data) {
     auto nids = identnum.load();
     for (std::size_t i = 0; i < nids; ++i) {
-        ident *id;
-        {
-            mtx_guard l{ident_mtx};
-            id = identmap[i];
+        f(lookup_ident(i), data);
+    }
+}
+
+/* called with ident_mtx held; an ident of the same name gets replaced */
+static void ident_table_put(ident_table *tab, ident *id) {
+    auto name = id->name();
+    auto mask = tab->size - 1;
+    auto i = std::hash<std::string_view>{}(name) & mask;
+    for (;; i = (i + 1) & mask) {
+        auto *oid = tab->slots[i].load();
+        if (!oid || (oid->name() == name)) {
+            tab->slots[i].store(id);
+            return;
         }
-        f(id, data);
     }
 }
 
@@ -86,18 +99,43 @@ ident *internal_state::add_ident(ident *id, ident_impl *impl) {
     ident_p{*id}.impl(impl);
     {
         mtx_guard l{ident_mtx};
-        idents[id->name()] = id;
-        impl->p_index = identnum++;
-        if (identnum > identcap) {
-            /* if we've run out of space, double it */
-            identcap *= 2;
-            auto *oldmap = identmap;
-            auto *newmap = create_array<ident *>(identcap);
-            std::memcpy(newmap, oldmap, sizeof(ident *) * impl->p_index);
-            identmap = newmap;
-            destroy_array(oldmap, identcap / 2);
+        std::size_t idx = identnum.load(), off;
+        auto seg = identmap_seg(idx, off);
+        if (seg >= IDENTMAP_SEGS) {
+            throw std::bad_alloc{};
+        }
+        auto *slots = identmap[seg].load();
+        if (!slots) {
+            /* out of space, the next segment is never moved so it can be
+             * published right away, readers only ever get to the indexes
+             * of idents that have been added
+             */
+            slots = create_array<atomic_type<ident *>>(
+                IDENTMAP_BASE << seg
+            );
+            identmap[seg].store(slots);
+        }
+        /* the ident is complete before it's published, as readers do not
+         * take the lock
+         */
+        impl->p_index = int(idx);
+        slots[off].store(id);
+        auto *tab = idents.load();
+        if ((idx + 1) * 2 > tab->size) {
+            auto *ntab = create<ident_table>();
+            ntab->size = tab->size * 2;
+            ntab->slots = create_array<atomic_type<ident *>>(ntab->size);
+            ntab->prev = tab;
+            for (std::size_t i = 0; i < tab->size; ++i) {
+                if (auto *oid = tab->slots[i].load(); oid) {
+                    ident_table_put(ntab, oid);
+                }
+            }
+            idents.store(ntab);
+            tab = ntab;
         }
-        identmap[impl->p_index] = id;
+        ident_table_put(tab, id);
+        identnum.store(idx + 1);
         return id;
     }
 }
@@ -119,12 +157,15 @@ ident &internal_state::new_ident(state &cs, std::string_view name, int flags) {
 }
 
 ident *internal_state::get_ident(std::string_view name) const {
-    mtx_guard l{ident_mtx};
-    auto id = idents.find(name);
-    if (id == idents.end()) {
-        return nullptr;
+    auto *tab = idents.load();
+    auto mask = tab->size - 1;
+    auto i = std::hash<std::string_view>{}(name) & mask;
+    for (;; i = (i + 1) & mask) {
+        auto *id = tab->slots[i].load();
+        if (!id || (id->name() == name)) {
+            return id;
+        }
     }
-    return id->second;
 }
 
 /* public interfaces */
@@ -228,6 +269,7 @@ state::state(alloc_func func, void *data) {
 
     p = &new_command("doargs", "b", [](auto &cs, auto args, auto &res) {
         res = exec_code_with_args(*cs.p_tstate, args[0].get_code());
+        raise_loop_ctl(*cs.p_tstate);
     });
     static_cast<command_impl *>(p)->p_type = ID_DOARGS;
 
@@ -545,52 +587,9 @@ LIBCUBESCRIPT_EXPORT void state::assign_value(
 }
 
 LIBCUBESCRIPT_EXPORT any_value state::lookup_value(std::string_view name) {
-    ident *id = nullptr;
-    auto idopt = get_ident(name);
-    if (!idopt) {
-        id = nullptr;
-    } else {
-        id = &idopt->get();
-    }
-    alias_stack *ast;
-    if (id) {
-        switch(id->type()) {
-            case ident_type::ALIAS: {
-                auto *a = static_cast<alias_impl *>(id);
-                ast = &p_tstate->get_astack(static_cast<alias *>(id));
-                if (ast->flags & IDENT_FLAG_UNKNOWN) {
-                    break;
-                }
-                if (a->is_arg() && !ident_is_used_arg(id, *p_tstate)) {
-                    return any_value{};
-                }
-                return ast->node->val_s.get_plain();
-            }
-            case ident_type::VAR:
-                return static_cast<builtin_var *>(id)->value();
-            case ident_type::COMMAND: {
-                any_value val{};
-                auto *cimpl = static_cast<command_impl *>(id);
-                auto &args = p_tstate->vmstack;
-                auto osz = args.size();
-                /* pad with as many empty values as we need */
-                args.resize(osz + cimpl->arg_count());
-                try {
-                    exec_command(
-                        *p_tstate, cimpl, cimpl, &args[osz], val, 0, true
-                    );
-                } catch (...) {
-                    args.resize(osz);
-                    throw;
-                }
-                args.resize(osz);
-                return val;
-            }
-            default:
-                return any_value{};
-        }
-    }
-    throw error_p::make(*this, "unknown alias lookup: %s", name.data());
+    return lookup_ident_value(
+        *p_tstate, p_tstate->istate->get_ident(name), name
+    );
 }
 
 LIBCUBESCRIPT_EXPORT void state::reset_value(std::string_view name) {
@@ -634,6 +633,8 @@ LIBCUBESCRIPT_EXPORT command &state::new_command(
     std::string_view name, std::string_view args, command_func func
 ) {
     int nargs = 0;
+    command_plan plan{};
+    plan.nfixed = args.size();
     for (auto fmt = args.begin(); fmt != args.end(); ++fmt) {
         switch (*fmt) {
             case 'i':
@@ -668,6 +669,8 @@ LIBCUBESCRIPT_EXPORT command &state::new_command(
                     };
                 }
                 nargs -= nrep;
+                plan.nfixed = std::size_t(fmt - args.begin());
+                plan.nrep = std::size_t(nrep);
                 break;
             }
             case '.':
@@ -679,6 +682,10 @@ LIBCUBESCRIPT_EXPORT command &state::new_command(
                         *this, "unterminated variadic argument list"
                     };
                 }
+                if (!plan.nrep) {
+                    plan.nfixed = std::size_t(fmt - args.begin());
+                }
+                plan.variadic = true;
                 fmt += 2;
                 break;
             default:
@@ -690,7 +697,7 @@ LIBCUBESCRIPT_EXPORT command &state::new_command(
     auto &is = *p_tstate->istate;
     auto *cmd = is.create<command_impl>(
         string_ref{*this, name}, string_ref{*this, args},
-        nargs, std::move(func)
+        nargs, plan, std::move(func)
     );
     /* we can set these builtins */
     command **bptrs[] = {
@@ -742,6 +749,15 @@ LIBCUBESCRIPT_EXPORT bcode_ref state::compile(
     return gs.steal_ref();
 }
 
+LIBCUBESCRIPT_EXPORT bcode_ref state::compile(
+    std::string_view v, std::string_view source, int opt_level
+) {
+    gen_state gs{*p_tstate};
+    gs.opt_level = opt_level;
+    gs.gen_main(v, source);
+    return gs.steal_ref();
+}
+
 LIBCUBESCRIPT_EXPORT bool state::override_mode() const {
     return (p_tstate->ident_flags & IDENT_FLAG_OVERRIDDEN);
 }
@@ -780,6 +796,24 @@ LIBCUBESCRIPT_EXPORT std::size_t state::max_call_depth(std::size_t v) {
     return old;
 }
 
+LIBCUBESCRIPT_EXPORT int state::opt_level() const {
+    return p_tstate->opt_level;
+}
+
+LIBCUBESCRIPT_EXPORT int state::opt_level(int v) {
+    auto old = p_tstate->opt_level;
+    p_tstate->opt_level = v;
+    return old;
+}
+
+LIBCUBESCRIPT_EXPORT std::size_t state::dispatch_count() const {
+#if LIBCUBESCRIPT_VM_OPCODE_STATS
+    return p_tstate->op_count;
+#else
+    return 0;
+#endif
+}
+
 LIBCUBESCRIPT_EXPORT void std_init_all(state &cs) {
     std_init_base(cs);
     std_init_math(cs);
@@ -3,10 +3,10 @@
 
 #include <cubescript/cubescript.hh>
 
-#include <unordered_map>
 #include <string>
 #include <vector>
 #include <array>
+#include <bit>
 
 #include "cs_bcode.hh"
 #include "cs_ident.hh"
@@ -16,6 +16,7 @@ namespace cubescript {
 
 struct internal_state;
 struct string_pool;
+struct list_cache;
 
 template<typename T>
 struct std_allocator {
@@ -37,28 +38,50 @@ struct std_allocator {
     internal_state *istate;
 };
 
+/* idents by name: open addressing with linear probing over a power of
+ * two number of slots, kept at most half full; it is only written under
+ * ident_mtx, and a slot that holds an ident only ever gets an ident of
+ * the same name, so it can be read without locking; once it grows, the
+ * old table is kept around (there may be readers left in it) until the
+ * state is gone
+ */
+struct ident_table {
+    atomic_type<ident *> *slots;
+    std::size_t size;
+    ident_table *prev;
+};
+
 struct internal_state {
-    using allocator_type = std_allocator<
-        std::pair<std::string_view const, ident *>
-    >;
     alloc_func allocf;
     void *aptr;
 
-    std::unordered_map<
-        std::string_view, ident *,
-        std::hash<std::string_view>,
-        std::equal_to<std::string_view>,
-        allocator_type
-    > idents;
-    ident **identmap;
-    std::size_t identcap;
+    static constexpr std::size_t IDENTS_INIT = 1024;
+    atomic_type<ident_table *> idents;
+    /* idents by index: an append-only table split into segments, the
+     * first one holding IDENTMAP_BASE slots and every next one twice as
+     * many as the one before; segments are never moved or freed while
+     * the state is alive, so once a segment and a slot are published
+     * (in add_ident, under ident_mtx), they can be read without locking
+     */
+    static constexpr std::size_t IDENTMAP_BASE = 1024;
+    static constexpr std::size_t IDENTMAP_SEGS = 16;
+    std::array<
+        atomic_type<atomic_type<ident *> *>, IDENTMAP_SEGS
+    > identmap;
     std::array<ident *, MAX_ARGUMENTS> argmap;
     atomic_type<std::size_t> identnum;
     mutable mutex_type ident_mtx;
 
+    /* strings drop their list indexes as they go, so this goes last */
+    list_cache *lists;
     string_pool *strman;
     empty_block *empty;
 
+#if LIBCUBESCRIPT_VM_JIT
+    /* held while compiling native code */
+    mutex_type jit_mtx;
+#endif
+
     ident *id_dummy;
 
     builtin_var *ivar_numargs;
@@ -75,8 +98,22 @@ struct internal_state {
 
     ~internal_state();
 
-    ident *lookup_ident(std::size_t idx);
-    ident const *lookup_ident(std::size_t idx) const;
+    /* the segment of the given index, and the index within it */
+    static std::size_t identmap_seg(std::size_t idx, std::size_t &off) {
+        auto n = std::size_t(std::bit_width(idx / IDENTMAP_BASE + 1)) - 1;
+        off = idx - IDENTMAP_BASE * ((std::size_t(1) << n) - 1);
+        return n;
+    }
+
+    ident *lookup_ident(std::size_t idx) const {
+        if (idx < MAX_ARGUMENTS) {
+            return argmap[idx];
+        }
+        std::size_t off;
+        auto seg = identmap_seg(idx, off);
+        return identmap[seg].load()[off].load();
+    }
+
     void foreach_ident(void (*f)(ident *, void *), void *data);
 
     ident *add_ident(ident *id, ident_impl *impl);
@@ -146,6 +183,59 @@ inline void new_cmd_quiet(
     }
 }
 
+/* like new_cmd_quiet, for commands that can be folded by the compiler
+ * (see IDENT_FLAG_PURE); a command already registered is left alone
+ */
+template<typename F>
+inline void new_cmd_pure(
+    state &cs, std::string_view name, std::string_view args, F &&f
+) {
+    try {
+        auto &cmd = cs.new_command(name, args, std::forward<F>(f));
+        ident_p{cmd}.impl().p_flags |= IDENT_FLAG_PURE;
+    } catch (error const &) {
+        return;
+    }
+}
+
+/* like new_cmd_pure, for commands that are compiled into BC_INST_MATH with
+ * the given operation when called with two arguments; if the name is
+ * already taken, calls to it are left alone as well
+ */
+template<typename F>
+inline void new_cmd_math(
+    state &cs, std::string_view name, std::string_view args,
+    std::uint32_t op, F &&f
+) {
+    try {
+        auto &cmd = static_cast<command_impl &>(
+            ident_p{cs.new_command(name, args, std::forward<F>(f))}.impl()
+        );
+        cmd.p_flags |= IDENT_FLAG_PURE;
+        cmd.p_mathop = op;
+    } catch (error const &) {
+        return;
+    }
+}
+
+/* like new_cmd_quiet, for loop builtins compiled into BC_INST_LOOP of
+ * the given kind when their code is given as literal blocks
+ */
+template<typename F>
+inline void new_cmd_loop(
+    state &cs, std::string_view name, std::string_view args,
+    std::uint32_t kind, F &&f
+) {
+    try {
+        auto &cmd = static_cast<command_impl &>(
+            ident_p{cs.new_command(name, args, std::forward<F>(f))}.impl()
+        );
+        cmd.p_loop = kind;
+    } catch (error const &) {
+        return;
+    }
+}
+
 } /* namespace cubescript */
 
 #endif
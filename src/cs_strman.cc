@@ -5,13 +5,20 @@
 #include "cs_strman.hh"
 #include "cs_thread.hh"
 #include "cs_lock.hh"
+#include "cs_list.hh"
 
 namespace cubescript {
 
 struct string_ref_state {
     internal_state *state;
     std::size_t length;
-    std::size_t refcount;
+    /* set once the string is in the pool */
+    std::size_t hash;
+    atomic_type<std::size_t> refcount;
+    /* not in the pool at all */
+    bool transient;
+    /* has an index in the list cache */
+    atomic_type<bool> indexed;
 };
 
 inline string_ref_state *get_ref_state(char const *ptr) {
@@ -20,22 +27,77 @@ inline string_ref_state *get_ref_state(char const *ptr) {
     return r - 1;
 }
 
+inline char const *get_ref_str(string_ref_state *st) {
+    st += 1;
+    char const *r;
+    std::memcpy(&r, &st, sizeof(r));
+    return r;
+}
+
+/* takes a reference unless the count has already dropped to zero, in
+ * which case the string is about to be removed by whoever dropped it
+ * and must not be handed out anymore
+ */
+static bool str_ref_nonzero(string_ref_state *st) {
+    auto n = st->refcount.load();
+    while (n) {
+        if (st->refcount.compare_exchange_weak(n, n + 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void str_free(internal_state *cs, string_ref_state *st) {
+    auto len = st->length;
+    st->~string_ref_state();
+    cs->alloc(st, len + sizeof(string_ref_state) + 1, 0);
+}
+
+string_pool::string_pool(internal_state *cs): cstate{cs} {
+    shards = static_cast<shard *>(
+        cs->alloc(nullptr, 0, NUM_SHARDS * sizeof(shard))
+    );
+    for (std::size_t i = 0; i < NUM_SHARDS; ++i) {
+        new (&shards[i]) shard{cs};
+    }
+    intstrs = cs->create_array<atomic_type<char const *>>(
+        INTSTR_MAX - INTSTR_MIN + 1
+    );
+}
+
+string_pool::~string_pool() {
+    for (integer_type i = 0; i <= (INTSTR_MAX - INTSTR_MIN); ++i) {
+        if (auto *str = intstrs[i].load(); str) {
+            internal_unref(str);
+        }
+    }
+    cstate->destroy_array(intstrs, INTSTR_MAX - INTSTR_MIN + 1);
+    for (std::size_t i = 0; i < NUM_SHARDS; ++i) {
+        shards[i].~shard();
+    }
+    cstate->alloc(shards, NUM_SHARDS * sizeof(shard), 0);
+}
+
+string_pool::shard &string_pool::get_shard(std::size_t hash) const {
+    /* the low bits pick the bucket within the shard */
+    return shards[(hash >> 16) % NUM_SHARDS];
+}
+
 char const *string_pool::add(std::string_view str) {
-    {
-        mtx_guard l{p_mtx};
-        auto it = counts.find(str);
-        /* already present: just increment ref */
-        if (it != counts.end()) {
-            auto *st = it->second;
-            /* having a null pointer is the same as non-existence */
-            if (st) {
-                ++st->refcount;
-                st += 1;
-                char const *r;
-                std::memcpy(&r, &st, sizeof(r));
-                return r;
-            }
+    string_key key{str};
+    auto &sh = get_shard(key.hash);
+    mtx_guard l{sh.p_mtx};
+    auto it = sh.counts.find(key);
+    /* already present: just increment ref */
+    if (it != sh.counts.end()) {
+        if (str_ref_nonzero(it->second)) {
+            return get_ref_str(it->second);
         }
+        /* on its way out, its memory will be freed by whoever has
+         * dropped the last reference, so replace it
+         */
+        sh.counts.erase(it);
     }
     /* not present: allocate brand new data */
     auto ss = str.size();
@@ -43,87 +105,97 @@ char const *string_pool::add(std::string_view str) {
     /* write string data, it's already pre-terminated */
     memcpy(strp, str.data(), ss);
     /* store it */
-    {
-        mtx_guard l{p_mtx};
-        counts.emplace(std::string_view{strp, ss}, get_ref_state(strp));
-    }
+    auto *st = get_ref_state(strp);
+    st->hash = key.hash;
+    sh.counts.emplace(string_key{std::string_view{strp, ss}, key.hash}, st);
+    return strp;
+}
+
+char const *string_pool::add_transient(std::string_view str) {
+    auto strp = alloc_buf(str.size());
+    memcpy(strp, str.data(), str.size());
+    get_ref_state(strp)->transient = true;
     return strp;
 }
 
 char const *string_pool::internal_ref(char const *ptr) {
-    auto *ss = get_ref_state(ptr);
-    {
-        mtx_guard l{p_mtx};
-        ++ss->refcount;
-    }
+    get_ref_state(ptr)->refcount.fetch_add(1);
     return ptr;
 }
 
 string_ref string_pool::steal(char *ptr) {
     auto *ss = get_ref_state(ptr);
-    auto sr = std::string_view{ptr, ss->length};
-    string_ref_state *st = nullptr;
+    string_key key{std::string_view{ptr, ss->length}};
+    ss->hash = key.hash;
+    auto &sh = get_shard(key.hash);
+    char const *rp;
     {
-        mtx_guard l{p_mtx};
+        mtx_guard l{sh.p_mtx};
         /* much like add(), but we already have memory */
-        auto it = counts.find(sr);
-        if (it != counts.end()) {
-            st = it->second;
+        auto it = sh.counts.find(key);
+        if ((it == sh.counts.end()) || !str_ref_nonzero(it->second)) {
+            if (it != sh.counts.end()) {
+                sh.counts.erase(it);
+            }
+            ss->refcount.store(0); /* string_ref will increment it */
+            sh.counts.emplace(key, ss);
+            return string_ref{ptr};
         }
+        rp = get_ref_str(it->second);
     }
-    if (st) {
-        /* the buffer is superfluous now */
-        cstate->alloc(ss, ss->length + sizeof(string_ref_state) + 1, 0);
-        st += 1;
-        char const *rp;
-        std::memcpy(&rp, &st, sizeof(rp));
-        return string_ref{rp};
-    } else {
-        mtx_guard l{p_mtx};
-        ss->refcount = 0; /* string_ref will increment it */
-        counts.emplace(sr, ss);
-    }
+    /* the buffer is superfluous now */
+    str_free(cstate, ss);
+    /* drop the reference taken above, the string_ref has its own */
+    string_ref ret{rp};
+    internal_unref(rp);
+    return ret;
+}
+
+string_ref string_pool::steal_transient(char *ptr) {
+    auto *ss = get_ref_state(ptr);
+    ss->transient = true;
+    ss->refcount.store(0); /* string_ref will increment it */
     return string_ref{ptr};
 }
 
 void string_pool::internal_unref(char const *ptr) {
     auto *ss = get_ref_state(ptr);
-    if (mtx_guard l{p_mtx}; !--ss->refcount) {
-        /* refcount zero, so ditch it
-         * this path is a little slow...
-         */
-        auto sr = std::string_view{ptr, ss->length};
-        auto it = counts.find(sr);
-        /* this should *never* happen unless we have a bug */
-#ifndef NDEBUG
-        assert(it != counts.end());
-#else
-        if (it == counts.end()) {
-            abort();
-        }
-#endif
-        /* we're freeing the key */
-        counts.erase(it);
-    } else {
+    if (ss->refcount.fetch_sub(1) != 1) {
         return;
     }
+    if (ss->indexed.load()) {
+        cstate->lists->drop(ptr);
+    }
+    if (ss->transient) {
+        str_free(cstate, ss);
+        return;
+    }
+    /* refcount zero, so ditch it; nobody can take a reference anymore,
+     * but the string may have been replaced in the meantime (see add)
+     */
+    string_key key{std::string_view{ptr, ss->length}, ss->hash};
+    auto &sh = get_shard(key.hash);
+    {
+        mtx_guard l{sh.p_mtx};
+        auto it = sh.counts.find(key);
+        if ((it != sh.counts.end()) && (it->second == ss)) {
+            /* we're freeing the key */
+            sh.counts.erase(it);
+        }
+    }
     /* dealloc */
-    cstate->alloc(ss, ss->length + sizeof(string_ref_state) + 1, 0);
+    str_free(cstate, ss);
 }
 
 char const *string_pool::find(std::string_view str) const {
-    string_ref_state *sp;
-    {
-        mtx_guard l{p_mtx};
-        auto it = counts.find(str);
-        if (it == counts.end()) {
-            return nullptr;
-        }
-        sp = it->second + 1;
+    string_key key{str};
+    auto &sh = get_shard(key.hash);
+    mtx_guard l{sh.p_mtx};
+    auto it = sh.counts.find(key);
+    if ((it == sh.counts.end()) || !it->second->refcount.load()) {
+        return nullptr;
     }
-    char const *rp;
-    std::memcpy(&rp, &sp, sizeof(rp));
-    return rp;
+    return get_ref_str(it->second);
 }
 
 std::string_view string_pool::get(char const *ptr) const {
@@ -134,10 +206,7 @@ std::string_view string_pool::get(char const *ptr) const {
 char *string_pool::alloc_buf(std::size_t len) const {
     auto mem = cstate->alloc(nullptr, 0, len + sizeof(string_ref_state) + 1);
     /* write length and initial refcount */
-    auto *sst = static_cast<string_ref_state *>(mem);
-    sst->state = cstate;
-    sst->length = len;
-    sst->refcount = 1;
+    auto *sst = new (mem) string_ref_state{cstate, len, 0, 1, false, false};
     /* pre-terminate */
     char *strp;
     sst += 1;
@@ -159,6 +228,25 @@ std::string_view str_managed_view(char const *str) {
     return get_ref_state(str)->state->strman->get(str);
 }
 
+bool str_managed_transient(char const *str) {
+    return get_ref_state(str)->transient;
+}
+
+void str_managed_set_indexed(char const *str) {
+    get_ref_state(str)->indexed.store(true);
+}
+
+char const *str_managed_intern(char const *str) {
+    auto *ss = get_ref_state(str);
+    if (!ss->transient) {
+        return str;
+    }
+    auto *sp = ss->state->strman;
+    auto *ret = sp->add(sp->get(str));
+    sp->internal_unref(str);
+    return ret;
+}
+
 /* strref implementation */
 
 LIBCUBESCRIPT_EXPORT string_ref::string_ref(state &cs, std::string_view str) {
@@ -181,7 +269,9 @@ LIBCUBESCRIPT_EXPORT string_ref::~string_ref() {
 }
 
 LIBCUBESCRIPT_EXPORT string_ref &string_ref::operator=(string_ref const &ref) {
+    auto *op = p_str;
     p_str = str_managed_ref(ref.p_str);
+    str_managed_unref(op);
     return *this;
 }
 
@@ -193,12 +283,21 @@ LIBCUBESCRIPT_EXPORT string_ref::operator std::string_view() const {
     return str_managed_view(p_str);
 }
 
+/* interned strings are the same if and only if they are at the same
+ * address, transient ones have to be compared
+ */
 LIBCUBESCRIPT_EXPORT bool string_ref::operator==(string_ref const &s) const {
-    return p_str == s.p_str;
+    if (p_str == s.p_str) {
+        return true;
+    }
+    if (!str_managed_transient(p_str) && !str_managed_transient(s.p_str)) {
+        return false;
+    }
+    return view() == s.view();
 }
 
 LIBCUBESCRIPT_EXPORT bool string_ref::operator!=(string_ref const &s) const {
-    return p_str != s.p_str;
+    return !(*this == s);
 }
 
 } /* namespace cubescript */
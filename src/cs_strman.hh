@@ -17,6 +17,11 @@ struct string_ref_state;
 char const *str_managed_ref(char const *str);
 void str_managed_unref(char const *str);
 std::string_view str_managed_view(char const *str);
+bool str_managed_transient(char const *str);
+/* the string has an index in the list cache (see cs_list.hh) */
+void str_managed_set_indexed(char const *str);
+/* takes over the reference, returning one to the interned version */
+char const *str_managed_intern(char const *str);
 
 /* string manager
  *
@@ -30,16 +35,74 @@ std::string_view str_managed_view(char const *str);
  * as a part of the string's memory, so it can be easily accessed using just
  * the pointer to the string, but also this is transparent for usage
  *
- * the string manager is thread-safe, so it should be usable in any context
+ * strings can also be transient, i.e. allocated and reference counted the
+ * same way, but not interned; these are used for intermediate values (see
+ * any_value), which are mostly dropped again right away, and so there is
+ * no point in hashing them; transient strings get interned when they are
+ * stored for longer (into an alias or a variable), and ident names are
+ * always interned
+ *
+ * the string manager is thread-safe, so it should be usable in any context;
+ * the pool is split into shards by hash, each with its own lock, and the
+ * reference counts are atomic, so that references are taken and dropped
+ * without locking, except for dropping the last one (which removes the
+ * string from its shard)
+ */
+
+/* keys of the pool, carrying the hash of the string, which is computed
+ * once when the string is added and stored along with it, so that it
+ * never has to be hashed again; comparing a managed string with itself
+ * does not look at its contents either
  */
+struct string_key {
+    std::string_view str;
+    std::size_t hash;
+
+    string_key(std::string_view s, std::size_t h): str{s}, hash{h} {}
+
+    string_key(std::string_view s):
+        str{s}, hash{std::hash<std::string_view>{}(s)}
+    {}
+};
+
+struct string_key_hash {
+    std::size_t operator()(string_key const &k) const {
+        return k.hash;
+    }
+};
+
+struct string_key_equal {
+    bool operator()(string_key const &a, string_key const &b) const {
+        if (a.hash != b.hash) {
+            return false;
+        }
+        if (a.str.data() == b.str.data()) {
+            return (a.str.size() == b.str.size());
+        }
+        return (a.str == b.str);
+    }
+};
 
 struct string_pool {
     using allocator_type = std_allocator<
-        std::pair<std::string_view const, string_ref_state *>
+        std::pair<string_key const, string_ref_state *>
     >;
+
+    static constexpr std::size_t NUM_SHARDS = 16;
+
+    struct shard {
+        shard(internal_state *cs): counts{allocator_type{cs}} {}
+
+        mutex_type p_mtx{};
+        std::unordered_map<
+            string_key, string_ref_state *,
+            string_key_hash, string_key_equal, allocator_type
+        > counts;
+    };
+
     string_pool() = delete;
-    string_pool(internal_state *cs): cstate{cs}, counts{allocator_type{cs}} {}
-    ~string_pool() {}
+    string_pool(internal_state *cs);
+    ~string_pool();
 
     string_pool(string_pool const &) = delete;
     string_pool(string_pool &&) = delete;
@@ -53,6 +116,11 @@ struct string_pool {
      */
     char const *add(std::string_view str);
 
+    /* like add(), but the string is transient, so it is always freshly
+     * allocated and never hashed
+     */
+    char const *add_transient(std::string_view str);
+
     /* this simply increments the reference count of an existing managed
      * string, this is only safe when you know the pointer you are passing
      * is already managed the system
@@ -64,13 +132,18 @@ struct string_pool {
      */
     string_ref steal(char *ptr);
 
+    /* like steal(), but the string is transient */
+    string_ref steal_transient(char *ptr);
+
     /* decrements the reference count and removes it from the system if
      * that reaches zero; likewise, only safe with pointers that are managed
      */
     void internal_unref(char const *ptr);
 
     /* just finds a managed pointer with the same contents
-     * as the input, if not found then a null pointer is returned
+     * as the input, if not found then a null pointer is returned;
+     * no reference is taken, so the string may be gone by the time
+     * this returns unless the caller holds one
      */
     char const *find(std::string_view str) const;
 
@@ -82,14 +155,19 @@ struct string_pool {
      */
     char *alloc_buf(std::size_t len) const;
 
+    /* the shard a string with the given hash belongs to */
+    shard &get_shard(std::size_t hash) const;
+
     internal_state *cstate;
-    mutable mutex_type p_mtx{};
-    std::unordered_map<
-        std::string_view, string_ref_state *,
-        std::hash<std::string_view>,
-        std::equal_to<std::string_view>,
-        allocator_type
-    > counts;
+    shard *shards;
+
+    /* strings of small integers (see any_value), made on first use and
+     * then kept around with a reference until the pool is gone, so that
+     * these do not have to be formatted and allocated over and over
+     */
+    static constexpr integer_type INTSTR_MIN = -128;
+    static constexpr integer_type INTSTR_MAX = 1023;
+    atomic_type<char const *> *intstrs;
 };
 
 } /* namespace cubescript */
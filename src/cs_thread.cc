@@ -1,32 +1,41 @@
 #include "cs_thread.hh"
+#include "cs_vm.hh"
 
 #include <cstdio>
 
 namespace cubescript {
 
 thread_state::thread_state(internal_state *cs):
-    vmstack{cs}, idstack{cs}, callstack{cs}, astacks{cs}, errbuf{cs}
+    vmstack{cs}, vmstacks{vmstacks_allocator{cs}},
+    idstack{idstack_allocator{cs}}, callstack{cs},
+    frames{frame_allocator{cs}}, astacks{cs}, errbuf{cs}
 {
     vmstack.reserve(32);
-    idstack.reserve(MAX_ARGUMENTS);
+    ftop = &frames.emplace_back();
 }
 
+#if LIBCUBESCRIPT_VM_OPCODE_STATS
+thread_state::~thread_state() {
+    vm_dump_stats(*this);
+}
+#endif
+
 hook_func thread_state::set_hook(hook_func f) {
     auto hk = std::move(call_hook);
     call_hook = std::move(f);
     return hk;
 }
 
-alias_stack &thread_state::get_astack(alias const *a) {
-    auto it = astacks.try_emplace(a->index());
-    if (it.second) {
-        auto *imp = const_cast<alias_impl *>(
-            static_cast<alias_impl const *>(a)
-        );
-        it.first->second.node = &imp->p_initial;
-        it.first->second.flags = imp->p_flags;
+alias_stack &thread_state::init_astack(alias const *a) {
+    auto *imp = const_cast<alias_impl *>(static_cast<alias_impl const *>(a));
+    auto idx = std::size_t(imp->p_index);
+    if (idx >= astacks.size()) {
+        astacks.resize(idx + 1);
     }
-    return it.first->second;
+    auto &ast = astacks[idx];
+    ast.node = &imp->p_initial;
+    ast.flags = imp->p_flags;
+    return ast;
 }
 
 char *thread_state::request_errbuf(std::size_t bufs, char *&sp) {
@@ -3,11 +3,16 @@
 
 #include <cubescript/cubescript.hh>
 
+#include <deque>
 #include <utility>
+#if LIBCUBESCRIPT_VM_JIT
+#include <exception>
+#endif
 
 #include "cs_std.hh"
 #include "cs_state.hh"
 #include "cs_ident.hh"
+#include "cs_bcode.hh"
 
 namespace cubescript {
 
@@ -18,22 +23,83 @@ struct ident_level {
     ident_level(ident &i): id{i} {};
 };
 
+/* VM frame types, these determine what happens when a frame is left */
+enum {
+    /* the frame a vm_exec invocation starts with */
+    VM_FRAME_BASE = 0,
+    /* nested code run by BC_INST_ENTER, ENTER_RESULT, DO or JUMP_RESULT */
+    VM_FRAME_CODE,
+    /* rest of the block after BC_INST_LOCAL, pops the locals */
+    VM_FRAME_LOCAL,
+    /* alias call, restores the argument aliases and numargs */
+    VM_FRAME_ALIAS,
+    /* BC_INST_DO_ARGS, restores the argument aliases */
+    VM_FRAME_ARGS,
+    /* BC_INST_LOOP, runs the loop code until done, pops the loop ident */
+    VM_FRAME_LOOP
+};
+
+/* nested code and alias calls do not recurse the VM natively, they
+ * push one of these instead; see vm_exec
+ */
+struct vm_frame {
+    /* the result slot R */
+    any_value val{};
+    /* keeps the bytecode alive while it runs */
+    bcode_ref code{};
+    /* where the parent resumes, null if right after the frame's exit */
+    std::uint32_t *retcode = nullptr;
+    /* the instruction that has pushed the frame */
+    std::uint32_t op = BC_INST_START;
+    int kind = VM_FRAME_BASE;
+    /* the VM stack is restored to this size on exit */
+    std::size_t vmtop = 0;
+    /* same with the ident stack, where applicable */
+    std::size_t idtop = 0;
+    /* number of arguments or locals */
+    std::size_t nargs = 0;
+    /* previous numargs and ident flags for alias calls */
+    integer_type oldargs = 0;
+    int oldflags = 0;
+    /* the frame below and the one above, the latter being kept around
+     * for reuse once allocated
+     */
+    vm_frame *prev = nullptr;
+    vm_frame *next = nullptr;
+#if LIBCUBESCRIPT_VM_JIT
+    /* native code of the code the frame runs, if it has been compiled */
+    jit_block *jit = nullptr;
+#endif
+};
+
 struct thread_state {
-    using astack_allocator = std_allocator<std::pair<int const, alias_stack>>;
+    using astack_allocator = std_allocator<alias_stack>;
+    using idstack_allocator = std_allocator<ident_stack>;
+    using frame_allocator = std_allocator<vm_frame>;
+    using vmstacks_allocator = std_allocator<valbuf<any_value>>;
     /* the shared state pointer */
     internal_state *istate{};
     /* the public state interface */
     state *pstate{};
     /* VM stack */
     valbuf<any_value> vmstack;
-    /* ident stack */
-    valbuf<ident_stack> idstack;
+    /* VM stacks of the outer vm_exec invocations, see vm_guard */
+    std::deque<valbuf<any_value>, vmstacks_allocator> vmstacks;
+    /* ident stack; not contiguous, as alias stacks point into it */
+    std::deque<ident_stack, idstack_allocator> idstack;
     /* call stack */
     valbuf<ident_level> callstack;
-    /* per-alias stack pointer */
-    std::unordered_map<
-        int, alias_stack, std::hash<int>, std::equal_to<int>, astack_allocator
-    > astacks;
+    /* VM frames; stable addresses, as they are linked together, and the
+     * first one is a sentinel at the bottom that is never used
+     */
+    std::deque<vm_frame, frame_allocator> frames;
+    /* topmost frame in use */
+    vm_frame *ftop;
+    /* per-alias stack pointer, indexed by ident index and grown as needed;
+     * not contiguous, as references to the entries are held while others
+     * are added, and entries with a null node are not set up yet
+     */
+    std::deque<alias_stack, astack_allocator> astacks;
     /* per-thread storage buffer for error messages */
     charbuf errbuf;
     /* we can attach a hook to vm events */
@@ -43,23 +109,53 @@ struct thread_state {
     /* thread ident flags */
     int ident_flags = 0;
     /* call depth limit */
-    std::size_t max_call_depth = 1024;
+    std::size_t max_call_depth = 65536;
+    /* optimization level of the code generator */
+    int opt_level = 1;
     /* current call depth */
     std::size_t call_depth = 0;
+    /* native nesting level of vm_exec */
+    std::size_t vm_level = 0;
     /* loop nesting level */
     std::size_t loop_level = 0;
+    /* pending break/continue, see raise_loop_ctl */
+    loop_state loop_ctl = loop_state::NORMAL;
+#if LIBCUBESCRIPT_VM_JIT
+    /* where the interpreter continues after native code, and the error
+     * that has made it stop (see cs_jit.hh)
+     */
+    std::uint32_t *jit_code = nullptr;
+    std::exception_ptr jit_error{};
+#endif
     /* debug info */
     std::string_view source{};
     std::size_t *current_line = nullptr;
+#if LIBCUBESCRIPT_VM_OPCODE_STATS
+    /* dynamic opcode pair counts, dumped on destruction */
+    std::size_t op_pairs[BC_INST_OP_MASK + 1][BC_INST_OP_MASK + 1]{};
+    std::uint32_t op_last = BC_INST_START;
+    std::size_t op_count = 0;
+#endif
 
     thread_state(internal_state *cs);
+#if LIBCUBESCRIPT_VM_OPCODE_STATS
+    ~thread_state();
+#endif
 
     hook_func set_hook(hook_func f);
 
     hook_func &get_hook() { return call_hook; }
     hook_func const &get_hook() const { return call_hook; }
 
-    alias_stack &get_astack(alias const *a);
+    alias_stack &get_astack(alias const *a) {
+        auto idx = std::size_t(static_cast<alias_impl const *>(a)->p_index);
+        if ((idx < astacks.size()) && astacks[idx].node) {
+            return astacks[idx];
+        }
+        return init_astack(a);
+    }
+
+    alias_stack &init_astack(alias const *a);
 
     char *request_errbuf(std::size_t bufs, char *&sp);
 };
@@ -3,14 +3,102 @@
 #include "cs_parser.hh"
 #include "cs_state.hh"
 #include "cs_strman.hh"
+#include "cs_val.hh"
 
+#include <charconv>
 #include <cmath>
 #include <cstdlib>
 #include <iterator>
+#include <limits>
+#include <type_traits>
 
 namespace cubescript {
 
+/* numbers are made into strings using std::to_chars when the formats are
+ * the default ones (or any other simple enough ones), which is specified to
+ * produce the same thing as printf in the C locale, and is much faster;
+ * custom formats go through snprintf
+ */
+
+/* the precision of a format like "%.7g" with the given conversion, or -1
+ * if the format is anything else
+ */
+static constexpr int fmt_prec(std::string_view fmt, char conv) {
+    if ((fmt.size() < 4) || (fmt[0] != '%') || (fmt[1] != '.')) {
+        return -1;
+    }
+    if (fmt.back() != conv) {
+        return -1;
+    }
+    int prec = 0;
+    for (auto c: fmt.substr(2, fmt.size() - 3)) {
+        if ((c < '0') || (c > '9') || (prec > 99)) {
+            return -1;
+        }
+        prec = prec * 10 + (c - '0');
+    }
+    return prec;
+}
+
+static constexpr bool intstr_fast() {
+    std::string_view fmt{INTEGER_FORMAT};
+    if constexpr (std::is_same_v<integer_type, int>) {
+        return (fmt == "%d");
+    } else if constexpr (std::is_same_v<integer_type, long>) {
+        return (fmt == "%ld");
+    } else if constexpr (std::is_same_v<integer_type, long long>) {
+        return (fmt == "%lld");
+    }
+    return false;
+}
+
+#if defined(__cpp_lib_to_chars) && (__cpp_lib_to_chars >= 201611L)
+static constexpr int FLOAT_PREC = fmt_prec(FLOAT_FORMAT, 'g');
+static constexpr int ROUND_FLOAT_PREC = fmt_prec(ROUND_FLOAT_FORMAT, 'f');
+
+static std::string_view floatstr_fast(float_type v, charbuf &buf) {
+    auto fmt = std::chars_format::general;
+    auto prec = FLOAT_PREC;
+    if (v == std::floor(v)) {
+        fmt = std::chars_format::fixed;
+        prec = ROUND_FLOAT_PREC;
+    }
+    buf.reserve(32);
+    auto [end, ec] = std::to_chars(buf.data(), buf.data() + 32, v, fmt, prec);
+    if (ec == std::errc::value_too_large) {
+        /* large round numbers have all of their digits written out */
+        std::size_t len = std::numeric_limits<float_type>::max_exponent10;
+        len += prec + 8;
+        buf.reserve(len);
+        auto r = std::to_chars(buf.data(), buf.data() + len, v, fmt, prec);
+        end = r.ptr;
+        ec = r.ec;
+    }
+    if (ec != std::errc{}) {
+        abort(); /* unreachable */
+    }
+    return std::string_view{buf.data(), std::size_t(end - buf.data())};
+}
+#else
+/* floating point to_chars is not there everywhere */
+static constexpr int FLOAT_PREC = -1;
+static constexpr int ROUND_FLOAT_PREC = -1;
+
+static std::string_view floatstr_fast(float_type, charbuf &) {
+    abort(); /* unreachable */
+}
+#endif
+
 static std::string_view intstr(integer_type v, charbuf &buf) {
+    if constexpr (intstr_fast()) {
+        /* enough for any 64-bit integer */
+        buf.reserve(32);
+        auto [end, ec] = std::to_chars(buf.data(), buf.data() + 32, v);
+        if (ec != std::errc{}) {
+            abort(); /* unreachable */
+        }
+        return std::string_view{buf.data(), std::size_t(end - buf.data())};
+    }
     buf.reserve(32);
     int n = snprintf(buf.data(), 32, INTEGER_FORMAT, v);
     if (n > 32) {
@@ -29,6 +117,9 @@ static std::string_view intstr(integer_type v, charbuf &buf) {
 }
 
 static std::string_view floatstr(float_type v, charbuf &buf) {
+    if constexpr ((FLOAT_PREC >= 0) && (ROUND_FLOAT_PREC >= 0)) {
+        return floatstr_fast(v, buf);
+    }
     buf.reserve(32);
     int n;
     if (v == std::floor(v)) {
@@ -56,6 +147,40 @@ static std::string_view floatstr(float_type v, charbuf &buf) {
     return std::string_view{buf.data(), std::size_t(n)};
 }
 
+/* strings of small integers are cached, see string_pool; this returns
+ * the string without taking a reference, the pool holds one
+ */
+static bool intstr_cacheable(integer_type v) {
+    return (v >= string_pool::INTSTR_MIN) && (v <= string_pool::INTSTR_MAX);
+}
+
+static char const *intstr_cached(state &cs, integer_type v) {
+    auto *sp = state_p{cs}.ts().istate->strman;
+    auto &slot = sp->intstrs[v - string_pool::INTSTR_MIN];
+    auto *str = slot.load();
+    if (str) {
+        return str;
+    }
+    charbuf rs{cs};
+    auto *nstr = sp->add(intstr(v, rs));
+    while (!slot.compare_exchange_weak(str, nstr)) {
+        if (str) {
+            /* made by another thread in the meantime */
+            sp->internal_unref(nstr);
+            return str;
+        }
+    }
+    return nstr;
+}
+
+/* the strings made out of values are intermediate, see string_pool */
+static string_ref transient_ref(state &cs, std::string_view str) {
+    auto *sp = state_p{cs}.ts().istate->strman;
+    auto *buf = sp->alloc_buf(str.size());
+    std::memcpy(buf, str.data(), str.size());
+    return sp->steal_transient(buf);
+}
+
 template<typename T>
 static inline void csv_cleanup(value_type tv, T *stor) {
     switch (tv) {
@@ -90,7 +215,7 @@ any_value::any_value(float_type val):
 any_value::any_value(std::string_view val, state &cs):
     p_stor{}, p_type{value_type::STRING}
 {
-    p_stor.s = state_p{cs}.ts().istate->strman->add(val);
+    p_stor.s = state_p{cs}.ts().istate->strman->add_transient(val);
 }
 
 any_value::any_value(string_ref const &val):
@@ -150,8 +275,7 @@ any_value &any_value::operator=(any_value const &v) {
 }
 
 any_value &any_value::operator=(any_value &&v) {
-    *this = v;
-    v.set_none();
+    any_value_p{*this}.steal(v);
     return *this;
 }
 
@@ -198,7 +322,7 @@ void any_value::set_float(float_type val) {
 
 void any_value::set_string(std::string_view val, state &cs) {
     csv_cleanup(p_type, &p_stor);
-    p_stor.s = state_p{cs}.ts().istate->strman->add(val);
+    p_stor.s = state_p{cs}.ts().istate->strman->add_transient(val);
     p_type = value_type::STRING;
 }
 
@@ -290,6 +414,11 @@ std::string_view any_value::force_string(state &cs) {
             str = floatstr(p_stor.f, rs);
             break;
         case value_type::INTEGER:
+            if (intstr_cacheable(p_stor.i)) {
+                p_stor.s = str_managed_ref(intstr_cached(cs, p_stor.i));
+                p_type = value_type::STRING;
+                return str_managed_view(p_stor.s);
+            }
             str = intstr(p_stor.i, rs);
             break;
         case value_type::STRING:
@@ -377,12 +506,15 @@ string_ref any_value::get_string(state &cs) const {
         case value_type::STRING:
             return string_ref{p_stor.s};
         case value_type::INTEGER: {
+            if (intstr_cacheable(p_stor.i)) {
+                return string_ref{intstr_cached(cs, p_stor.i)};
+            }
             charbuf rs{cs};
-            return string_ref{cs, intstr(p_stor.i, rs)};
+            return transient_ref(cs, intstr(p_stor.i, rs));
         }
         case value_type::FLOAT: {
             charbuf rs{cs};
-            return string_ref{cs, floatstr(p_stor.f, rs)};
+            return transient_ref(cs, floatstr(p_stor.f, rs));
         }
         default:
             break;
@@ -454,7 +586,7 @@ LIBCUBESCRIPT_EXPORT string_ref concat_values(
         }
         std::copy(sep.begin(), sep.end(), std::back_inserter(buf));
     }
-    return string_ref{cs, buf.str()};
+    return transient_ref(cs, buf.str());
 }
 
 } /* namespace cubescript */
@@ -0,0 +1,128 @@
+#ifndef LIBCUBESCRIPT_VAL_HH
+#define LIBCUBESCRIPT_VAL_HH
+
+#include <cubescript/cubescript.hh>
+
+#include <cstring>
+
+#include "cs_strman.hh"
+
+namespace cubescript {
+
+/* inline access to the storage of values, for the VM
+ *
+ * numbers (and idents) hold no references, so they can be stored, copied
+ * and tested in place, without going through the out-of-line public API
+ * and its cleanup of the previous contents; everything else falls back
+ * to the public API, so the refcounting stays in one place
+ */
+struct any_value_p {
+    any_value_p(any_value &v): vp{&v} {}
+
+    /* whether values of the type hold a reference that must be released */
+    static bool managed(value_type tp) {
+        switch (tp) {
+            case value_type::STRING:
+            case value_type::CODE:
+                return true;
+            default:
+                break;
+        }
+        return false;
+    }
+
+    bool managed() const {
+        return managed(vp->p_type);
+    }
+
+    value_type type() const {
+        return vp->p_type;
+    }
+
+    void set_none() {
+        if (managed()) {
+            vp->set_none();
+        } else {
+            vp->p_type = value_type::NONE;
+        }
+    }
+
+    void set_integer(integer_type val) {
+        if (managed()) {
+            vp->set_integer(val);
+        } else {
+            vp->p_type = value_type::INTEGER;
+            vp->p_stor.i = val;
+        }
+    }
+
+    void set_float(float_type val) {
+        if (managed()) {
+            vp->set_float(val);
+        } else {
+            vp->p_type = value_type::FLOAT;
+            vp->p_stor.f = val;
+        }
+    }
+
+    /* copy v into the value; references are only taken for managed types */
+    void assign(any_value const &v) {
+        if (managed() || managed(v.p_type)) {
+            *vp = v;
+            return;
+        }
+        vp->p_type = v.p_type;
+        std::memcpy(&vp->p_stor, &v.p_stor, sizeof(vp->p_stor));
+    }
+
+    /* move v into the value, leaving v null; this transfers any reference
+     * instead of taking a new one and dropping the old one
+     */
+    void steal(any_value &v) {
+        set_none();
+        vp->p_type = v.p_type;
+        std::memcpy(&vp->p_stor, &v.p_stor, sizeof(vp->p_stor));
+        v.p_type = value_type::NONE;
+    }
+
+    /* values stored for longer hold interned strings, see string_pool */
+    void intern() {
+        if (vp->p_type == value_type::STRING) {
+            vp->p_stor.s = str_managed_intern(vp->p_stor.s);
+        }
+    }
+
+    integer_type get_integer() const {
+        if (vp->p_type == value_type::INTEGER) {
+            return vp->p_stor.i;
+        }
+        return vp->get_integer();
+    }
+
+    float_type get_float() const {
+        if (vp->p_type == value_type::FLOAT) {
+            return vp->p_stor.f;
+        }
+        return vp->get_float();
+    }
+
+    bool get_bool() const {
+        switch (vp->p_type) {
+            case value_type::INTEGER:
+                return vp->p_stor.i != 0;
+            case value_type::FLOAT:
+                return vp->p_stor.f != 0;
+            case value_type::NONE:
+                return false;
+            default:
+                break;
+        }
+        return vp->get_bool();
+    }
+
+    any_value *vp;
+};
+
+} /* namespace cubescript */
+
+#endif
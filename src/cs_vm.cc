@@ -1,10 +1,16 @@
 #include <cubescript/cubescript.hh>
 #include "cs_vm.hh"
+#include "cs_val.hh"
 #include "cs_std.hh"
 #include "cs_parser.hh"
 #include "cs_error.hh"
 
+#if LIBCUBESCRIPT_VM_JIT
+#  include "cs_jit.hh"
+#endif
+
 #include <cstdio>
+#include <algorithm>
 #include <cmath>
 #include <limits>
 
@@ -16,7 +22,7 @@ static inline void push_alias(thread_state &ts, ident &id, ident_stack &st) {
     }
     if (!static_cast<alias &>(id).is_arg()) {
         auto *aimp = static_cast<alias_impl *>(&id);
-        auto ast = ts.get_astack(aimp);
+        auto &ast = ts.get_astack(aimp);
         ast.push(st);
         ast.flags &= ~IDENT_FLAG_UNKNOWN;
     }
@@ -31,106 +37,122 @@ static inline void pop_alias(thread_state &ts, ident &id) {
     }
 }
 
+/* coerce an argument to the type given by a command's format character */
+static inline void exec_coerce(state &cs, char type, any_value &arg) {
+    auto tp = any_value_p{arg}.type();
+    switch (type) {
+        case 'i':
+            if (tp != value_type::INTEGER) {
+                arg.force_integer();
+            }
+            break;
+        case 'f':
+            if (tp != value_type::FLOAT) {
+                arg.force_float();
+            }
+            break;
+        case 's':
+            if (tp != value_type::STRING) {
+                arg.force_string(cs);
+            }
+            break;
+        case 'c':
+            if (tp == value_type::STRING) {
+                if (arg.get_string(cs).empty()) {
+                    arg.set_integer(0);
+                } else {
+                    arg.force_code(cs);
+                }
+            }
+            break;
+        case 'b':
+            if (tp != value_type::CODE) {
+                arg.force_code(cs);
+            }
+            break;
+        case 'v':
+            if (tp != value_type::IDENT) {
+                arg.force_ident(cs);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* args must have room for at least the fixed arguments of the command */
 void exec_command(
     thread_state &ts, command_impl *id, ident *self, any_value *args,
     any_value &res, std::size_t nargs, bool lookup
 ) {
-    int i = -1, fakeargs = 0, numargs = int(nargs);
-    bool rep = false;
-    auto fmt = id->args();
-    auto set_fake = [](
-        int &idx, int &fargs, bool r, int argn, any_value *argp
-    ) {
-        if (++idx >= argn) {
-            if (r) {
-                return false;
-            }
-            argp[idx].set_none();
-            ++fargs;
-            return false;
-        }
-        return true;
-    };
-    for (auto it = fmt.begin(); it != fmt.end(); ++it) {
-        switch (*it) {
-            case 'i':
-                if (set_fake(i, fakeargs, rep, numargs, args)) {
-                    args[i].force_integer();
-                }
-                break;
-            case 'f':
-                if (set_fake(i, fakeargs, rep, numargs, args)) {
-                    args[i].force_float();
-                }
-                break;
-            case 's':
-                if (set_fake(i, fakeargs, rep, numargs, args)) {
-                    args[i].force_string(*ts.pstate);
-                }
-                break;
-            case 'a':
-                set_fake(i, fakeargs, rep, numargs, args);
-                break;
-            case 'c':
-                if (set_fake(i, fakeargs, rep, numargs, args)) {
-                    if (args[i].type() == value_type::STRING) {
-                        auto str = args[i].get_string(*ts.pstate);
-                        if (str.empty()) {
-                            args[i].set_integer(0);
-                        } else {
-                            args[i].force_code(*ts.pstate);
-                        }
-                    }
-                }
-                break;
-            case 'b':
-                if (set_fake(i, fakeargs, rep, numargs, args)) {
-                    args[i].force_code(*ts.pstate);
-                }
-                break;
-            case 'v':
-                if (set_fake(i, fakeargs, rep, numargs, args)) {
-                    args[i].force_ident(*ts.pstate);
-                }
-                break;
+    auto &cs = *ts.pstate;
+    auto &plan = id->p_plan;
+    std::size_t i = 0, fakeargs = 0;
+    auto exec_arg = [&](char type) {
+        switch (type) {
             case '$':
-                i += 1;
                 args[i].set_ident(*self);
                 break;
             case '#':
-                i += 1;
-                args[i].set_integer(integer_type(lookup ? -1 : i - fakeargs));
+                args[i].set_integer(
+                    lookup ? integer_type(-1) : integer_type(i - fakeargs)
+                );
                 break;
-            case '.':
-                i = std::max(i + 1, numargs);
-                id->call_id(ts, span_type<any_value>{args, std::size_t(i)}, res);
-                return;
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-                if (i + 1 < numargs) {
-                    it -= *it - '0' + 1;
-                    rep = true;
-                }
+            default:
+                exec_coerce(cs, type, args[i]);
                 break;
         }
+    };
+    for (; i < plan.nfixed; ++i) {
+        char type = plan.steps[i];
+        if ((i >= nargs) && (type != '$') && (type != '#')) {
+            /* missing arguments are passed as none */
+            args[i].set_none();
+            ++fakeargs;
+            continue;
+        }
+        exec_arg(type);
+    }
+    if (!plan.variadic) {
+        id->call_id(ts, span_type<any_value>{args, i}, res);
+        res.force_plain();
+        return;
     }
-    ++i;
-    id->call_id(ts, span_type<any_value>{args, std::size_t(i)}, res);
-    res.force_plain();
+    if (plan.nrep) {
+        for (std::size_t j = plan.nfixed - plan.nrep; i < nargs; ++i) {
+            exec_arg(plan.steps[j]);
+            if (++j == plan.nfixed) {
+                j -= plan.nrep;
+            }
+        }
+    }
+    id->call_id(ts, span_type<any_value>{args, std::max(i, nargs)}, res);
 }
 
-any_value exec_alias(
-    thread_state &ts, alias *a, any_value *args,
+/* the code of the current value of an alias, compiled on first use */
+static bcode_ref const &vm_alias_code(thread_state &ts, alias_stack &astack) {
+    if (!astack.node->code) {
+        gen_state gs{ts};
+        gs.gen_main(astack.node->val_s.get_string(*ts.pstate));
+        astack.node->code = gs.steal_ref();
+    }
+    return astack.node->code;
+}
+
+/* set up an alias call in the given frame: the arguments are moved into
+ * the argument aliases, numargs and ident flags are saved and set, and
+ * a callstack level is pushed; once the frame kind is VM_FRAME_ALIAS,
+ * vm_alias_leave must be used to undo this, even if compilation fails
+ */
+static void vm_alias_enter(
+    thread_state &ts, vm_frame &fr, alias *a, any_value *args,
     std::size_t callargs, alias_stack &astack
 ) {
     /* excess arguments get ignored (make error maybe?) */
-    any_value ret;
     callargs = std::min(callargs, MAX_ARGUMENTS);
     builtin_var *anargs = ts.istate->ivar_numargs;
     argset uargs{};
-    std::size_t noff = ts.idstack.size();
+    fr.idtop = ts.idstack.size();
     for(std::size_t i = 0; i < callargs; i++) {
         auto &ast = ts.get_astack(
             static_cast<alias *>(ts.istate->argmap[i])
@@ -140,65 +162,124 @@ any_value exec_alias(
         st.val_s = std::move(args[i]);
         uargs[i] = true;
     }
-    auto oldargs = anargs->value();
-    auto oldflags = ts.ident_flags;
+    fr.nargs = callargs;
+    fr.oldargs = anargs->value().get_integer();
+    fr.oldflags = ts.ident_flags;
     ts.ident_flags = astack.flags;
     any_value cv;
     cv.set_integer(integer_type(callargs));
     anargs->set_raw_value(*ts.pstate, std::move(cv));
     auto &lev = ts.callstack.emplace_back(*a);
     lev.usedargs = std::move(uargs);
-    if (!astack.node->code) {
-        try {
-            gen_state gs{ts};
-            gs.gen_main(astack.node->val_s.get_string(*ts.pstate));
-            astack.node->code = gs.steal_ref();
-        } catch (...) {
-            ts.callstack.pop_back();
-            throw;
-        }
+    fr.kind = VM_FRAME_ALIAS;
+    fr.code = vm_alias_code(ts, astack);
+}
+
+static void vm_alias_leave(thread_state &ts, vm_frame &fr) {
+    auto amask = ts.callstack.back().usedargs;
+    ts.callstack.pop_back();
+    ts.ident_flags = fr.oldflags;
+    std::size_t cargs = fr.nargs;
+    for (std::size_t i = 0; i < cargs; i++) {
+        ts.get_astack(
+            static_cast<alias *>(ts.istate->argmap[i])
+        ).pop();
+        amask[i] = false;
     }
-    bcode_ref coderef = astack.node->code;
-    auto cleanup = [](
-        auto &tss, std::size_t cargs, std::size_t nids, auto oflags
-    ) {
-        auto amask = tss.callstack.back().usedargs;
-        tss.callstack.pop_back();
-        tss.ident_flags = oflags;
-        for (std::size_t i = 0; i < cargs; i++) {
-            tss.get_astack(
-                static_cast<alias *>(tss.istate->argmap[i])
+    for (; amask.any(); ++cargs) {
+        if (amask[cargs]) {
+            ts.get_astack(
+                static_cast<alias *>(ts.istate->argmap[cargs])
             ).pop();
-            amask[i] = false;
+            amask[cargs] = false;
         }
-        for (; amask.any(); ++cargs) {
-            if (amask[cargs]) {
-                tss.get_astack(
-                    static_cast<alias *>(tss.istate->argmap[cargs])
-                ).pop();
-                amask[cargs] = false;
-            }
-        }
-        tss.idstack.resize(nids);
-    };
+    }
+    ts.idstack.resize(fr.idtop);
+    any_value cv;
+    cv.set_integer(fr.oldargs);
+    ts.istate->ivar_numargs->set_raw_value(*ts.pstate, std::move(cv));
+}
+
+any_value exec_alias(
+    thread_state &ts, alias *a, any_value *args,
+    std::size_t callargs, alias_stack &astack
+) {
+    any_value ret;
+    vm_frame fr;
     try {
-        vm_exec(ts, bcode_p{coderef}.get()->raw(), ret);
+        vm_alias_enter(ts, fr, a, args, callargs, astack);
+        vm_exec(ts, bcode_p{fr.code}.get()->raw(), ret);
     } catch (...) {
-        cleanup(ts, callargs, noff, oldflags);
-        anargs->set_raw_value(*ts.pstate, std::move(oldargs));
+        if (fr.kind == VM_FRAME_ALIAS) {
+            vm_alias_leave(ts, fr);
+        }
         throw;
     }
-    cleanup(ts, callargs, noff, oldflags);
-    anargs->set_raw_value(*ts.pstate, std::move(oldargs));
+    vm_alias_leave(ts, fr);
     return ret;
 }
 
-any_value exec_code_with_args(thread_state &ts, bcode_ref const &body) {
-    if (ts.callstack.empty()) {
-        return body.call(*ts.pstate);
+any_value lookup_ident_value(
+    thread_state &ts, ident *id, std::string_view name
+) {
+    if (id) {
+        switch(id->type()) {
+            case ident_type::ALIAS: {
+                auto *a = static_cast<alias_impl *>(id);
+                auto &ast = ts.get_astack(static_cast<alias *>(id));
+                if (ast.flags & IDENT_FLAG_UNKNOWN) {
+                    break;
+                }
+                if (a->is_arg() && !ident_is_used_arg(id, ts)) {
+                    return any_value{};
+                }
+                return ast.node->val_s.get_plain();
+            }
+            case ident_type::VAR:
+                return static_cast<builtin_var *>(id)->value();
+            case ident_type::COMMAND: {
+                any_value val{};
+                auto *cimpl = static_cast<command_impl *>(id);
+                auto &args = ts.vmstack;
+                auto osz = args.size();
+                /* pad with as many empty values as we need */
+                args.resize(osz + cimpl->p_plan.nfixed);
+                try {
+                    exec_command(ts, cimpl, cimpl, &args[osz], val, 0, true);
+                } catch (...) {
+                    args.resize(osz);
+                    throw;
+                }
+                args.resize(osz);
+                return val;
+            }
+            default:
+                return any_value{};
+        }
+    }
+    throw error_p::make(
+        *ts.pstate, "unknown alias lookup: %s", name.data()
+    );
+}
+
+void raise_loop_ctl(thread_state &ts) {
+    switch (std::exchange(ts.loop_ctl, loop_state::NORMAL)) {
+        case loop_state::BREAK:
+            throw break_exception{};
+        case loop_state::CONTINUE:
+            throw continue_exception{};
+        default:
+            break;
     }
+}
+
+/* for BC_INST_DO_ARGS: restore the argument aliases to the previous
+ * callstack level, undone by vm_args_leave; the callstack must not
+ * be empty
+ */
+static void vm_args_enter(thread_state &ts, vm_frame &fr) {
     auto mask = ts.callstack.back().usedargs;
-    std::size_t noff = ts.idstack.size();
+    fr.idtop = ts.idstack.size();
     for (std::size_t i = 0; mask.any(); ++i) {
         if (mask[0]) {
             auto &ast = ts.get_astack(
@@ -210,280 +291,950 @@ any_value exec_code_with_args(thread_state &ts, bcode_ref const &body) {
         }
         mask >>= 1;
     }
-    ident_level *prevstack = nullptr;
-    if (ts.callstack.size() >= 2) {
-        prevstack = &ts.callstack[ts.callstack.size() - 2];
-    }
+    /* the level below the current one, if any, is where the args are
+     * restored from; it's looked up by index as the callstack may move
+     */
     auto &lev = ts.callstack.emplace_back(ts.callstack.back().id);
-    if (!prevstack) {
+    std::size_t nlev = ts.callstack.size();
+    if (nlev < 3) {
         lev.usedargs.set();
     } else {
-        lev.usedargs = prevstack->usedargs;
+        lev.usedargs = ts.callstack[nlev - 3].usedargs;
     }
-    auto cleanup = [](auto &tss, ident_level *pstack, std::size_t offn) {
-        auto mask2 = tss.callstack.back().usedargs;
-        if (pstack) {
-            pstack->usedargs = mask2;
-        }
-        tss.callstack.pop_back();
-        for (std::size_t i = 0, nredo = 0; mask2.any(); ++i) {
-            if (mask2[0]) {
-                tss.get_astack(
-                    static_cast<alias *>(tss.istate->argmap[i])
-                ).node = tss.idstack[offn + nredo++].next;
-            }
-            mask2 >>= 1;
+    fr.kind = VM_FRAME_ARGS;
+}
+
+static void vm_args_leave(thread_state &ts, vm_frame &fr) {
+    std::size_t nlev = ts.callstack.size();
+    if (nlev >= 3) {
+        ts.callstack[nlev - 3].usedargs = ts.callstack.back().usedargs;
+    }
+    ts.callstack.pop_back();
+    /* redo the args that were undone, which is by the current level's
+     * mask, not the one the code was run with (that may have any bits)
+     */
+    auto mask = ts.callstack.back().usedargs;
+    for (std::size_t i = 0, nredo = 0; mask.any(); ++i) {
+        if (mask[0]) {
+            ts.get_astack(
+                static_cast<alias *>(ts.istate->argmap[i])
+            ).node = ts.idstack[fr.idtop + nredo++].next;
         }
-    };
+        mask >>= 1;
+    }
+    ts.idstack.resize(fr.idtop);
+}
+
+any_value exec_code_with_args(thread_state &ts, bcode_ref const &body) {
     any_value ret;
+    if (ts.callstack.empty()) {
+        vm_exec(ts, bcode_p{body}.get()->raw(), ret);
+        return ret;
+    }
+    vm_frame fr;
+    vm_args_enter(ts, fr);
     try {
-        ret = body.call(*ts.pstate);
+        vm_exec(ts, bcode_p{body}.get()->raw(), ret);
     } catch (...) {
-        cleanup(ts, prevstack, noff);
-        ts.idstack.resize(noff);
+        vm_args_leave(ts, fr);
         throw;
     }
-    cleanup(ts, prevstack, noff);
-    ts.idstack.resize(noff);
+    vm_args_leave(ts, fr);
     return ret;
 }
 
+/* VM frames
+ *
+ * within a single vm_exec, nested code (BC_INST_ENTER and friends, DO,
+ * local) and alias calls do not recurse natively; a frame is pushed
+ * on ts.frames and the dispatch loop carries on with the new code,
+ * then once that exits, the frame is popped and the instruction that
+ * pushed it is completed; this way the native stack only grows when
+ * the VM is reentered from outside, e.g. by a command running a block
+ */
+static inline vm_frame &vm_push_frame(
+    thread_state &ts, int kind, std::uint32_t op, std::uint32_t *retcode
+) {
+    if (ts.max_call_depth && (ts.call_depth >= ts.max_call_depth)) {
+        throw error{*ts.pstate, "exceeded recursion limit"};
+    }
+    auto *pfr = ts.ftop;
+    if (!pfr->next) {
+        pfr->next = &ts.frames.emplace_back();
+        pfr->next->prev = pfr;
+    }
+    auto &fr = *pfr->next;
+    ts.ftop = &fr;
+    ++ts.call_depth;
+    fr.kind = kind;
+    fr.op = op;
+    fr.retcode = retcode;
+#if LIBCUBESCRIPT_VM_JIT
+    fr.jit = nullptr;
+#endif
+    fr.vmtop = ts.vmstack.size();
+    if (ts.call_hook) {
+        ts.call_hook(*ts.pstate);
+    }
+    return fr;
+}
+
+/* undo whatever the frame has set up, result is left in the frame */
+static inline void vm_leave_frame(thread_state &ts, vm_frame &fr) {
+    switch (fr.kind) {
+        case VM_FRAME_LOCAL: {
+            auto &args = ts.vmstack;
+            for (std::size_t i = fr.vmtop - fr.nargs; i < fr.vmtop; ++i) {
+                pop_alias(ts, args[i].get_ident(*ts.pstate));
+            }
+            ts.idstack.resize(fr.idtop);
+            break;
+        }
+        case VM_FRAME_ALIAS:
+            vm_alias_leave(ts, fr);
+            break;
+        case VM_FRAME_ARGS:
+            vm_args_leave(ts, fr);
+            break;
+        case VM_FRAME_LOOP:
+            /* the loop ident is in the first slot, see vm_loop_enter */
+            if (fr.nargs) {
+                auto &id = ts.vmstack[fr.vmtop].get_ident(*ts.pstate);
+                ts.get_astack(static_cast<alias *>(&id)).pop();
+                ts.idstack.resize(fr.idtop);
+            }
+            --ts.loop_level;
+            break;
+        default:
+            break;
+    }
+    ts.vmstack.resize(fr.vmtop);
+}
+
+/* the result is expected to have been moved out of the frame already */
+static inline void vm_pop_frame(thread_state &ts, vm_frame &fr) {
+    if (bcode_p{fr.code}.get()) {
+        fr.code = bcode_ref{};
+    }
+    ts.ftop = fr.prev;
+    --ts.call_depth;
+}
+
+/* when the VM is reentered from a command, the command's arguments are
+ * still on the VM stack, so the nested invocation gets a stack of its own
+ * (recycled across calls) to keep them from being moved by its pushes
+ */
 struct vm_guard {
-    vm_guard(thread_state &s): ts{s}, oldtop{s.vmstack.size()} {
-        if (s.max_call_depth && (s.call_depth >= s.max_call_depth)) {
+    vm_guard(thread_state &s): ts{s}, base{s.ftop} {
+        if (s.vm_level >= MAX_VM_NESTING) {
             throw error{*s.pstate, "exceeded recursion limit"};
         }
-        ++s.call_depth;
+        if (s.vm_level) {
+            if (s.vmstacks.size() < s.vm_level) {
+                s.vmstacks.emplace_back(s.istate).reserve(32);
+            }
+            s.vmstack.buf.swap(s.vmstacks[s.vm_level - 1].buf);
+        }
+        ++s.vm_level;
     }
 
+    /* frames are left over on errors and break/continue */
     ~vm_guard() {
-        --ts.call_depth;
-        ts.vmstack.resize(oldtop);
+        while (ts.ftop != base) {
+            auto &fr = *ts.ftop;
+            vm_leave_frame(ts, fr);
+            any_value_p{fr.val}.set_none();
+            vm_pop_frame(ts, fr);
+        }
+        if (--ts.vm_level) {
+            ts.vmstack.buf.swap(ts.vmstacks[ts.vm_level - 1].buf);
+        }
     }
 
     thread_state &ts;
-    std::size_t oldtop;
+    vm_frame *base;
 };
 
-std::uint32_t *vm_exec(
-    thread_state &ts, std::uint32_t *code, any_value &result
+/* BC_INST_CALL in tail position (BC_CALL_TAIL): if the code runs in the
+ * frame of an alias call, possibly within inline code, the frame is reused
+ * for the callee, dropping the caller's arguments and callstack level
+ * right away rather than once the callee is done, so that recursion in
+ * tail position runs in constant space; that is not done for callees
+ * that may run doargs (BC_START_DOARGS), as the caller's level would be
+ * gone by then
+ *
+ * the arguments start at offset on the VM stack; null if there is no
+ * frame to reuse, in which case nothing is done
+ */
+static vm_frame *vm_tail_call(
+    thread_state &ts, alias *a, std::size_t offset, std::size_t callargs,
+    alias_stack &astack
 ) {
-    result.set_none();
-    auto &cs = *ts.pstate;
-    vm_guard scope{ts}; /* keep track of recursion depth + manage stack */
+    auto *afr = ts.ftop;
+    while (
+        (afr->kind == VM_FRAME_CODE) &&
+        ((afr->op & BC_INST_OP_MASK) == BC_INST_ENTER_RESULT)
+    ) {
+        afr = afr->prev;
+    }
+    if (afr->kind != VM_FRAME_ALIAS) {
+        return nullptr;
+    }
+    auto *start = bcode_p{vm_alias_code(ts, astack)}.get()->raw() - 1;
+    if (*start & BC_START_DOARGS) {
+        return nullptr;
+    }
+    /* inline code frames only hold their result */
+    while (ts.ftop != afr) {
+        auto &fr = *ts.ftop;
+        any_value_p{fr.val}.set_none();
+        vm_pop_frame(ts, fr);
+    }
+    vm_alias_leave(ts, *afr);
+    afr->kind = VM_FRAME_CODE;
+    any_value_p{afr->val}.set_none();
     auto &args = ts.vmstack;
-    auto &chook = cs.call_hook();
-    if (chook) {
-        chook(cs);
-    }
-    auto force_val = [](state &s, any_value &v, int opn) {
-        switch (opn & BC_INST_RET_MASK) {
-            case BC_RET_STRING:
-                v.force_string(s);
-                break;
-            case BC_RET_INT:
+    if (offset != afr->vmtop) {
+        for (std::size_t i = 0; i < callargs; ++i) {
+            any_value_p{args[afr->vmtop + i]}.steal(args[offset + i]);
+        }
+    }
+    args.resize(afr->vmtop + callargs);
+#if LIBCUBESCRIPT_VM_JIT
+    afr->jit = nullptr;
+#endif
+    if (ts.call_hook) {
+        ts.call_hook(*ts.pstate);
+    }
+    vm_alias_enter(ts, *afr, a, &args[afr->vmtop], callargs, astack);
+    args.resize(afr->vmtop);
+    return afr;
+}
+
+/* look up an ident by name for BC_INST_CALL_U and BC_INST_LOOKUP_U, using
+ * the cache word following the instruction; the word holds the index of
+ * the last ident found plus one, and the cached ident is still the right
+ * one if its name is the same (the very same pointer if the name given
+ * is interned, but it may be an intermediate string as well)
+ *
+ * idents are never removed or renamed, so a hit cannot go stale; a miss
+ * (or a name interned twice by racing threads) just does the full lookup
+ */
+static inline ident *vm_get_ident(
+    thread_state &ts, std::uint32_t &cache, string_ref const &name
+) {
+    atomic_ref_type<std::uint32_t> cref{cache};
+    auto cidx = cref.load();
+    if (cidx) {
+        auto *id = ts.istate->lookup_ident(cidx - 1);
+        auto idn = id->name();
+        if ((idn.data() == name.data()) || (idn == name.view())) {
+            return id;
+        }
+    }
+    auto *id = ts.istate->get_ident(name);
+    if (id) {
+        cref.store(std::uint32_t(id->index() + 1));
+    }
+    return id;
+}
+
+/* the following implement instructions for both vm_exec and the helpers
+ * called by native code (see cs_jit.hh)
+ */
+
+/* force a value to the type given by the instruction */
+static inline void vm_force_val(state &cs, any_value &v, std::uint32_t op) {
+    /* values are mostly of the right type already */
+    auto tp = any_value_p{v}.type();
+    switch (op & BC_INST_RET_MASK) {
+        case BC_RET_STRING:
+            if (tp != value_type::STRING) {
+                v.force_string(cs);
+            }
+            break;
+        case BC_RET_INT:
+            if (tp != value_type::INTEGER) {
                 v.force_integer();
-                break;
-            case BC_RET_FLOAT:
+            }
+            break;
+        case BC_RET_FLOAT:
+            if (tp != value_type::FLOAT) {
                 v.force_float();
-                break;
+            }
+            break;
+    }
+}
+
+/* BC_INST_COMPILE */
+static inline void vm_compile_arg(thread_state &ts, any_value &arg) {
+    gen_state gs{ts};
+    switch (arg.type()) {
+        case value_type::INTEGER:
+            gs.gen_main_integer(arg.get_integer());
+            break;
+        case value_type::FLOAT:
+            gs.gen_main_float(arg.get_float());
+            break;
+        case value_type::STRING:
+            gs.gen_main(arg.get_string(*ts.pstate));
+            break;
+        default:
+            gs.gen_main_null();
+            break;
+    }
+    arg.set_code(gs.steal_ref());
+}
+
+/* BC_INST_COND */
+static inline void vm_cond_arg(thread_state &ts, any_value &arg) {
+    switch (arg.type()) {
+        case value_type::STRING: {
+            std::string_view s = arg.get_string(*ts.pstate);
+            if (!s.empty()) {
+                gen_state gs{ts};
+                gs.gen_main(s);
+                arg.set_code(gs.steal_ref());
+            } else {
+                arg.force_none();
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/* BC_INST_IDENT and BC_INST_IDENT_U: an argument alias that is not set
+ * in the current call gets a node of its own, so that it can be assigned
+ */
+static inline void vm_set_ident(thread_state &ts, any_value &arg, ident *id) {
+    alias *a = static_cast<alias *>(id);
+    if (a->is_arg() && !ident_is_used_arg(id, ts)) {
+        ts.get_astack(a).push(ts.idstack.emplace_back());
+        ts.callstack.back().usedargs[id->index()] = true;
+    }
+    arg.set_ident(*id);
+}
+
+/* BC_INST_LOOKUP, the value is pushed */
+static inline void vm_lookup_alias(thread_state &ts, ident *id) {
+    auto &args = ts.vmstack;
+    if (static_cast<alias *>(id)->is_arg()) {
+        auto &v = args.emplace_back();
+        if (ident_is_used_arg(id, ts)) {
+            any_value_p{v}.assign(ts.get_astack(
+                static_cast<alias *>(id)
+            ).node->val_s);
         }
+        return;
+    }
+    auto &ast = ts.get_astack(static_cast<alias *>(id));
+    if (ast.flags & IDENT_FLAG_UNKNOWN) {
+        throw error_p::make(
+            *ts.pstate, "unknown alias lookup: %s", id->name().data()
+        );
+    }
+    any_value_p{args.emplace_back()}.assign(ast.node->val_s);
+}
+
+/* BC_INST_CONC and BC_INST_CONC_W */
+static inline void vm_concat(thread_state &ts, std::uint32_t op) {
+    auto &args = ts.vmstack;
+    std::size_t numconc = op >> 8;
+    auto buf = concat_values(
+        *ts.pstate, span_type<any_value>{
+            &args[args.size() - numconc], numconc
+        }, ((op & BC_INST_OP_MASK) == BC_INST_CONC) ? " " : ""
+    );
+    args.resize(args.size() - numconc);
+    args.emplace_back().set_string(buf);
+}
+
+/* BC_INST_MATH and BC_INST_MATH_ARG; res may be the left operand */
+static inline void vm_math(
+    any_value &res, any_value &a, any_value &b, std::uint32_t mop
+) {
+    any_value_p r{res}, x{a}, y{b};
+    switch (mop) {
+        case BC_MATH_ADD:
+            r.set_integer(x.get_integer() + y.get_integer());
+            break;
+        case BC_MATH_SUB:
+            r.set_integer(x.get_integer() - y.get_integer());
+            break;
+        case BC_MATH_MUL:
+            r.set_integer(x.get_integer() * y.get_integer());
+            break;
+        case BC_MATH_DIV: {
+            auto d = y.get_integer();
+            r.set_integer(d ? (x.get_integer() / d) : integer_type(0));
+            break;
+        }
+        case BC_MATH_MOD: {
+            auto d = y.get_integer();
+            r.set_integer(d ? (x.get_integer() % d) : integer_type(0));
+            break;
+        }
+        case BC_MATH_EQ:
+            r.set_integer(integer_type(x.get_integer() == y.get_integer()));
+            break;
+        case BC_MATH_NE:
+            r.set_integer(integer_type(x.get_integer() != y.get_integer()));
+            break;
+        case BC_MATH_LT:
+            r.set_integer(integer_type(x.get_integer() < y.get_integer()));
+            break;
+        case BC_MATH_GT:
+            r.set_integer(integer_type(x.get_integer() > y.get_integer()));
+            break;
+        case BC_MATH_LE:
+            r.set_integer(integer_type(x.get_integer() <= y.get_integer()));
+            break;
+        case BC_MATH_GE:
+            r.set_integer(integer_type(x.get_integer() >= y.get_integer()));
+            break;
+        case BC_MATH_ADDF:
+            r.set_float(x.get_float() + y.get_float());
+            break;
+        case BC_MATH_SUBF:
+            r.set_float(x.get_float() - y.get_float());
+            break;
+        case BC_MATH_MULF:
+            r.set_float(x.get_float() * y.get_float());
+            break;
+        case BC_MATH_DIVF: {
+            auto d = y.get_float();
+            r.set_float(d ? (x.get_float() / d) : float_type(0));
+            break;
+        }
+        case BC_MATH_EQF:
+            r.set_integer(integer_type(x.get_float() == y.get_float()));
+            break;
+        case BC_MATH_NEF:
+            r.set_integer(integer_type(x.get_float() != y.get_float()));
+            break;
+        case BC_MATH_LTF:
+            r.set_integer(integer_type(x.get_float() < y.get_float()));
+            break;
+        case BC_MATH_GTF:
+            r.set_integer(integer_type(x.get_float() > y.get_float()));
+            break;
+        case BC_MATH_LEF:
+            r.set_integer(integer_type(x.get_float() <= y.get_float()));
+            break;
+        case BC_MATH_GEF:
+            r.set_integer(integer_type(x.get_float() >= y.get_float()));
+            break;
+        default:
+            break;
+    }
+}
+
+/* BC_INST_ALIAS and friends */
+static inline void vm_set_alias(
+    thread_state &ts, std::uint32_t idx, any_value &v
+) {
+    auto *a = static_cast<alias *>(ts.istate->lookup_ident(idx));
+    auto &ast = ts.get_astack(a);
+    if (a->is_arg()) {
+        ast.set_arg(a, ts, v);
+    } else {
+        ast.set_alias(a, ts, v);
+    }
+}
+
+/* BC_INST_LOCAL: the idents on top of the stack get pushed for the
+ * duration of the given frame
+ */
+static inline void vm_push_locals(
+    thread_state &ts, vm_frame &fr, std::size_t numlocals
+) {
+    auto &args = ts.vmstack;
+    std::size_t offset = args.size() - numlocals;
+    fr.idtop = ts.idstack.size();
+    fr.nargs = numlocals;
+    for (std::size_t i = 0; i < numlocals; ++i) {
+        push_alias(
+            ts, args[offset + i].get_ident(*ts.pstate),
+            ts.idstack.emplace_back()
+        );
+    }
+}
+
+/* loops (BC_INST_LOOP)
+ *
+ * the loop frame stays for the whole loop, restarting its code (right
+ * past the instruction and its kind word) on every iteration, so that
+ * the loop runs within the VM much like nested code; its state is kept
+ * in slots on the VM stack, right below the frame's own stack (fr.nargs
+ * of them, starting at fr.vmtop): the loop ident, and then either the
+ * counter, count, offset and step, or the list, the position of its
+ * next item and that of the current one (-1 before the first); the ident
+ * is pushed like a local, its value being at fr.idtop
+ */
+enum {
+    VM_LOOP_IDENT = 0,
+    VM_LOOP_COUNTER,
+    VM_LOOP_NUM,
+    VM_LOOP_OFFSET,
+    VM_LOOP_STEP,
+    VM_LOOP_LIST = VM_LOOP_COUNTER,
+    VM_LOOP_POS = VM_LOOP_NUM,
+    VM_LOOP_PREV = VM_LOOP_OFFSET
+};
+
+static inline std::uint32_t *vm_loop_code(vm_frame &fr) {
+    return fr.retcode - (fr.op >> 8) + 1;
+}
+
+/* set up the next iteration, false once the loop is done */
+static bool vm_loop_next(thread_state &ts, vm_frame &fr) {
+    auto &cs = *ts.pstate;
+    auto &args = ts.vmstack;
+    auto kind = vm_loop_code(fr)[-1];
+    args.resize(fr.vmtop + fr.nargs);
+    any_value_p{fr.val}.set_none();
+    if (ts.call_hook) {
+        ts.call_hook(cs);
+    }
+    auto *slots = &args[fr.vmtop];
+    if (kind & BC_LOOP_NUM) {
+        auto i = any_value_p{slots[VM_LOOP_COUNTER]}.get_integer() + 1;
+        if (i >= any_value_p{slots[VM_LOOP_NUM]}.get_integer()) {
+            return false;
+        }
+        any_value_p{slots[VM_LOOP_COUNTER]}.set_integer(i);
+        any_value_p{ts.idstack[fr.idtop].val_s}.set_integer(
+            any_value_p{slots[VM_LOOP_OFFSET]}.get_integer() +
+            i * any_value_p{slots[VM_LOOP_STEP]}.get_integer()
+        );
+    } else if (kind & BC_LOOP_LIST) {
+        auto lst = slots[VM_LOOP_LIST].force_string(cs);
+        auto pos = std::size_t(slots[VM_LOOP_POS].get_integer());
+        list_parser p{cs, lst.substr(pos)};
+        if (!p.parse()) {
+            return false;
+        }
+        auto &val = ts.idstack[fr.idtop].val_s;
+        if (p.quoted_item().data()) {
+            val.set_string(p.get_item());
+        } else {
+            /* the list ends within an item, which a parser going through
+             * the whole list leaves as the previous item once more
+             */
+            auto prev = slots[VM_LOOP_PREV].get_integer();
+            if (prev < 0) {
+                val.set_string("", cs);
+            } else {
+                list_parser pp{cs, lst.substr(std::size_t(prev))};
+                pp.parse();
+                val.set_string(pp.get_item());
+            }
+        }
+        any_value_p{slots[VM_LOOP_PREV]}.set_integer(integer_type(pos));
+        pos = lst.size() - p.input().size();
+        any_value_p{slots[VM_LOOP_POS]}.set_integer(integer_type(pos));
+    }
+    return true;
+}
+
+/* take the arguments off the stack into the slots of the freshly pushed
+ * loop frame and set up the first iteration; false if there is none
+ */
+static bool vm_loop_enter(
+    thread_state &ts, vm_frame &fr, std::uint32_t kind
+) {
+    auto &cs = *ts.pstate;
+    auto &args = ts.vmstack;
+    std::size_t nargs = 0;
+    ++ts.loop_level;
+    fr.nargs = 0;
+    if (kind & BC_LOOP_NUM) {
+        nargs = 2 + !!(kind & BC_LOOP_ADD) + !!(kind & BC_LOOP_MUL);
+    } else if (kind & BC_LOOP_LIST) {
+        nargs = 2;
+    }
+    fr.vmtop = args.size() - nargs;
+    if (!nargs) {
+        return true;
+    }
+    if (kind & BC_LOOP_NUM) {
+        auto *a = &args[fr.vmtop + 1];
+        integer_type off = 0, num, step = 1;
+        /* plain loop* takes the count before the step */
+        bool nfirst = !(kind & (BC_LOOP_ADD | BC_LOOP_COND));
+        if (kind & BC_LOOP_ADD) {
+            off = any_value_p{*a++}.get_integer();
+        }
+        if ((kind & BC_LOOP_MUL) && !nfirst) {
+            step = any_value_p{*a++}.get_integer();
+        }
+        num = any_value_p{*a++}.get_integer();
+        if ((kind & BC_LOOP_MUL) && nfirst) {
+            step = any_value_p{*a}.get_integer();
+        }
+        if (num <= 0) {
+            return false;
+        }
+        args.resize(fr.vmtop + 1);
+        any_value_p{args.emplace_back()}.set_integer(-1);
+        any_value_p{args.emplace_back()}.set_integer(num);
+        any_value_p{args.emplace_back()}.set_integer(off);
+        any_value_p{args.emplace_back()}.set_integer(step);
+    } else {
+        args.back().force_string(cs);
+        any_value_p{args.emplace_back()}.set_integer(0);
+        any_value_p{args.emplace_back()}.set_integer(-1);
+    }
+    /* like alias_local */
+    auto &id = args[fr.vmtop].get_ident(cs);
+    if (id.type() != ident_type::ALIAS) {
+        throw error_p::make(
+            cs, "ident '%s' is not an alias", id.name().data()
+        );
+    }
+    auto &ast = ts.get_astack(static_cast<alias *>(&id));
+    fr.idtop = ts.idstack.size();
+    ast.push(ts.idstack.emplace_back());
+    ast.flags &= ~IDENT_FLAG_UNKNOWN;
+    fr.nargs = args.size() - fr.vmtop;
+    return vm_loop_next(ts, fr);
+}
+
+/* the loop is over; the frame becomes a plain one, so that it is left
+ * like any other once its code exits
+ */
+static inline void vm_loop_done(thread_state &ts, vm_frame &fr) {
+    vm_leave_frame(ts, fr);
+    any_value_p{fr.val}.set_none();
+    fr.kind = VM_FRAME_CODE;
+}
+
+/* break or continue the innermost loop run by the current vm_exec, if
+ * any, dropping the frames above it; once it returns true, the loop is
+ * to continue by exiting the loop frame
+ */
+static bool vm_loop_ctl(thread_state &ts, bool cont) {
+    auto *lfr = ts.ftop;
+    for (; lfr->kind != VM_FRAME_LOOP; lfr = lfr->prev) {
+        if (lfr->kind == VM_FRAME_BASE) {
+            return false;
+        }
+    }
+    while (ts.ftop != lfr) {
+        auto &fr = *ts.ftop;
+        vm_leave_frame(ts, fr);
+        any_value_p{fr.val}.set_none();
+        vm_pop_frame(ts, fr);
+    }
+    if (cont) {
+        any_value_p{lfr->val}.set_none();
+    } else {
+        vm_loop_done(ts, *lfr);
+    }
+    return true;
+}
+
+/* locals in the condition of a loop end with it, R is kept */
+static inline void vm_loop_cond(thread_state &ts) {
+    while (ts.ftop->kind == VM_FRAME_LOCAL) {
+        auto &fr = *ts.ftop;
+        vm_leave_frame(ts, fr);
+        any_value_p{fr.prev->val}.steal(fr.val);
+        vm_pop_frame(ts, fr);
+    }
+}
+
+#if LIBCUBESCRIPT_VM_JIT
+static bool vm_jit_enter(thread_state &ts, vm_frame &fr, std::uint32_t *code);
+#endif
+
+/* the dispatch loop below is written in terms of these macros, so that
+ * it can be built either as a plain switch or as direct-threaded code
+ * using a table of label addresses (a GCC/Clang extension, enabled at
+ * build time where supported); in the latter case every handler ends
+ * with its own indirect jump, which is a lot friendlier to the branch
+ * predictor than funneling everything through a single one
+ */
+#if LIBCUBESCRIPT_VM_OPCODE_STATS
+#  define VM_COUNT(op) { \
+       std::uint32_t opc = (op) & BC_INST_OP_MASK; \
+       ++ts.op_pairs[ts.op_last][opc]; \
+       ++ts.op_count; \
+       ts.op_last = opc; \
+   }
+#else
+#  define VM_COUNT(op)
+#endif
+
+#if LIBCUBESCRIPT_VM_COMPUTED_GOTO
+#  define VM_SWITCH(op) goto *vm_dispatch[(op) & BC_INST_OP_MASK];
+#  define VM_CASE(op) vm_label_##op
+#  define VM_DEFAULT vm_label_default
+#  define VM_NEXT { \
+       op = *code++; \
+       VM_COUNT(op) \
+       goto *vm_dispatch[op & BC_INST_OP_MASK]; \
+   }
+#  if defined(__GNUC__)
+#    pragma GCC diagnostic push
+#    pragma GCC diagnostic ignored "-Wpedantic"
+#  endif
+#else
+#  define VM_SWITCH(op) switch ((op) & BC_INST_OP_MASK)
+#  define VM_CASE(op) case op
+#  define VM_DEFAULT default
+#  define VM_NEXT continue
+#endif
+
+/* for instructions starting to run other code in a new frame; the code
+ * is run natively if the JIT takes it
+ */
+#if LIBCUBESCRIPT_VM_JIT
+#  define VM_ENTER { \
+       if (vm_jit_enter(ts, *fr, code)) { \
+           goto use_native; \
+       } \
+       VM_NEXT; \
+   }
+#else
+#  define VM_ENTER VM_NEXT
+#endif
+
+/* run the code in the current frame until the base frame of vm_exec is
+ * exited, returning the position past its end, or null on break/continue
+ * when there is no loop to handle them within (see vm_exec); resume is
+ * set when the frame goes on in the middle of its code
+ */
+static std::uint32_t *vm_run(
+    thread_state &ts, std::uint32_t *code, bool resume
+) {
+    auto &cs = *ts.pstate;
+    auto &args = ts.vmstack;
+    /* the current frame and its result slot */
+    vm_frame *fr = ts.ftop;
+    any_value *res = &fr->val;
+#if LIBCUBESCRIPT_VM_COMPUTED_GOTO
+    /* indexed by opcode, keep in sync with the enum in cs_bcode.hh */
+    static void *vm_dispatch[BC_INST_OP_MASK + 1] = {
+        &&VM_CASE(BC_INST_START),
+        &&VM_CASE(BC_INST_OFFSET),
+        &&VM_CASE(BC_INST_NULL),
+        &&VM_CASE(BC_INST_TRUE),
+        &&VM_CASE(BC_INST_FALSE),
+        &&VM_CASE(BC_INST_NOT),
+        &&VM_CASE(BC_INST_POP),
+        &&VM_CASE(BC_INST_ENTER),
+        &&VM_CASE(BC_INST_ENTER_RESULT),
+        &&VM_CASE(BC_INST_EXIT),
+        &&VM_CASE(BC_INST_RESULT),
+        &&VM_CASE(BC_INST_RESULT_ARG),
+        &&VM_CASE(BC_INST_FORCE),
+        &&VM_CASE(BC_INST_DUP),
+        &&VM_CASE(BC_INST_VAL),
+        &&VM_CASE(BC_INST_VAL_INT),
+        &&VM_CASE(BC_INST_LOCAL),
+        &&VM_CASE(BC_INST_DO),
+        &&VM_CASE(BC_INST_DO_ARGS),
+        &&VM_CASE(BC_INST_JUMP),
+        &&VM_CASE(BC_INST_JUMP_B),
+        &&VM_CASE(BC_INST_JUMP_RESULT),
+        &&VM_CASE(BC_INST_BREAK),
+        &&VM_CASE(BC_INST_BLOCK),
+        &&VM_CASE(BC_INST_EMPTY),
+        &&VM_CASE(BC_INST_COMPILE),
+        &&VM_CASE(BC_INST_COND),
+        &&VM_CASE(BC_INST_IDENT),
+        &&VM_CASE(BC_INST_IDENT_U),
+        &&VM_CASE(BC_INST_LOOKUP),
+        &&VM_CASE(BC_INST_LOOKUP_U),
+        &&VM_CASE(BC_INST_CONC),
+        &&VM_CASE(BC_INST_CONC_W),
+        &&VM_CASE(BC_INST_VAR),
+        &&VM_CASE(BC_INST_ALIAS),
+        &&VM_CASE(BC_INST_ALIAS_U),
+        &&VM_CASE(BC_INST_CALL),
+        &&VM_CASE(BC_INST_CALL_U),
+        &&VM_CASE(BC_INST_COM),
+        &&VM_CASE(BC_INST_COM_V),
+        &&VM_CASE(BC_INST_COM_ARG),
+        &&VM_CASE(BC_INST_COM_V_ARG),
+        &&VM_CASE(BC_INST_CALL_ARG),
+        &&VM_CASE(BC_INST_ALIAS_RESULT),
+        &&VM_CASE(BC_INST_ALIAS_VAL),
+        &&VM_CASE(BC_INST_JUMP_B_R),
+        &&VM_CASE(BC_INST_MATH),
+        &&VM_CASE(BC_INST_MATH_ARG),
+        &&VM_CASE(BC_INST_LOOP),
+        &&VM_CASE(BC_INST_LOOP_COND),
+        &&VM_DEFAULT, &&VM_DEFAULT, &&VM_DEFAULT, &&VM_DEFAULT,
+        &&VM_DEFAULT, &&VM_DEFAULT, &&VM_DEFAULT, &&VM_DEFAULT,
+        &&VM_DEFAULT, &&VM_DEFAULT, &&VM_DEFAULT, &&VM_DEFAULT,
+        &&VM_DEFAULT, &&VM_DEFAULT
     };
+#endif
+    std::uint32_t op;
+#if LIBCUBESCRIPT_VM_JIT
+    /* only code being started can be looked up for compilation; resumed
+     * code goes on natively only if it was running natively before
+     */
+    if (fr->jit || (!resume && vm_jit_enter(ts, *fr, code))) {
+        goto use_native;
+    }
+#endif
     for (;;) {
-        std::uint32_t op = *code++;
-        switch (op & BC_INST_OP_MASK) {
-            case BC_INST_START:
-            case BC_INST_OFFSET:
-                continue;
-
-            case BC_INST_NULL:
-                result.set_none();
+        op = *code++;
+        VM_COUNT(op)
+        VM_SWITCH(op) {
+            VM_CASE(BC_INST_START):
+            VM_CASE(BC_INST_OFFSET):
+                VM_NEXT;
+
+            VM_CASE(BC_INST_NULL):
+                any_value_p{*res}.set_none();
                 goto use_result;
 
-            case BC_INST_FALSE:
-                result.set_integer(0);
+            VM_CASE(BC_INST_FALSE):
+                any_value_p{*res}.set_integer(0);
                 goto use_result;
 
-            case BC_INST_TRUE:
-                result.set_integer(1);
+            VM_CASE(BC_INST_TRUE):
+                any_value_p{*res}.set_integer(1);
                 goto use_result;
 
-            case BC_INST_NOT:
-                result.set_integer(!args.back().get_bool());
+            VM_CASE(BC_INST_NOT):
+                any_value_p{*res}.set_integer(
+                    !any_value_p{args.back()}.get_bool()
+                );
                 args.pop_back();
                 goto use_result;
 
-            case BC_INST_POP:
+            VM_CASE(BC_INST_POP):
                 args.pop_back();
-                continue;
-
-            case BC_INST_ENTER:
-                code = vm_exec(ts, code, args.emplace_back());
-                continue;
+                VM_NEXT;
 
-            case BC_INST_ENTER_RESULT:
-                code = vm_exec(ts, code, result);
-                continue;
+            VM_CASE(BC_INST_ENTER):
+            VM_CASE(BC_INST_ENTER_RESULT):
+                fr = &vm_push_frame(ts, VM_FRAME_CODE, op, nullptr);
+                res = &fr->val;
+                VM_NEXT;
 
-            case BC_INST_EXIT:
+            VM_CASE(BC_INST_EXIT):
+                vm_force_val(cs, *res, op);
                 goto use_exit;
 
-            case BC_INST_RESULT:
-                result = std::move(args.back());
+            VM_CASE(BC_INST_RESULT):
+                any_value_p{*res}.steal(args.back());
                 args.pop_back();
                 goto use_result;
 
-            case BC_INST_RESULT_ARG:
-                args.emplace_back(std::move(result));
+            VM_CASE(BC_INST_RESULT_ARG):
+                any_value_p{args.emplace_back()}.steal(*res);
                 goto use_top;
 
-            case BC_INST_FORCE:
+            VM_CASE(BC_INST_FORCE):
                 goto use_top;
 
-            case BC_INST_DUP: {
+            VM_CASE(BC_INST_DUP): {
                 auto &v = args.back();
-                args.emplace_back() = v;
+                any_value_p{args.emplace_back()}.assign(v);
                 goto use_top;
             }
 
-            case BC_INST_VAL:
-                switch (op & BC_INST_RET_MASK) {
-                    case BC_RET_STRING: {
-                        auto len = op >> 8;
-                        char const *str;
-                        std::memcpy(&str, &code, sizeof(str));
-                        std::string_view sv{str, len};
-                        args.emplace_back().set_string(sv, cs);
-                        code += len / sizeof(std::uint32_t) + 1;
-                        continue;
-                    }
-                    case BC_RET_INT: {
-                        integer_type i;
-                        std::memcpy(&i, code, sizeof(i));
-                        args.emplace_back().set_integer(i);
-                        code += bc_store_size<integer_type>;
-                        continue;
-                    }
-                    case BC_RET_FLOAT: {
-                        float_type f;
-                        std::memcpy(&f, code, sizeof(f));
-                        args.emplace_back().set_float(f);
-                        code += bc_store_size<float_type>;
-                        continue;
-                    }
-                    default:
-                        break;
-                }
-                args.emplace_back().set_none();
-                continue;
-
-            case BC_INST_VAL_INT:
-                switch (op & BC_INST_RET_MASK) {
-                    case BC_RET_STRING: {
-                        char s[4] = {
-                            char((op >> 8) & 0xFF),
-                            char((op >> 16) & 0xFF),
-                            char((op >> 24) & 0xFF), '\0'
-                        };
-                        /* gotta cast or r.size() == potentially 3 */
-                        args.emplace_back().set_string(s, cs);
-                        continue;
-                    }
-                    case BC_RET_INT:
-                        args.emplace_back().set_integer(integer_type(op) >> 8);
-                        continue;
-                    case BC_RET_FLOAT:
-                        args.emplace_back().set_float(
-                            float_type(integer_type(op) >> 8)
-                        );
-                        continue;
-                    default:
-                        break;
-                }
-                args.emplace_back().set_none();
-                continue;
-
-            case BC_INST_LOCAL: {
-                std::size_t numlocals = op >> 8;
-                std::size_t offset = args.size() - numlocals;
-                std::size_t idstsz = ts.idstack.size();
-                for (std::size_t i = 0; i < numlocals; ++i) {
-                    push_alias(
-                        ts, args[offset + i].get_ident(cs),
-                        ts.idstack.emplace_back()
-                    );
-                }
-                auto cleanup = [](
-                    auto &css, std::size_t off, std::size_t isz, auto &av
-                ) {
-                    for (std::size_t i = off; i < av.size(); ++i) {
-                        pop_alias(state_p{css}.ts(), av[i].get_ident(css));
-                    }
-                    state_p{css}.ts().idstack.resize(isz);
-                };
-                try {
-                    code = vm_exec(ts, code, result);
-                } catch (...) {
-                    cleanup(cs, offset, idstsz, args);
-                    throw;
-                }
-                cleanup(cs, offset, idstsz, args);
-                return code;
-            }
-
-            case BC_INST_DO_ARGS: {
-                auto v = std::move(args.back());
-                args.pop_back();
-                result = exec_code_with_args(ts, v.get_code());
-                goto use_result;
-            }
-
-            case BC_INST_DO: {
-                auto v = std::move(args.back());
+            VM_CASE(BC_INST_VAL):
+            VM_CASE(BC_INST_VAL_INT):
+                code = vm_get_literal(cs, op, code, args.emplace_back());
+                VM_NEXT;
+
+            VM_CASE(BC_INST_LOCAL):
+                /* the rest of the block runs in a frame of its own, which
+                 * pops the locals and then exits this one as well
+                 */
+                fr = &vm_push_frame(ts, VM_FRAME_LOCAL, op, nullptr);
+                res = &fr->val;
+                vm_push_locals(ts, *fr, op >> 8);
+                VM_NEXT;
+
+            VM_CASE(BC_INST_DO_ARGS):
+            VM_CASE(BC_INST_DO): {
+                auto body = args.back().get_code();
                 args.pop_back();
-                result = v.get_code().call(cs);
-                goto use_result;
+                fr = &vm_push_frame(ts, VM_FRAME_CODE, op, code);
+                fr->code = std::move(body);
+                res = &fr->val;
+                if (
+                    ((op & BC_INST_OP_MASK) == BC_INST_DO_ARGS) &&
+                    !ts.callstack.empty()
+                ) {
+                    vm_args_enter(ts, *fr);
+                }
+                code = bcode_p{fr->code}.get()->raw();
+                VM_ENTER;
             }
 
-            case BC_INST_JUMP: {
+            VM_CASE(BC_INST_JUMP): {
                 std::uint32_t len = op >> 8;
                 code += len;
-                continue;
+                VM_NEXT;
             }
 
-            case BC_INST_JUMP_B: {
+            VM_CASE(BC_INST_JUMP_B): {
                 std::uint32_t len = op >> 8;
                 /* BC_INST_FLAG_TRUE/FALSE */
-                if (args.back().get_bool() == !!(op & BC_INST_RET_MASK)) {
+                if (
+                    any_value_p{args.back()}.get_bool() ==
+                    !!(op & BC_INST_RET_MASK)
+                ) {
                     code += len;
                 }
                 args.pop_back();
-                continue;
+                VM_NEXT;
             }
 
-            case BC_INST_JUMP_RESULT: {
+            VM_CASE(BC_INST_JUMP_B_R): {
                 std::uint32_t len = op >> 8;
-                auto v = std::move(args.back());
-                args.pop_back();
-                if (v.type() == value_type::CODE) {
-                    result = v.get_code().call(cs);
-                } else {
-                    result = std::move(v);
-                }
                 /* BC_INST_FLAG_TRUE/FALSE */
-                if (result.get_bool() == !!(op & BC_INST_RET_MASK)) {
+                if (
+                    any_value_p{*res}.get_bool() == !!(op & BC_INST_RET_MASK)
+                ) {
                     code += len;
                 }
-                continue;
+                any_value_p{*res}.set_none();
+                VM_NEXT;
+            }
+
+            VM_CASE(BC_INST_JUMP_RESULT): {
+                if (args.back().type() == value_type::CODE) {
+                    /* the jump is done once the frame exits */
+                    auto body = args.back().get_code();
+                    args.pop_back();
+                    fr = &vm_push_frame(ts, VM_FRAME_CODE, op, code);
+                    fr->code = std::move(body);
+                    res = &fr->val;
+                    code = bcode_p{fr->code}.get()->raw();
+                    VM_ENTER;
+                }
+                any_value_p{*res}.steal(args.back());
+                args.pop_back();
+                goto use_jump;
             }
 
-            case BC_INST_BREAK:
+            VM_CASE(BC_INST_BREAK):
+                /* loops run by this vm_exec are handled right away */
+                if (vm_loop_ctl(ts, op & BC_INST_RET_MASK)) {
+                    fr = ts.ftop;
+                    res = &fr->val;
+                    goto use_exit;
+                }
                 if (ts.loop_level) {
                     if (op & BC_INST_RET_MASK) {
-                        throw continue_exception{};
+                        ts.loop_ctl = loop_state::CONTINUE;
                     } else {
-                        throw break_exception{};
+                        ts.loop_ctl = loop_state::BREAK;
                     }
+                    /* the guard unwinds the frames */
+                    return nullptr;
                 } else {
                     if (op & BC_INST_RET_MASK) {
                         throw error{cs, "no loop to continue"};
@@ -491,77 +1242,39 @@ std::uint32_t *vm_exec(
                         throw error{cs, "no loop to break"};
                     }
                 }
-                break;
+                VM_NEXT;
 
-            case BC_INST_BLOCK: {
+            VM_CASE(BC_INST_BLOCK): {
                 std::uint32_t len = op >> 8;
                 bcode *b;
                 code += 1;
                 std::memcpy(&b, &code, sizeof(b));
                 args.emplace_back().set_code(bcode_p::make_ref(b));
                 code += len - 1;
-                continue;
+                VM_NEXT;
             }
 
-            case BC_INST_EMPTY:
+            VM_CASE(BC_INST_EMPTY):
                 args.emplace_back().set_code(bcode_p::make_ref(
                     bcode_get_empty(ts.istate->empty, op & BC_INST_RET_MASK)
                 ));
-                break;
+                VM_NEXT;
 
-            case BC_INST_COMPILE: {
-                any_value &arg = args.back();
-                gen_state gs{ts};
-                switch (arg.type()) {
-                    case value_type::INTEGER:
-                        gs.gen_main_integer(arg.get_integer());
-                        break;
-                    case value_type::FLOAT:
-                        gs.gen_main_float(arg.get_float());
-                        break;
-                    case value_type::STRING:
-                        gs.gen_main(arg.get_string(cs));
-                        break;
-                    default:
-                        gs.gen_main_null();
-                        break;
-                }
-                arg.set_code(gs.steal_ref());
-                continue;
-            }
+            VM_CASE(BC_INST_COMPILE):
+                vm_compile_arg(ts, args.back());
+                VM_NEXT;
 
-            case BC_INST_COND: {
-                any_value &arg = args.back();
-                switch (arg.type()) {
-                    case value_type::STRING: {
-                        std::string_view s = arg.get_string(cs);
-                        if (!s.empty()) {
-                            gen_state gs{ts};
-                            gs.gen_main(s);
-                            arg.set_code(gs.steal_ref());
-                        } else {
-                            arg.force_none();
-                        }
-                        break;
-                    }
-                    default:
-                        break;
-                }
-                continue;
-            }
+            VM_CASE(BC_INST_COND):
+                vm_cond_arg(ts, args.back());
+                VM_NEXT;
 
-            case BC_INST_IDENT: {
-                alias *a = static_cast<alias *>(
-                    ts.istate->lookup_ident(op >> 8)
+            VM_CASE(BC_INST_IDENT):
+                vm_set_ident(
+                    ts, args.emplace_back(), ts.istate->lookup_ident(op >> 8)
                 );
-                if (a->is_arg() && !ident_is_used_arg(a, ts)) {
-                    ts.get_astack(a).push(ts.idstack.emplace_back());
-                    ts.callstack.back().usedargs[a->index()] = true;
-                }
-                args.emplace_back().set_ident(*a);
-                continue;
-            }
-            case BC_INST_IDENT_U: {
+                VM_NEXT;
+
+            VM_CASE(BC_INST_IDENT_U): {
                 any_value &arg = args.back();
                 ident *id = ts.istate->id_dummy;
                 if (arg.type() == value_type::STRING) {
@@ -569,90 +1282,70 @@ std::uint32_t *vm_exec(
                         cs, arg.get_string(cs), IDENT_FLAG_UNKNOWN
                     );
                 }
-                alias *a = static_cast<alias *>(id);
-                if (a->is_arg() && !ident_is_used_arg(id, ts)) {
-                    ts.get_astack(a).push(ts.idstack.emplace_back());
-                    ts.callstack.back().usedargs[id->index()] = true;
-                }
-                arg.set_ident(*id);
-                continue;
+                vm_set_ident(ts, arg, id);
+                VM_NEXT;
             }
 
-            case BC_INST_LOOKUP_U:
-                args.back() = cs.lookup_value(args.back().get_string(cs));
+            VM_CASE(BC_INST_LOOKUP_U): {
+                auto idn = args.back().get_string(cs);
+                args.back() = lookup_ident_value(
+                    ts, vm_get_ident(ts, *code++, idn), idn
+                );
                 goto use_top;
+            }
 
-            case BC_INST_LOOKUP: {
-                ident *id = ts.istate->lookup_ident(op >> 8);
-                if (static_cast<alias *>(id)->is_arg()) {
-                    auto &v = args.emplace_back();
-                    if (ident_is_used_arg(id, ts)) {
-                        v = ts.get_astack(static_cast<alias *>(id)).node->val_s;
-                    }
-                    goto use_top;
-                }
-                auto &ast = ts.get_astack(static_cast<alias *>(id));
-                if (ast.flags & IDENT_FLAG_UNKNOWN) {
-                    throw error_p::make(
-                        *ts.pstate, "unknown alias lookup: %s",
-                        id->name().data()
-                    );
-                }
-                args.emplace_back() = ast.node->val_s;
+            VM_CASE(BC_INST_LOOKUP):
+                vm_lookup_alias(ts, ts.istate->lookup_ident(op >> 8));
                 goto use_top;
-            }
 
-            case BC_INST_CONC:
-            case BC_INST_CONC_W: {
-                std::size_t numconc = op >> 8;
-                auto buf = concat_values(
-                    cs, span_type<any_value>{
-                        &args[args.size() - numconc], numconc
-                    }, ((op & BC_INST_OP_MASK) == BC_INST_CONC) ? " " : ""
-                );
-                args.resize(args.size() - numconc);
-                args.emplace_back().set_string(buf);
+            VM_CASE(BC_INST_CONC):
+            VM_CASE(BC_INST_CONC_W):
+                vm_concat(ts, op);
                 goto use_top;
-            }
 
-            case BC_INST_VAR:
+            VM_CASE(BC_INST_VAR):
                 args.emplace_back() = static_cast<builtin_var *>(
                     ts.istate->lookup_ident(op >> 8)
                 )->value();
                 goto use_top;
 
-            case BC_INST_ALIAS: {
-                auto *a = static_cast<alias *>(
-                    ts.istate->lookup_ident(op >> 8)
-                );
-                auto &ast = ts.get_astack(a);
-                if (a->is_arg()) {
-                    ast.set_arg(a, ts, args.back());
-                } else {
-                    ast.set_alias(a, ts, args.back());
-                }
+            VM_CASE(BC_INST_ALIAS):
+                vm_set_alias(ts, op >> 8, args.back());
                 args.pop_back();
-                continue;
+                VM_NEXT;
+
+            VM_CASE(BC_INST_ALIAS_RESULT):
+                vm_set_alias(ts, op >> 8, *res);
+                VM_NEXT;
+
+            VM_CASE(BC_INST_ALIAS_VAL): {
+                any_value v;
+                std::uint32_t lop = *code++;
+                code = vm_get_literal(cs, lop, code, v);
+                vm_set_alias(ts, op >> 8, v);
+                VM_NEXT;
             }
 
-            case BC_INST_ALIAS_U: {
+            VM_CASE(BC_INST_ALIAS_U): {
                 auto v = std::move(args.back());
                 args.pop_back();
                 cs.assign_value(args.back().get_string(cs), std::move(v));
                 args.pop_back();
-                continue;
+                VM_NEXT;
             }
 
-            case BC_INST_CALL: {
-                result.force_none();
+            VM_CASE(BC_INST_CALL):
+            VM_CASE(BC_INST_CALL_ARG): {
+                any_value_p{*res}.set_none();
                 ident *id = ts.istate->lookup_ident(op >> 8);
-                std::size_t callargs = *code++;
+                std::uint32_t cnt = *code++;
+                std::size_t callargs = cnt & ~BC_CALL_TAIL;
                 std::size_t offset = args.size() - callargs;
                 auto *imp = static_cast<alias_impl *>(id);
                 if (imp->is_arg()) {
                     if (!ident_is_used_arg(id, ts)) {
                         args.resize(offset);
-                        goto use_result;
+                        goto use_call;
                     }
                 }
                 auto &ast = ts.get_astack(imp);
@@ -661,94 +1354,100 @@ std::uint32_t *vm_exec(
                         cs, "unknown command: %s", id->name().data()
                     );
                 }
-                result = exec_alias(ts, imp, &args[offset], callargs, ast);
-                args.resize(offset);
-                goto use_result;
+                if ((cnt & BC_CALL_TAIL) && !imp->is_arg()) {
+                    auto *tfr = vm_tail_call(ts, imp, offset, callargs, ast);
+                    if (tfr) {
+                        fr = tfr;
+                        res = &fr->val;
+                        code = bcode_p{fr->code}.get()->raw();
+                        VM_ENTER;
+                    }
+                }
+                fr = &vm_push_frame(ts, VM_FRAME_CODE, op, code);
+                fr->vmtop = offset;
+                res = &fr->val;
+                vm_alias_enter(ts, *fr, imp, &args[offset], callargs, ast);
+                code = bcode_p{fr->code}.get()->raw();
+                VM_ENTER;
             }
 
-            case BC_INST_CALL_U: {
+            VM_CASE(BC_INST_CALL_U): {
                 std::size_t callargs = op >> 8;
                 std::size_t offset = args.size() - callargs;
+                std::uint32_t &cache = *code++;
                 any_value &idarg = args[offset - 1];
                 if (idarg.type() != value_type::STRING) {
 litval:
-                    result = std::move(idarg);
+                    any_value_p{*res}.steal(idarg);
                     args.resize(offset - 1);
                     goto use_result;
                 }
-                auto idn = idarg.get_string(cs);
-                auto id = cs.get_ident(idn);
+                /* the handler may leave through a computed goto, which
+                 * would skip the destructor of a string_ref; idarg holds
+                 * the name for as long as the view is used
+                 */
+                std::string_view idn;
+                ident *id;
+                {
+                    auto idr = idarg.get_string(cs);
+                    id = vm_get_ident(ts, cache, idr);
+                    idn = idr.view();
+                }
                 if (!id) {
 noid:
                     if (!is_valid_name(idn)) {
                         goto litval;
                     }
-                    std::string_view ids{idn};
                     throw error_p::make(
-                        cs, "unknown command: %s", ids.data()
+                        cs, "unknown command: %s", idn.data()
                     );
                 }
-                result.force_none();
-                switch (ident_p{id->get()}.impl().p_type) {
+                any_value_p{*res}.set_none();
+                switch (ident_p{*id}.impl().p_type) {
                     default:
-                        if (!ident_is_callable(&id->get())) {
+                        if (!ident_is_callable(id)) {
                             args.resize(offset - 1);
                             goto use_result;
                         }
                     /* fallthrough */
                     case ID_COMMAND: {
-                        auto *cimp = static_cast<command_impl *>(&id->get());
+                        auto *cimp = static_cast<command_impl *>(id);
                         args.resize(offset + std::max(
-                            std::size_t(cimp->arg_count()), callargs
+                            cimp->p_plan.nfixed, callargs
                         ));
                         exec_command(
-                            ts, cimp, cimp, &args[offset], result, callargs
+                            ts, cimp, cimp, &args[offset], *res, callargs
                         );
                         args.resize(offset - 1);
                         goto use_result;
                     }
                     case ID_LOCAL: {
-                        std::size_t idstsz = ts.idstack.size();
-                        for (std::size_t j = 0; j < callargs; ++j) {
-                            push_alias(
-                                ts, args[offset + j].force_ident(cs),
-                                ts.idstack.emplace_back()
-                            );
-                        }
-                        try {
-                            code = vm_exec(ts, code, result);
-                        } catch (...) {
-                            for (std::size_t j = 0; j < callargs; ++j) {
-                                pop_alias(ts, args[offset + j].get_ident(cs));
-                            }
-                            ts.idstack.resize(idstsz);
-                            throw;
-                        }
+                        /* like BC_INST_LOCAL */
                         for (std::size_t j = 0; j < callargs; ++j) {
-                            pop_alias(ts, args[offset + j].get_ident(cs));
+                            args[offset + j].force_ident(cs);
                         }
-                        ts.idstack.resize(idstsz);
-                        return code;
+                        fr = &vm_push_frame(ts, VM_FRAME_LOCAL, op, nullptr);
+                        res = &fr->val;
+                        vm_push_locals(ts, *fr, callargs);
+                        VM_NEXT;
                     }
                     case ID_VAR: {
-                        auto *hid = static_cast<var_impl &>(
-                            id->get()
-                        ).get_setter(ts);
+                        auto *hid = static_cast<var_impl *>(id)->get_setter(ts);
                         auto *cimp = static_cast<command_impl *>(hid);
                         /* the $ argument */
                         args.insert(offset, any_value{});
                         args.resize(offset + std::max(
-                            std::size_t(cimp->arg_count()), callargs
+                            cimp->p_plan.nfixed, callargs + 1
                         ));
                         exec_command(
-                            ts, cimp, &id->get(), &args[offset],
-                            result, callargs
+                            ts, cimp, id, &args[offset],
+                            *res, callargs + 1
                         );
                         args.resize(offset - 1);
                         goto use_result;
                     }
                     case ID_ALIAS: {
-                        alias *a = static_cast<alias *>(&id->get());
+                        alias *a = static_cast<alias *>(id);
                         if (a->is_arg() && !ident_is_used_arg(a, ts)) {
                             args.resize(offset - 1);
                             goto use_result;
@@ -757,54 +1456,824 @@ noid:
                         if (ast.node->val_s.type() == value_type::NONE) {
                             goto noid;
                         }
-                        result = exec_alias(
-                            ts, a, &args[offset], callargs, ast
+                        fr = &vm_push_frame(ts, VM_FRAME_CODE, op, code);
+                        fr->vmtop = offset - 1;
+                        res = &fr->val;
+                        vm_alias_enter(
+                            ts, *fr, a, &args[offset], callargs, ast
                         );
-                        args.resize(offset - 1);
-                        goto use_result;
+                        code = bcode_p{fr->code}.get()->raw();
+                        VM_ENTER;
                     }
                 }
             }
 
-            case BC_INST_COM: {
+            VM_CASE(BC_INST_COM):
+            VM_CASE(BC_INST_COM_ARG): {
                 command_impl *id = static_cast<command_impl *>(
                     ts.istate->lookup_ident(op >> 8)
                 );
-                std::size_t offset = args.size() - id->arg_count();
-                result.force_none();
+                std::size_t offset = args.size() - id->p_numargs;
+                any_value_p{*res}.set_none();
                 id->call_id(ts, span_type<any_value>{
-                    &args[offset], std::size_t(id->arg_count())
-                }, result);
+                    &args[offset], std::size_t(id->p_numargs)
+                }, *res);
                 args.resize(offset);
-                goto use_result;
+                goto use_call;
             }
 
-            case BC_INST_COM_V: {
+            VM_CASE(BC_INST_COM_V):
+            VM_CASE(BC_INST_COM_V_ARG): {
                 command_impl *id = static_cast<command_impl *>(
                     ts.istate->lookup_ident(op >> 8)
                 );
                 std::size_t callargs = *code++;
                 std::size_t offset = args.size() - callargs;
-                result.force_none();
+                any_value_p{*res}.set_none();
                 id->call_id(
-                    ts, span_type<any_value>{&args[offset], callargs}, result
+                    ts, span_type<any_value>{&args[offset], callargs}, *res
                 );
                 args.resize(offset);
+                goto use_call;
+            }
+
+            VM_CASE(BC_INST_MATH): {
+                std::size_t offset = args.size() - 2;
+                vm_math(*res, args[offset], args[offset + 1], op >> 8);
+                args.resize(offset);
                 goto use_result;
             }
+
+            VM_CASE(BC_INST_MATH_ARG): {
+                std::size_t offset = args.size() - 2;
+                vm_math(args[offset], args[offset], args[offset + 1], op >> 8);
+                args.pop_back();
+                goto use_top;
+            }
+
+            VM_CASE(BC_INST_LOOP):
+                fr = &vm_push_frame(ts, VM_FRAME_LOOP, op, code + (op >> 8));
+                res = &fr->val;
+#if LIBCUBESCRIPT_VM_JIT
+                fr->jit = fr->prev->jit;
+#endif
+                if (!vm_loop_enter(ts, *fr, *code)) {
+                    vm_loop_done(ts, *fr);
+                    goto use_exit;
+                }
+                code += 1;
+#if LIBCUBESCRIPT_VM_JIT
+                if (fr->jit) {
+                    goto use_native;
+                }
+#endif
+                VM_NEXT;
+
+            VM_CASE(BC_INST_LOOP_COND):
+                vm_loop_cond(ts);
+                fr = ts.ftop;
+                res = &fr->val;
+                if (!any_value_p{*res}.get_bool()) {
+                    vm_loop_done(ts, *fr);
+                    goto use_exit;
+                }
+                any_value_p{*res}.set_none();
+                code += 2;
+                VM_NEXT;
+
+            VM_DEFAULT:
+                VM_NEXT;
+        }
+        VM_NEXT;
+use_call:
+        /* calls fused with BC_INST_RESULT_ARG push the result right away */
+        if (
+            ((op & BC_INST_OP_MASK) >= BC_INST_COM_ARG) &&
+            ((op & BC_INST_OP_MASK) <= BC_INST_CALL_ARG)
+        ) {
+            any_value_p{args.emplace_back()}.steal(*res);
+            goto use_top;
         }
-        continue;
 use_result:
-        force_val(cs, result, op);
-        continue;
+        vm_force_val(cs, *res, op);
+        VM_NEXT;
 use_top:
-        force_val(cs, args.back(), op);
-        continue;
+        vm_force_val(cs, args.back(), op);
+        VM_NEXT;
+use_jump:
+        /* BC_INST_FLAG_TRUE/FALSE */
+        if (any_value_p{*res}.get_bool() == !!(op & BC_INST_RET_MASK)) {
+            code += op >> 8;
+        }
+        VM_NEXT;
 use_exit:
-        force_val(cs, result, op);
-        break;
+        /* leave the current frame; R has already been forced */
+        if (fr->kind == VM_FRAME_BASE) {
+            break;
+        }
+        if ((fr->kind == VM_FRAME_LOOP) && vm_loop_next(ts, *fr)) {
+            code = vm_loop_code(*fr);
+#if LIBCUBESCRIPT_VM_JIT
+            if (fr->jit) {
+                goto use_native;
+            }
+#endif
+            VM_NEXT;
+        }
+        {
+            int kind = fr->kind;
+            op = fr->op;
+            if (fr->retcode) {
+                code = fr->retcode;
+            }
+            vm_leave_frame(ts, *fr);
+            auto *pfr = fr->prev;
+            if ((op & BC_INST_OP_MASK) == BC_INST_ENTER) {
+                any_value_p{args.emplace_back()}.steal(fr->val);
+            } else {
+                any_value_p{pfr->val}.steal(fr->val);
+            }
+            vm_pop_frame(ts, *fr);
+            fr = pfr;
+            res = &fr->val;
+            /* now finish the instruction that has pushed the frame */
+            if (kind == VM_FRAME_LOCAL) {
+                goto use_exit;
+            }
+#if LIBCUBESCRIPT_VM_JIT
+            if (fr->jit) {
+                /* same as below, but the rest runs natively */
+                switch (op & BC_INST_OP_MASK) {
+                    case BC_INST_DO:
+                    case BC_INST_DO_ARGS:
+                    case BC_INST_CALL:
+                    case BC_INST_CALL_U:
+                    case BC_INST_LOOP:
+                        vm_force_val(cs, *res, op);
+                        break;
+                    case BC_INST_CALL_ARG:
+                        any_value_p{args.emplace_back()}.steal(*res);
+                        vm_force_val(cs, args.back(), op);
+                        break;
+                    case BC_INST_JUMP_RESULT:
+                        if (
+                            any_value_p{*res}.get_bool() ==
+                            !!(op & BC_INST_RET_MASK)
+                        ) {
+                            code += op >> 8;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                goto use_native;
+            }
+#endif
+            switch (op & BC_INST_OP_MASK) {
+                case BC_INST_DO:
+                case BC_INST_DO_ARGS:
+                case BC_INST_LOOP:
+                    goto use_result;
+                case BC_INST_JUMP_RESULT:
+                    goto use_jump;
+                case BC_INST_CALL:
+                case BC_INST_CALL_ARG:
+                case BC_INST_CALL_U:
+                    goto use_call;
+                default:
+                    break;
+            }
+        }
+        VM_NEXT;
+#if LIBCUBESCRIPT_VM_JIT
+use_native:
+        /* run the current frame natively until it needs the interpreter */
+        switch (jit_run(ts, fr->jit, code)) {
+            case JIT_EXIT:
+                fr = ts.ftop;
+                res = &fr->val;
+                code = ts.jit_code;
+                goto use_exit;
+            case JIT_PUSH:
+                fr = ts.ftop;
+                res = &fr->val;
+                code = ts.jit_code;
+                VM_ENTER;
+            default:
+                break;
+        }
+        fr = ts.ftop;
+        res = &fr->val;
+        code = ts.jit_code;
+        VM_NEXT;
+#endif
     }
     return code;
 }
 
+/* break and continue coming from code outside the VM (such as commands)
+ * as exceptions are handled here if there is a loop for them, which then
+ * continues by running the exit of its body (right before its retcode)
+ */
+std::uint32_t *vm_exec(
+    thread_state &ts, std::uint32_t *code, any_value &result
+) {
+    any_value_p{result}.set_none();
+    vm_guard scope{ts}; /* keep track of native nesting + unwind frames */
+    vm_push_frame(ts, VM_FRAME_BASE, BC_INST_START, nullptr);
+    for (bool resume = false;; resume = true) {
+        try {
+            code = vm_run(ts, code, resume);
+            break;
+        } catch (break_exception) {
+            if (!vm_loop_ctl(ts, false)) {
+                throw;
+            }
+        } catch (continue_exception) {
+            if (!vm_loop_ctl(ts, true)) {
+                throw;
+            }
+        }
+        code = ts.ftop->retcode - 1;
+    }
+    if (!code) {
+        /* the guard unwinds the frames */
+        return nullptr;
+    }
+    auto &fr = *ts.ftop;
+    vm_leave_frame(ts, fr);
+    any_value_p{result}.steal(fr.val);
+    vm_pop_frame(ts, fr);
+    return code;
+}
+
+#if LIBCUBESCRIPT_VM_COMPUTED_GOTO && defined(__GNUC__)
+#  pragma GCC diagnostic pop
+#endif
+
+#undef VM_COUNT
+#undef VM_SWITCH
+#undef VM_CASE
+#undef VM_DEFAULT
+#undef VM_NEXT
+#undef VM_ENTER
+
+#if LIBCUBESCRIPT_VM_JIT
+/* helpers for the native code, one per opcode; they do what vm_exec does,
+ * with R being the result of the current frame
+ */
+
+static int jit_op_interp(thread_state &ts, std::uint32_t *ip) {
+    ts.jit_code = ip;
+    return JIT_INTERP;
+}
+
+static int jit_op_const(thread_state &ts, std::uint32_t *ip) {
+    auto &res = ts.ftop->val;
+    switch (*ip & BC_INST_OP_MASK) {
+        case BC_INST_FALSE:
+            any_value_p{res}.set_integer(0);
+            break;
+        case BC_INST_TRUE:
+            any_value_p{res}.set_integer(1);
+            break;
+        default:
+            any_value_p{res}.set_none();
+            break;
+    }
+    vm_force_val(*ts.pstate, res, *ip);
+    return JIT_NEXT;
+}
+
+static int jit_op_not(thread_state &ts, std::uint32_t *ip) {
+    auto &res = ts.ftop->val;
+    any_value_p{res}.set_integer(!any_value_p{ts.vmstack.back()}.get_bool());
+    ts.vmstack.pop_back();
+    vm_force_val(*ts.pstate, res, *ip);
+    return JIT_NEXT;
+}
+
+static int jit_op_pop(thread_state &ts, std::uint32_t *) {
+    ts.vmstack.pop_back();
+    return JIT_NEXT;
+}
+
+static int jit_op_enter(thread_state &ts, std::uint32_t *ip) {
+    auto &fr = vm_push_frame(ts, VM_FRAME_CODE, *ip, nullptr);
+    fr.jit = fr.prev->jit;
+    return JIT_NEXT;
+}
+
+static int jit_op_exit(thread_state &ts, std::uint32_t *ip) {
+    vm_force_val(*ts.pstate, ts.ftop->val, *ip);
+    ts.jit_code = ip + 1;
+    return JIT_EXIT;
+}
+
+static int jit_op_result(thread_state &ts, std::uint32_t *ip) {
+    auto &res = ts.ftop->val;
+    any_value_p{res}.steal(ts.vmstack.back());
+    ts.vmstack.pop_back();
+    vm_force_val(*ts.pstate, res, *ip);
+    return JIT_NEXT;
+}
+
+static int jit_op_result_arg(thread_state &ts, std::uint32_t *ip) {
+    auto &v = ts.vmstack.emplace_back();
+    any_value_p{v}.steal(ts.ftop->val);
+    vm_force_val(*ts.pstate, v, *ip);
+    return JIT_NEXT;
+}
+
+static int jit_op_force(thread_state &ts, std::uint32_t *ip) {
+    vm_force_val(*ts.pstate, ts.vmstack.back(), *ip);
+    return JIT_NEXT;
+}
+
+static int jit_op_dup(thread_state &ts, std::uint32_t *ip) {
+    auto &args = ts.vmstack;
+    auto &v = args.back();
+    any_value_p{args.emplace_back()}.assign(v);
+    vm_force_val(*ts.pstate, args.back(), *ip);
+    return JIT_NEXT;
+}
+
+static int jit_op_val(thread_state &ts, std::uint32_t *ip) {
+    vm_get_literal(*ts.pstate, *ip, ip + 1, ts.vmstack.emplace_back());
+    return JIT_NEXT;
+}
+
+static int jit_op_local(thread_state &ts, std::uint32_t *ip) {
+    auto &fr = vm_push_frame(ts, VM_FRAME_LOCAL, *ip, nullptr);
+    fr.jit = fr.prev->jit;
+    vm_push_locals(ts, fr, *ip >> 8);
+    return JIT_NEXT;
+}
+
+static int jit_op_do(thread_state &ts, std::uint32_t *ip) {
+    auto &args = ts.vmstack;
+    auto body = args.back().get_code();
+    args.pop_back();
+    auto &fr = vm_push_frame(ts, VM_FRAME_CODE, *ip, ip + 1);
+    fr.code = std::move(body);
+    if (
+        ((*ip & BC_INST_OP_MASK) == BC_INST_DO_ARGS) &&
+        !ts.callstack.empty()
+    ) {
+        vm_args_enter(ts, fr);
+    }
+    ts.jit_code = bcode_p{fr.code}.get()->raw();
+    return JIT_PUSH;
+}
+
+static int jit_op_jump_b(thread_state &ts, std::uint32_t *ip) {
+    bool b = any_value_p{ts.vmstack.back()}.get_bool();
+    ts.vmstack.pop_back();
+    return (b == !!(*ip & BC_INST_RET_MASK)) ? JIT_JUMP : JIT_NEXT;
+}
+
+static int jit_op_jump_b_r(thread_state &ts, std::uint32_t *ip) {
+    auto &res = ts.ftop->val;
+    bool b = any_value_p{res}.get_bool();
+    any_value_p{res}.set_none();
+    return (b == !!(*ip & BC_INST_RET_MASK)) ? JIT_JUMP : JIT_NEXT;
+}
+
+static int jit_op_jump_result(thread_state &ts, std::uint32_t *ip) {
+    auto &args = ts.vmstack;
+    if (args.back().type() == value_type::CODE) {
+        /* the jump is done by vm_exec once the frame exits */
+        auto body = args.back().get_code();
+        args.pop_back();
+        auto &fr = vm_push_frame(ts, VM_FRAME_CODE, *ip, ip + 1);
+        fr.code = std::move(body);
+        ts.jit_code = bcode_p{fr.code}.get()->raw();
+        return JIT_PUSH;
+    }
+    auto &res = ts.ftop->val;
+    any_value_p{res}.steal(args.back());
+    args.pop_back();
+    bool b = any_value_p{res}.get_bool();
+    return (b == !!(*ip & BC_INST_RET_MASK)) ? JIT_JUMP : JIT_NEXT;
+}
+
+static int jit_op_block(thread_state &ts, std::uint32_t *ip) {
+    /* past the offset */
+    bcode *b;
+    ip += 2;
+    std::memcpy(&b, &ip, sizeof(b));
+    ts.vmstack.emplace_back().set_code(bcode_p::make_ref(b));
+    return JIT_NEXT;
+}
+
+static int jit_op_empty(thread_state &ts, std::uint32_t *ip) {
+    ts.vmstack.emplace_back().set_code(bcode_p::make_ref(
+        bcode_get_empty(ts.istate->empty, *ip & BC_INST_RET_MASK)
+    ));
+    return JIT_NEXT;
+}
+
+static int jit_op_compile(thread_state &ts, std::uint32_t *) {
+    vm_compile_arg(ts, ts.vmstack.back());
+    return JIT_NEXT;
+}
+
+static int jit_op_cond(thread_state &ts, std::uint32_t *) {
+    vm_cond_arg(ts, ts.vmstack.back());
+    return JIT_NEXT;
+}
+
+static int jit_op_ident(thread_state &ts, std::uint32_t *ip) {
+    vm_set_ident(
+        ts, ts.vmstack.emplace_back(), ts.istate->lookup_ident(*ip >> 8)
+    );
+    return JIT_NEXT;
+}
+
+static int jit_op_ident_u(thread_state &ts, std::uint32_t *) {
+    any_value &arg = ts.vmstack.back();
+    ident *id = ts.istate->id_dummy;
+    if (arg.type() == value_type::STRING) {
+        id = &ts.istate->new_ident(
+            *ts.pstate, arg.get_string(*ts.pstate), IDENT_FLAG_UNKNOWN
+        );
+    }
+    vm_set_ident(ts, arg, id);
+    return JIT_NEXT;
+}
+
+static int jit_op_lookup_u(thread_state &ts, std::uint32_t *ip) {
+    auto &args = ts.vmstack;
+    auto idn = args.back().get_string(*ts.pstate);
+    args.back() = lookup_ident_value(ts, vm_get_ident(ts, ip[1], idn), idn);
+    vm_force_val(*ts.pstate, args.back(), *ip);
+    return JIT_NEXT;
+}
+
+static int jit_op_lookup(thread_state &ts, std::uint32_t *ip) {
+    vm_lookup_alias(ts, ts.istate->lookup_ident(*ip >> 8));
+    vm_force_val(*ts.pstate, ts.vmstack.back(), *ip);
+    return JIT_NEXT;
+}
+
+static int jit_op_conc(thread_state &ts, std::uint32_t *ip) {
+    vm_concat(ts, *ip);
+    vm_force_val(*ts.pstate, ts.vmstack.back(), *ip);
+    return JIT_NEXT;
+}
+
+static int jit_op_var(thread_state &ts, std::uint32_t *ip) {
+    auto &v = ts.vmstack.emplace_back();
+    v = static_cast<builtin_var *>(
+        ts.istate->lookup_ident(*ip >> 8)
+    )->value();
+    vm_force_val(*ts.pstate, v, *ip);
+    return JIT_NEXT;
+}
+
+static int jit_op_alias(thread_state &ts, std::uint32_t *ip) {
+    vm_set_alias(ts, *ip >> 8, ts.vmstack.back());
+    ts.vmstack.pop_back();
+    return JIT_NEXT;
+}
+
+static int jit_op_alias_result(thread_state &ts, std::uint32_t *ip) {
+    vm_set_alias(ts, *ip >> 8, ts.ftop->val);
+    return JIT_NEXT;
+}
+
+static int jit_op_alias_val(thread_state &ts, std::uint32_t *ip) {
+    any_value v;
+    vm_get_literal(*ts.pstate, ip[1], ip + 2, v);
+    vm_set_alias(ts, *ip >> 8, v);
+    return JIT_NEXT;
+}
+
+static int jit_op_alias_u(thread_state &ts, std::uint32_t *) {
+    auto &args = ts.vmstack;
+    auto v = std::move(args.back());
+    args.pop_back();
+    ts.pstate->assign_value(args.back().get_string(*ts.pstate), std::move(v));
+    args.pop_back();
+    return JIT_NEXT;
+}
+
+/* what use_call does in vm_exec */
+static inline int jit_call_result(thread_state &ts, std::uint32_t op) {
+    auto &res = ts.ftop->val;
+    if (
+        ((op & BC_INST_OP_MASK) >= BC_INST_COM_ARG) &&
+        ((op & BC_INST_OP_MASK) <= BC_INST_CALL_ARG)
+    ) {
+        auto &v = ts.vmstack.emplace_back();
+        any_value_p{v}.steal(res);
+        vm_force_val(*ts.pstate, v, op);
+    } else {
+        vm_force_val(*ts.pstate, res, op);
+    }
+    return JIT_NEXT;
+}
+
+static int jit_op_call(thread_state &ts, std::uint32_t *ip) {
+    auto &args = ts.vmstack;
+    std::uint32_t op = *ip;
+    any_value_p{ts.ftop->val}.set_none();
+    ident *id = ts.istate->lookup_ident(op >> 8);
+    std::size_t callargs = ip[1] & ~BC_CALL_TAIL;
+    std::size_t offset = args.size() - callargs;
+    auto *imp = static_cast<alias_impl *>(id);
+    if (imp->is_arg() && !ident_is_used_arg(id, ts)) {
+        args.resize(offset);
+        return jit_call_result(ts, op);
+    }
+    auto &ast = ts.get_astack(imp);
+    if (ast.flags & IDENT_FLAG_UNKNOWN) {
+        throw error_p::make(
+            *ts.pstate, "unknown command: %s", id->name().data()
+        );
+    }
+    if ((ip[1] & BC_CALL_TAIL) && !imp->is_arg()) {
+        auto *tfr = vm_tail_call(ts, imp, offset, callargs, ast);
+        if (tfr) {
+            ts.jit_code = bcode_p{tfr->code}.get()->raw();
+            return JIT_PUSH;
+        }
+    }
+    auto &fr = vm_push_frame(ts, VM_FRAME_CODE, op, ip + 2);
+    fr.vmtop = offset;
+    vm_alias_enter(ts, fr, imp, &args[offset], callargs, ast);
+    ts.jit_code = bcode_p{fr.code}.get()->raw();
+    return JIT_PUSH;
+}
+
+static int jit_op_com(thread_state &ts, std::uint32_t *ip) {
+    auto &args = ts.vmstack;
+    command_impl *id = static_cast<command_impl *>(
+        ts.istate->lookup_ident(*ip >> 8)
+    );
+    std::size_t offset = args.size() - id->p_numargs;
+    any_value_p{ts.ftop->val}.set_none();
+    id->call_id(ts, span_type<any_value>{
+        &args[offset], std::size_t(id->p_numargs)
+    }, ts.ftop->val);
+    args.resize(offset);
+    return jit_call_result(ts, *ip);
+}
+
+static int jit_op_com_v(thread_state &ts, std::uint32_t *ip) {
+    auto &args = ts.vmstack;
+    command_impl *id = static_cast<command_impl *>(
+        ts.istate->lookup_ident(*ip >> 8)
+    );
+    std::size_t callargs = ip[1];
+    std::size_t offset = args.size() - callargs;
+    any_value_p{ts.ftop->val}.set_none();
+    id->call_id(
+        ts, span_type<any_value>{&args[offset], callargs}, ts.ftop->val
+    );
+    args.resize(offset);
+    return jit_call_result(ts, *ip);
+}
+
+static int jit_op_math(thread_state &ts, std::uint32_t *ip) {
+    auto &args = ts.vmstack;
+    std::uint32_t op = *ip;
+    std::size_t offset = args.size() - 2;
+    if ((op & BC_INST_OP_MASK) == BC_INST_MATH_ARG) {
+        vm_math(args[offset], args[offset], args[offset + 1], op >> 8);
+        args.pop_back();
+        vm_force_val(*ts.pstate, args.back(), op);
+    } else {
+        auto &res = ts.ftop->val;
+        vm_math(res, args[offset], args[offset + 1], op >> 8);
+        args.resize(offset);
+        vm_force_val(*ts.pstate, res, op);
+    }
+    return JIT_NEXT;
+}
+
+/* only goes on with the body natively, the rest is left to vm_exec */
+static int jit_op_loop_cond(thread_state &ts, std::uint32_t *ip) {
+    auto &fr = *ts.ftop;
+    if ((fr.kind != VM_FRAME_LOOP) || !any_value_p{fr.val}.get_bool()) {
+        return jit_op_interp(ts, ip);
+    }
+    any_value_p{fr.val}.set_none();
+    return JIT_NEXT;
+}
+
+/* exceptions must not be thrown through native code, so they are kept
+ * in the thread state and rethrown by jit_run
+ */
+template<int (*F)(thread_state &, std::uint32_t *)>
+static int jit_op(thread_state &ts, std::uint32_t *ip) noexcept {
+    try {
+        return F(ts, ip);
+    } catch (...) {
+        ts.jit_error = std::current_exception();
+        return JIT_ERROR;
+    }
+}
+
+/* indexed by opcode, keep in sync with the enum in cs_bcode.hh; starts,
+ * offsets and plain jumps are compiled without helpers, and dynamic
+ * calls (BC_INST_CALL_U), break/continue and loop setup are left to
+ * the interpreter
+ */
+static jit_helper const vm_jit_ops[BC_INST_OP_MASK + 1] = {
+    nullptr,                      /* BC_INST_START */
+    nullptr,                      /* BC_INST_OFFSET */
+    &jit_op<jit_op_const>,        /* BC_INST_NULL */
+    &jit_op<jit_op_const>,        /* BC_INST_TRUE */
+    &jit_op<jit_op_const>,        /* BC_INST_FALSE */
+    &jit_op<jit_op_not>,          /* BC_INST_NOT */
+    &jit_op<jit_op_pop>,          /* BC_INST_POP */
+    &jit_op<jit_op_enter>,        /* BC_INST_ENTER */
+    &jit_op<jit_op_enter>,        /* BC_INST_ENTER_RESULT */
+    &jit_op<jit_op_exit>,         /* BC_INST_EXIT */
+    &jit_op<jit_op_result>,       /* BC_INST_RESULT */
+    &jit_op<jit_op_result_arg>,   /* BC_INST_RESULT_ARG */
+    &jit_op<jit_op_force>,        /* BC_INST_FORCE */
+    &jit_op<jit_op_dup>,          /* BC_INST_DUP */
+    &jit_op<jit_op_val>,          /* BC_INST_VAL */
+    &jit_op<jit_op_val>,          /* BC_INST_VAL_INT */
+    &jit_op<jit_op_local>,        /* BC_INST_LOCAL */
+    &jit_op<jit_op_do>,           /* BC_INST_DO */
+    &jit_op<jit_op_do>,           /* BC_INST_DO_ARGS */
+    nullptr,                      /* BC_INST_JUMP */
+    &jit_op<jit_op_jump_b>,       /* BC_INST_JUMP_B */
+    &jit_op<jit_op_jump_result>,  /* BC_INST_JUMP_RESULT */
+    &jit_op_interp,               /* BC_INST_BREAK */
+    &jit_op<jit_op_block>,        /* BC_INST_BLOCK */
+    &jit_op<jit_op_empty>,        /* BC_INST_EMPTY */
+    &jit_op<jit_op_compile>,      /* BC_INST_COMPILE */
+    &jit_op<jit_op_cond>,         /* BC_INST_COND */
+    &jit_op<jit_op_ident>,        /* BC_INST_IDENT */
+    &jit_op<jit_op_ident_u>,      /* BC_INST_IDENT_U */
+    &jit_op<jit_op_lookup>,       /* BC_INST_LOOKUP */
+    &jit_op<jit_op_lookup_u>,     /* BC_INST_LOOKUP_U */
+    &jit_op<jit_op_conc>,         /* BC_INST_CONC */
+    &jit_op<jit_op_conc>,         /* BC_INST_CONC_W */
+    &jit_op<jit_op_var>,          /* BC_INST_VAR */
+    &jit_op<jit_op_alias>,        /* BC_INST_ALIAS */
+    &jit_op<jit_op_alias_u>,      /* BC_INST_ALIAS_U */
+    &jit_op<jit_op_call>,         /* BC_INST_CALL */
+    &jit_op_interp,               /* BC_INST_CALL_U */
+    &jit_op<jit_op_com>,          /* BC_INST_COM */
+    &jit_op<jit_op_com_v>,        /* BC_INST_COM_V */
+    &jit_op<jit_op_com>,          /* BC_INST_COM_ARG */
+    &jit_op<jit_op_com_v>,        /* BC_INST_COM_V_ARG */
+    &jit_op<jit_op_call>,         /* BC_INST_CALL_ARG */
+    &jit_op<jit_op_alias_result>, /* BC_INST_ALIAS_RESULT */
+    &jit_op<jit_op_alias_val>,    /* BC_INST_ALIAS_VAL */
+    &jit_op<jit_op_jump_b_r>,     /* BC_INST_JUMP_B_R */
+    &jit_op<jit_op_math>,         /* BC_INST_MATH */
+    &jit_op<jit_op_math>,         /* BC_INST_MATH_ARG */
+    &jit_op_interp,               /* BC_INST_LOOP */
+    &jit_op<jit_op_loop_cond>,    /* BC_INST_LOOP_COND */
+    &jit_op_interp, &jit_op_interp, &jit_op_interp, &jit_op_interp,
+    &jit_op_interp, &jit_op_interp, &jit_op_interp, &jit_op_interp,
+    &jit_op_interp, &jit_op_interp, &jit_op_interp, &jit_op_interp,
+    &jit_op_interp, &jit_op_interp
+};
+
+#ifndef LIBCUBESCRIPT_VM_JIT_THRESHOLD
+#define LIBCUBESCRIPT_VM_JIT_THRESHOLD 16
+#endif
+
+/* called whenever a frame starts running code; once the code has been
+ * entered enough times, its whole allocation gets compiled, and the frame
+ * runs natively from then on (fr.jit); allocations that fail to compile
+ * are not tried again
+ */
+static bool vm_jit_enter(thread_state &ts, vm_frame &fr, std::uint32_t *code) {
+    std::uint32_t *start;
+    std::size_t len;
+    auto *bj = bcode_get_jit(ts.istate, code, start, len);
+    if (!bj) {
+        return false;
+    }
+    atomic_ref_type<jit_block *> bref{bj->block};
+    auto *blk = bref.load();
+    if (!blk) {
+        /* racing increments only delay the compilation */
+        atomic_ref_type<std::uint32_t> href{bj->hits};
+        auto hits = href.load();
+        if (hits > LIBCUBESCRIPT_VM_JIT_THRESHOLD) {
+            return false;
+        }
+        if (hits != LIBCUBESCRIPT_VM_JIT_THRESHOLD) {
+            href.store(hits + 1);
+            return false;
+        }
+        mtx_guard l{ts.istate->jit_mtx};
+        blk = bref.load();
+        if (!blk) {
+            blk = jit_compile(ts.istate, start, len, vm_jit_ops);
+            if (!blk) {
+                href.store(hits + 1);
+                return false;
+            }
+            bref.store(blk);
+        }
+    }
+    fr.jit = blk;
+    return true;
+}
+#endif
+
+#if LIBCUBESCRIPT_VM_OPCODE_STATS
+/* the pairs are dumped sorted by frequency, which is what the choice of
+ * fused instructions in the generator is based on; keep the names in
+ * sync with the enum in cs_bcode.hh
+ */
+static char const *vm_op_names[BC_INST_OP_MASK + 1] = {
+    "START",
+    "OFFSET",
+    "NULL",
+    "TRUE",
+    "FALSE",
+    "NOT",
+    "POP",
+    "ENTER",
+    "ENTER_RESULT",
+    "EXIT",
+    "RESULT",
+    "RESULT_ARG",
+    "FORCE",
+    "DUP",
+    "VAL",
+    "VAL_INT",
+    "LOCAL",
+    "DO",
+    "DO_ARGS",
+    "JUMP",
+    "JUMP_B",
+    "JUMP_RESULT",
+    "BREAK",
+    "BLOCK",
+    "EMPTY",
+    "COMPILE",
+    "COND",
+    "IDENT",
+    "IDENT_U",
+    "LOOKUP",
+    "LOOKUP_U",
+    "CONC",
+    "CONC_W",
+    "VAR",
+    "ALIAS",
+    "ALIAS_U",
+    "CALL",
+    "CALL_U",
+    "COM",
+    "COM_V",
+    "COM_ARG",
+    "COM_V_ARG",
+    "CALL_ARG",
+    "ALIAS_RESULT",
+    "ALIAS_VAL",
+    "JUMP_B_R",
+    "MATH",
+    "MATH_ARG",
+    "LOOP",
+    "LOOP_COND"
+};
+
+void vm_dump_stats(thread_state &ts) {
+    struct op_pair {
+        std::size_t count;
+        std::uint32_t first, second;
+    };
+    std::size_t npairs = 0, total = 0;
+    op_pair pairs[(BC_INST_OP_MASK + 1) * (BC_INST_OP_MASK + 1)];
+    for (std::uint32_t i = 0; i <= BC_INST_OP_MASK; ++i) {
+        for (std::uint32_t j = 0; j <= BC_INST_OP_MASK; ++j) {
+            if (ts.op_pairs[i][j]) {
+                pairs[npairs++] = op_pair{ts.op_pairs[i][j], i, j};
+                total += ts.op_pairs[i][j];
+            }
+        }
+    }
+    if (!total) {
+        return;
+    }
+    std::sort(pairs, pairs + npairs, [](auto &a, auto &b) {
+        return a.count > b.count;
+    });
+    std::fprintf(
+        stderr, "opcode pair statistics (%zu dispatches):\n", total
+    );
+    for (std::size_t i = 0; i < std::min(npairs, std::size_t(32)); ++i) {
+        auto *fn = vm_op_names[pairs[i].first];
+        auto *sn = vm_op_names[pairs[i].second];
+        std::fprintf(
+            stderr, "%12zu %6.2f%% %s -> %s\n", pairs[i].count,
+            double(pairs[i].count) * 100.0 / double(total),
+            fn ? fn : "?", sn ? sn : "?"
+        );
+    }
+}
+#endif
+
 } /* namespace cubescript */
@@ -6,17 +6,36 @@
 #include "cs_std.hh"
 #include "cs_ident.hh"
 #include "cs_thread.hh"
+#include "cs_val.hh"
 
+#include <cstring>
 #include <utility>
 
 namespace cubescript {
 
+/* how many times vm_exec may be reentered natively (from commands or the
+ * public API); nesting within the VM is only bounded by max_call_depth
+ */
+static constexpr std::size_t MAX_VM_NESTING = 1024;
+
 struct break_exception {
 };
 
 struct continue_exception {
 };
 
+/* break and continue do not unwind the stack; loops compiled into
+ * BC_INST_LOOP are handled by the vm_exec running them, otherwise
+ * BC_INST_BREAK records the request as loop_ctl in the thread state and
+ * vm_exec drops its frames and returns null, which is passed on until it
+ * reaches the loop (bcode_ref::call_loop)
+ *
+ * exec_alias and exec_code_with_args leave the request pending as well;
+ * code that cannot pass it on (commands, public API) uses this to turn
+ * it into an exception, which call_loop also understands
+ */
+void raise_loop_ctl(thread_state &ts);
+
 void exec_command(
     thread_state &ts, command_impl *id, ident *self, any_value *args,
     any_value &res, std::size_t nargs, bool lookup = false
@@ -29,10 +48,76 @@ any_value exec_alias(
 
 any_value exec_code_with_args(thread_state &ts, bcode_ref const &body);
 
+any_value lookup_ident_value(
+    thread_state &ts, ident *id, std::string_view name
+);
+
 std::uint32_t *vm_exec(
     thread_state &ts, std::uint32_t *code, any_value &result
 );
 
+/* decode a literal encoded by BC_INST_VAL or BC_INST_VAL_INT into v,
+ * returning the position right after it
+ */
+inline std::uint32_t *vm_get_literal(
+    state &cs, std::uint32_t op, std::uint32_t *code, any_value &v
+) {
+    if ((op & BC_INST_OP_MASK) == BC_INST_VAL_INT) {
+        switch (op & BC_INST_RET_MASK) {
+            case BC_RET_STRING: {
+                char s[4] = {
+                    char((op >> 8) & 0xFF),
+                    char((op >> 16) & 0xFF),
+                    char((op >> 24) & 0xFF), '\0'
+                };
+                /* gotta cast or r.size() == potentially 3 */
+                v.set_string(s, cs);
+                return code;
+            }
+            case BC_RET_INT:
+                any_value_p{v}.set_integer(integer_type(op) >> 8);
+                return code;
+            case BC_RET_FLOAT:
+                any_value_p{v}.set_float(float_type(integer_type(op) >> 8));
+                return code;
+            default:
+                break;
+        }
+        v.set_none();
+        return code;
+    }
+    switch (op & BC_INST_RET_MASK) {
+        case BC_RET_STRING: {
+            auto len = op >> 8;
+            char const *str;
+            std::memcpy(&str, &code, sizeof(str));
+            std::string_view sv{str, len};
+            v.set_string(sv, cs);
+            return code + len / sizeof(std::uint32_t) + 1;
+        }
+        case BC_RET_INT: {
+            integer_type i;
+            std::memcpy(&i, code, sizeof(i));
+            any_value_p{v}.set_integer(i);
+            return code + bc_store_size<integer_type>;
+        }
+        case BC_RET_FLOAT: {
+            float_type f;
+            std::memcpy(&f, code, sizeof(f));
+            any_value_p{v}.set_float(f);
+            return code + bc_store_size<float_type>;
+        }
+        default:
+            break;
+    }
+    v.set_none();
+    return code;
+}
+
+#if LIBCUBESCRIPT_VM_OPCODE_STATS
+void vm_dump_stats(thread_state &ts);
+#endif
+
 } /* namespace cubescript */
 
 #endif /* LIBCUBESCRIPT_VM_HH */
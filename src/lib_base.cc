@@ -197,67 +197,88 @@ LIBCUBESCRIPT_EXPORT void std_init_base(state &gcs) {
         }
     });
 
-    new_cmd_quiet(gcs, "loop", "vab", [](auto &cs, auto args, auto &) {
+    new_cmd_loop(gcs, "loop", "vab", BC_LOOP_NUM, [](
+        auto &cs, auto args, auto &
+    ) {
         do_loop(
             cs, args[0].get_ident(cs), 0, args[1].get_integer(), 1,
             bcode_ref{}, args[2].get_code()
         );
     });
 
-    new_cmd_quiet(gcs, "loop+", "viib", [](auto &cs, auto args, auto &) {
+    new_cmd_loop(gcs, "loop+", "viib", BC_LOOP_NUM | BC_LOOP_ADD, [](
+        auto &cs, auto args, auto &
+    ) {
         do_loop(
             cs, args[0].get_ident(cs), args[1].get_integer(),
             args[2].get_integer(), 1, bcode_ref{}, args[3].get_code()
         );
     });
 
-    new_cmd_quiet(gcs, "loop*", "viib", [](auto &cs, auto args, auto &) {
+    new_cmd_loop(gcs, "loop*", "viib", BC_LOOP_NUM | BC_LOOP_MUL, [](
+        auto &cs, auto args, auto &
+    ) {
         do_loop(
             cs, args[0].get_ident(cs), 0, args[1].get_integer(),
             args[2].get_integer(), bcode_ref{}, args[3].get_code()
         );
     });
 
-    new_cmd_quiet(gcs, "loop+*", "viiib", [](auto &cs, auto args, auto &) {
-        do_loop(
-            cs, args[0].get_ident(cs), args[1].get_integer(),
-            args[3].get_integer(), args[2].get_integer(),
-            bcode_ref{}, args[4].get_code()
-        );
-    });
+    new_cmd_loop(
+        gcs, "loop+*", "viiib", BC_LOOP_NUM | BC_LOOP_ADD | BC_LOOP_MUL,
+        [](auto &cs, auto args, auto &) {
+            do_loop(
+                cs, args[0].get_ident(cs), args[1].get_integer(),
+                args[3].get_integer(), args[2].get_integer(),
+                bcode_ref{}, args[4].get_code()
+            );
+        }
+    );
 
-    new_cmd_quiet(gcs, "loopwhile", "vibb", [](auto &cs, auto args, auto &) {
+    new_cmd_loop(gcs, "loopwhile", "vibb", BC_LOOP_NUM | BC_LOOP_COND, [](
+        auto &cs, auto args, auto &
+    ) {
         do_loop(
             cs, args[0].get_ident(cs), 0, args[1].get_integer(), 1,
             args[2].get_code(), args[3].get_code()
         );
     });
 
-    new_cmd_quiet(gcs, "loopwhile+", "viibb", [](auto &cs, auto args, auto &) {
-        do_loop(
-            cs, args[0].get_ident(cs), args[1].get_integer(),
-            args[2].get_integer(), 1, args[3].get_code(), args[4].get_code()
-        );
-    });
-
-    new_cmd_quiet(gcs, "loopwhile*", "viibb", [](auto &cs, auto args, auto &) {
-        do_loop(
-            cs, args[0].get_ident(cs), 0, args[2].get_integer(),
-            args[1].get_integer(), args[3].get_code(), args[4].get_code()
-        );
-    });
+    new_cmd_loop(
+        gcs, "loopwhile+", "viibb", BC_LOOP_NUM | BC_LOOP_ADD | BC_LOOP_COND,
+        [](auto &cs, auto args, auto &) {
+            do_loop(
+                cs, args[0].get_ident(cs), args[1].get_integer(),
+                args[2].get_integer(), 1, args[3].get_code(), args[4].get_code()
+            );
+        }
+    );
+
+    new_cmd_loop(
+        gcs, "loopwhile*", "viibb", BC_LOOP_NUM | BC_LOOP_MUL | BC_LOOP_COND,
+        [](auto &cs, auto args, auto &) {
+            do_loop(
+                cs, args[0].get_ident(cs), 0, args[2].get_integer(),
+                args[1].get_integer(), args[3].get_code(), args[4].get_code()
+            );
+        }
+    );
+
+    new_cmd_loop(
+        gcs, "loopwhile+*", "viiibb",
+        BC_LOOP_NUM | BC_LOOP_ADD | BC_LOOP_MUL | BC_LOOP_COND,
+        [](auto &cs, auto args, auto &) {
+            do_loop(
+                cs, args[0].get_ident(cs), args[1].get_integer(),
+                args[3].get_integer(), args[2].get_integer(),
+                args[4].get_code(), args[5].get_code()
+            );
+        }
+    );
 
-    new_cmd_quiet(gcs, "loopwhile+*", "viiibb", [](
+    new_cmd_loop(gcs, "while", "bb", BC_LOOP_COND, [](
         auto &cs, auto args, auto &
     ) {
-        do_loop(
-            cs, args[0].get_ident(cs), args[1].get_integer(),
-            args[3].get_integer(), args[2].get_integer(), args[4].get_code(),
-            args[5].get_code()
-        );
-    });
-
-    new_cmd_quiet(gcs, "while", "bb", [](auto &cs, auto args, auto &) {
         auto cond = args[0].get_code();
         auto body = args[1].get_code();
         while (cond.call(cs).get_bool()) {
@@ -5,6 +5,7 @@
 #include "cs_std.hh"
 #include "cs_parser.hh"
 #include "cs_thread.hh"
+#include "cs_list.hh"
 
 namespace cubescript {
 
@@ -142,9 +143,8 @@ static void init_lib_list_sort(state &cs);
 
 LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
     new_cmd_quiet(gcs, "listlen", "s", [](auto &cs, auto args, auto &res) {
-        res.set_integer(
-            integer_type(list_parser{cs, args[0].get_string(cs)}.count())
-        );
+        list_indexer li{cs, args[0].get_string(cs)};
+        res.set_integer(integer_type(li.count()));
     });
 
     new_cmd_quiet(gcs, "at", "si1...", [](auto &cs, auto args, auto &res) {
@@ -155,21 +155,22 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
             res = args[0];
             return;
         }
-        auto str = args[0].get_string(cs);
-        list_parser p{cs, str};
+        list_indexer li{cs, args[0].get_string(cs)};
+        /* every index is looked up, but only the last one is the result;
+         * past the end is the last item, like the parser leaves it
+         */
+        list_item it{0, 0, 0, false};
         for (size_t i = 1; i < args.size(); ++i) {
-            p.set_input(str);
-            integer_type pos = args[i].get_integer();
-            for (; pos > 0; --pos) {
-                if (!p.parse()) {
-                    break;
+            auto pos = std::max(args[i].get_integer(), integer_type(0));
+            if (!li.get(std::size_t(pos), it)) {
+                if (auto n = li.count(); n) {
+                    li.get(n - 1, it);
+                } else {
+                    it = list_item{0, 0, 0, false};
                 }
             }
-            if (pos > 0 || !p.parse()) {
-                p.set_input("");
-            }
         }
-        res.set_string(p.get_item());
+        res.set_string(li.get_item(it));
     });
 
     new_cmd_quiet(gcs, "sublist", "sii#", [](auto &cs, auto args, auto &res) {
@@ -180,28 +181,27 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         integer_type offset = std::max(skip, integer_type(0)),
               len = (numargs >= 3) ? std::max(count, integer_type(0)) : -1;
 
-        list_parser p{cs, args[0].get_string(cs)};
-        for (integer_type i = 0; i < offset; ++i) {
-            if (!p.parse()) break;
-        }
+        list_indexer li{cs, args[0].get_string(cs)};
+        auto str = li.list();
+        auto start = li.after(std::size_t(offset));
         if (len < 0) {
             if (offset > 0) {
-                p.skip_until_item();
+                start = li.skip(start);
             }
-            res.set_string(p.input(), cs);
+            res.set_string(str.substr(start), cs);
             return;
         }
 
-        char const *list = p.input().data();
-        if (len > 0 && p.parse()) {
-            while (--len > 0 && p.parse());
-        } else {
+        list_item it;
+        if (!len || !li.get(std::size_t(offset), it)) {
             res.set_string("", cs);
             return;
         }
-        auto quote = p.quoted_item();
-        auto *qend = quote.data() + quote.size();
-        res.set_string(make_str_view(list, qend), cs);
+        auto last = std::size_t(offset) + std::size_t(len) - 1;
+        if (!li.get(last, it)) {
+            li.get(li.count() - 1, it);
+        }
+        res.set_string(str.substr(start, it.qend - start), cs);
     });
 
     new_cmd_quiet(gcs, "listfind", "vsb", [](auto &cs, auto args, auto &res) {
@@ -284,12 +284,16 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
         );
     });
 
-    new_cmd_quiet(gcs, "looplist", "vsb", [](auto &cs, auto args, auto &) {
+    new_cmd_loop(gcs, "looplist", "vsb", BC_LOOP_LIST, [](
+        auto &cs, auto args, auto &
+    ) {
         alias_local st{cs, args[0]};
         any_value idv{};
         auto body = args[2].get_code();
-        for (list_parser p{cs, args[1].get_string(cs)}; p.parse();) {
-            idv.set_string(p.get_item());
+        list_indexer li{cs, args[1].get_string(cs)};
+        list_item it;
+        for (std::size_t i = 0; li.get(i, it); ++i) {
+            idv.set_string(li.get_item(it));
             st.set(std::move(idv));
             switch (body.call_loop(cs)) {
                 case loop_state::BREAK:
@@ -457,20 +461,30 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
     ) {
         integer_type offset = std::max(args[2].get_integer(), integer_type(0));
         integer_type len    = std::max(args[3].get_integer(), integer_type(0));
-        std::string_view s = args[0].get_string(cs);
+        list_indexer li{cs, args[0].get_string(cs)};
+        std::string_view s = li.list();
         std::string_view vals = args[1].get_string(cs);
-        char const *list = s.data();
-        list_parser p{cs, s};
-        for (integer_type i = 0; i < offset; ++i) {
-            if (!p.parse()) {
-                break;
+        /* everything up to the end of the item before the offset, or
+         * the last one if there are fewer items
+         */
+        std::size_t qend = 0;
+        if (offset > 0) {
+            list_item it;
+            if (!li.get(std::size_t(offset - 1), it)) {
+                auto n = li.count();
+                if (n) {
+                    li.get(n - 1, it);
+                } else {
+                    it = list_item{0, 0, 0, false};
+                }
+            }
+            if (it.qend != it.qbeg) {
+                qend = it.qend;
             }
         }
-        std::string_view quote = p.quoted_item();
-        char const *qend = !quote.empty() ? quote.data() + quote.size() : list;
         charbuf buf{cs};
-        if (qend > list) {
-            buf.append(list, qend);
+        if (qend > 0) {
+            buf.append(s.substr(0, qend));
         }
         if (!vals.empty()) {
             if (!buf.empty()) {
@@ -478,14 +492,11 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
             }
             buf.append(vals);
         }
-        for (integer_type i = 0; i < len; ++i) {
-            if (!p.parse()) {
-                break;
-            }
-        }
-        p.skip_until_item();
-        if (!p.input().empty()) {
-            switch (p.input().front()) {
+        auto rest = s.substr(
+            li.skip(li.after(std::size_t(offset) + std::size_t(len)))
+        );
+        if (!rest.empty()) {
+            switch (rest.front()) {
                 case ')':
                 case ']':
                     break;
@@ -493,7 +504,7 @@ LIBCUBESCRIPT_EXPORT void std_init_list(state &gcs) {
                     if (!buf.empty()) {
                         buf.push_back(' ');
                     }
-                    buf.append(p.input());
+                    buf.append(rest);
                     break;
             }
         }
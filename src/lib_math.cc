@@ -7,6 +7,7 @@
 #include <cubescript/cubescript.hh>
 
 #include "cs_state.hh"
+#include "cs_bcode.hh"
 
 namespace cubescript {
 
@@ -76,68 +77,68 @@ static inline void cmp_op(span_type<any_value> args, any_value &res, F cmp) {
 }
 
 LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
-    new_cmd_quiet(cs, "sin", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "sin", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::sin(args[0].get_float() * RAD));
     });
-    new_cmd_quiet(cs, "cos", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "cos", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::cos(args[0].get_float() * RAD));
     });
-    new_cmd_quiet(cs, "tan", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "tan", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::tan(args[0].get_float() * RAD));
     });
 
-    new_cmd_quiet(cs, "asin", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "asin", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::asin(args[0].get_float()) / RAD);
     });
-    new_cmd_quiet(cs, "acos", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "acos", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::acos(args[0].get_float()) / RAD);
     });
-    new_cmd_quiet(cs, "atan", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "atan", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::atan(args[0].get_float()) / RAD);
     });
-    new_cmd_quiet(cs, "atan2", "ff", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "atan2", "ff", [](auto &, auto args, auto &res) {
         res.set_float(std::atan2(args[0].get_float(), args[1].get_float()) / RAD);
     });
 
-    new_cmd_quiet(cs, "sqrt", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "sqrt", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::sqrt(args[0].get_float()));
     });
-    new_cmd_quiet(cs, "loge", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "loge", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::log(args[0].get_float()));
     });
-    new_cmd_quiet(cs, "log2", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "log2", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::log(args[0].get_float()) / LN2);
     });
-    new_cmd_quiet(cs, "log10", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "log10", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::log10(args[0].get_float()));
     });
 
-    new_cmd_quiet(cs, "exp", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "exp", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::exp(args[0].get_float()));
     });
 
-    new_cmd_quiet(cs, "min", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "min", "i1...", [](auto &, auto args, auto &res) {
         integer_type v = (!args.empty() ? args[0].get_integer() : 0);
         for (size_t i = 1; i < args.size(); ++i) {
             v = std::min(v, args[i].get_integer());
         }
         res.set_integer(v);
     });
-    new_cmd_quiet(cs, "max", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "max", "i1...", [](auto &, auto args, auto &res) {
         integer_type v = (!args.empty() ? args[0].get_integer() : 0);
         for (size_t i = 1; i < args.size(); ++i) {
             v = std::max(v, args[i].get_integer());
         }
         res.set_integer(v);
     });
-    new_cmd_quiet(cs, "minf", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "minf", "f1...", [](auto &, auto args, auto &res) {
         float_type v = (!args.empty() ? args[0].get_float() : 0);
         for (size_t i = 1; i < args.size(); ++i) {
             v = std::min(v, args[i].get_float());
         }
         res.set_float(v);
     });
-    new_cmd_quiet(cs, "maxf", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "maxf", "f1...", [](auto &, auto args, auto &res) {
         float_type v = (!args.empty() ? args[0].get_float() : 0);
         for (size_t i = 1; i < args.size(); ++i) {
             v = std::max(v, args[i].get_float());
@@ -145,21 +146,21 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
         res.set_float(v);
     });
 
-    new_cmd_quiet(cs, "abs", "i", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "abs", "i", [](auto &, auto args, auto &res) {
         res.set_integer(std::abs(args[0].get_integer()));
     });
-    new_cmd_quiet(cs, "absf", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "absf", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::abs(args[0].get_float()));
     });
 
-    new_cmd_quiet(cs, "floor", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "floor", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::floor(args[0].get_float()));
     });
-    new_cmd_quiet(cs, "ceil", "f", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "ceil", "f", [](auto &, auto args, auto &res) {
         res.set_float(std::ceil(args[0].get_float()));
     });
 
-    new_cmd_quiet(cs, "round", "ff", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "round", "ff", [](auto &, auto args, auto &res) {
         float_type step = args[1].get_float();
         float_type r = args[0].get_float();
         if (step > 0) {
@@ -171,43 +172,49 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
         res.set_float(r);
     });
 
-    new_cmd_quiet(cs, "+", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "+", "i1...", BC_MATH_ADD, [](
+        auto &, auto args, auto &res
+    ) {
         math_op<integer_type>(args, res, 0, std::plus<integer_type>(), math_noop<integer_type>());
     });
-    new_cmd_quiet(cs, "*", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "*", "i1...", BC_MATH_MUL, [](
+        auto &, auto args, auto &res
+    ) {
         math_op<integer_type>(
             args, res, 1, std::multiplies<integer_type>(), math_noop<integer_type>()
         );
     });
-    new_cmd_quiet(cs, "-", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "-", "i1...", BC_MATH_SUB, [](
+        auto &, auto args, auto &res
+    ) {
         math_op<integer_type>(
             args, res, 0, std::minus<integer_type>(), std::negate<integer_type>()
         );
     });
 
-    new_cmd_quiet(cs, "^", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "^", "i1...", [](auto &, auto args, auto &res) {
         math_op<integer_type>(
             args, res, 0, std::bit_xor<integer_type>(), [](integer_type val) { return ~val; }
         );
     });
-    new_cmd_quiet(cs, "~", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "~", "i1...", [](auto &, auto args, auto &res) {
         math_op<integer_type>(
             args, res, 0, std::bit_xor<integer_type>(), [](integer_type val) { return ~val; }
         );
     });
-    new_cmd_quiet(cs, "&", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "&", "i1...", [](auto &, auto args, auto &res) {
         math_op<integer_type>(
             args, res, 0, std::bit_and<integer_type>(), math_noop<integer_type>()
         );
     });
-    new_cmd_quiet(cs, "|", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "|", "i1...", [](auto &, auto args, auto &res) {
         math_op<integer_type>(
             args, res, 0, std::bit_or<integer_type>(), math_noop<integer_type>()
         );
     });
 
     /* special combined cases */
-    new_cmd_quiet(cs, "^~", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "^~", "i1...", [](auto &, auto args, auto &res) {
         integer_type val;
         if (args.size() >= 2) {
             val = args[0].get_integer() ^ ~args[1].get_integer();
@@ -219,7 +226,7 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
         }
         res.set_integer(val);
     });
-    new_cmd_quiet(cs, "&~", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "&~", "i1...", [](auto &, auto args, auto &res) {
         integer_type val;
         if (args.size() >= 2) {
             val = args[0].get_integer() & ~args[1].get_integer();
@@ -231,7 +238,7 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
         }
         res.set_integer(val);
     });
-    new_cmd_quiet(cs, "|~", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "|~", "i1...", [](auto &, auto args, auto &res) {
         integer_type val;
         if (args.size() >= 2) {
             val = args[0].get_integer() | ~args[1].get_integer();
@@ -244,7 +251,7 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
         res.set_integer(val);
     });
 
-    new_cmd_quiet(cs, "<<", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "<<", "i1...", [](auto &, auto args, auto &res) {
         math_op<integer_type>(
             args, res, 0, [](integer_type val1, integer_type val2) {
                 return (val2 < integer_type(sizeof(integer_type) * CHAR_BIT))
@@ -253,7 +260,7 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
             }, math_noop<integer_type>()
         );
     });
-    new_cmd_quiet(cs, ">>", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, ">>", "i1...", [](auto &, auto args, auto &res) {
         math_op<integer_type>(
             args, res, 0, [](integer_type val1, integer_type val2) {
                 return val1 >> std::clamp(
@@ -263,23 +270,31 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
         );
     });
 
-    new_cmd_quiet(cs, "+f", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "+f", "f1...", BC_MATH_ADDF, [](
+        auto &, auto args, auto &res
+    ) {
         math_op<float_type>(
             args, res, 0, std::plus<float_type>(), math_noop<float_type>()
         );
     });
-    new_cmd_quiet(cs, "*f", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "*f", "f1...", BC_MATH_MULF, [](
+        auto &, auto args, auto &res
+    ) {
         math_op<float_type>(
             args, res, 1, std::multiplies<float_type>(), math_noop<float_type>()
         );
     });
-    new_cmd_quiet(cs, "-f", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "-f", "f1...", BC_MATH_SUBF, [](
+        auto &, auto args, auto &res
+    ) {
         math_op<float_type>(
             args, res, 0, std::minus<float_type>(), std::negate<float_type>()
         );
     });
 
-    new_cmd_quiet(cs, "div", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "div", "i1...", BC_MATH_DIV, [](
+        auto &, auto args, auto &res
+    ) {
         math_op<integer_type>(
             args, res, 0, [](integer_type val1, integer_type val2) {
                 if (val2) {
@@ -289,7 +304,9 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
             }, math_noop<integer_type>()
         );
     });
-    new_cmd_quiet(cs, "mod", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "mod", "i1...", BC_MATH_MOD, [](
+        auto &, auto args, auto &res
+    ) {
         math_op<integer_type>(
             args, res, 0, [](integer_type val1, integer_type val2) {
                 if (val2) {
@@ -299,7 +316,9 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
             }, math_noop<integer_type>()
         );
     });
-    new_cmd_quiet(cs, "divf", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "divf", "f1...", BC_MATH_DIVF, [](
+        auto &, auto args, auto &res
+    ) {
         math_op<float_type>(
             args, res, 0, [](float_type val1, float_type val2) {
                 if (val2) {
@@ -309,7 +328,7 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
             }, math_noop<float_type>()
         );
     });
-    new_cmd_quiet(cs, "modf", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "modf", "f1...", [](auto &, auto args, auto &res) {
         math_op<float_type>(
             args, res, 0, [](float_type val1, float_type val2) {
                 if (val2) {
@@ -320,7 +339,7 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
         );
     });
 
-    new_cmd_quiet(cs, "pow", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_pure(cs, "pow", "f1...", [](auto &, auto args, auto &res) {
         math_op<float_type>(
             args, res, 0, [](float_type val1, float_type val2) {
                 return float_type(pow(val1, val2));
@@ -328,41 +347,65 @@ LIBCUBESCRIPT_EXPORT void std_init_math(state &cs) {
         );
     });
 
-    new_cmd_quiet(cs, "=", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "=", "i1...", BC_MATH_EQ, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<integer_type>(args, res, std::equal_to<integer_type>());
     });
-    new_cmd_quiet(cs, "!=", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "!=", "i1...", BC_MATH_NE, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<integer_type>(args, res, std::not_equal_to<integer_type>());
     });
-    new_cmd_quiet(cs, "<", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "<", "i1...", BC_MATH_LT, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<integer_type>(args, res, std::less<integer_type>());
     });
-    new_cmd_quiet(cs, ">", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, ">", "i1...", BC_MATH_GT, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<integer_type>(args, res, std::greater<integer_type>());
     });
-    new_cmd_quiet(cs, "<=", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "<=", "i1...", BC_MATH_LE, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<integer_type>(args, res, std::less_equal<integer_type>());
     });
-    new_cmd_quiet(cs, ">=", "i1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, ">=", "i1...", BC_MATH_GE, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<integer_type>(args, res, std::greater_equal<integer_type>());
     });
 
-    new_cmd_quiet(cs, "=f", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "=f", "f1...", BC_MATH_EQF, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<float_type>(args, res, std::equal_to<float_type>());
     });
-    new_cmd_quiet(cs, "!=f", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "!=f", "f1...", BC_MATH_NEF, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<float_type>(args, res, std::not_equal_to<float_type>());
     });
-    new_cmd_quiet(cs, "<f", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "<f", "f1...", BC_MATH_LTF, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<float_type>(args, res, std::less<float_type>());
     });
-    new_cmd_quiet(cs, ">f", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, ">f", "f1...", BC_MATH_GTF, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<float_type>(args, res, std::greater<float_type>());
     });
-    new_cmd_quiet(cs, "<=f", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, "<=f", "f1...", BC_MATH_LEF, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<float_type>(args, res, std::less_equal<float_type>());
     });
-    new_cmd_quiet(cs, ">=f", "f1...", [](auto &, auto args, auto &res) {
+    new_cmd_math(cs, ">=f", "f1...", BC_MATH_GEF, [](
+        auto &, auto args, auto &res
+    ) {
         cmp_op<float_type>(args, res, std::greater_equal<float_type>());
     });
 }
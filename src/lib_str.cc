@@ -30,7 +30,7 @@ static inline void str_cmp_by(
 }
 
 LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
-    new_cmd_quiet(cs, "strstr", "ss", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "strstr", "ss", [](auto &ccs, auto args, auto &res) {
         std::string_view a = args[0].get_string(ccs);
         std::string_view b = args[1].get_string(ccs);
         auto pos = a.find(b);
@@ -41,11 +41,11 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
         }
     });
 
-    new_cmd_quiet(cs, "strlen", "s", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "strlen", "s", [](auto &ccs, auto args, auto &res) {
         res.set_integer(integer_type(args[0].get_string(ccs).size()));
     });
 
-    new_cmd_quiet(cs, "strcode", "si", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "strcode", "si", [](auto &ccs, auto args, auto &res) {
         std::string_view str = args[0].get_string(ccs);
         integer_type i = args[1].get_integer();
         if (i >= integer_type(str.size())) {
@@ -55,52 +55,52 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
         }
     });
 
-    new_cmd_quiet(cs, "codestr", "i", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "codestr", "i", [](auto &ccs, auto args, auto &res) {
         char const p[2] = { char(args[0].get_integer()), '\0' };
         res.set_string(std::string_view{static_cast<char const *>(p)}, ccs);
     });
 
-    new_cmd_quiet(cs, "strlower", "s", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "strlower", "s", [](auto &ccs, auto args, auto &res) {
         auto inps = args[0].get_string(ccs);
         auto *ics = state_p{ccs}.ts().istate;
         auto *buf = ics->strman->alloc_buf(inps.size());
         for (std::size_t i = 0; i < inps.size(); ++i) {
             buf[i] = char(tolower(inps.data()[i]));
         }
-        res.set_string(ics->strman->steal(buf));
+        res.set_string(ics->strman->steal_transient(buf));
     });
 
-    new_cmd_quiet(cs, "strupper", "s", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "strupper", "s", [](auto &ccs, auto args, auto &res) {
         auto inps = args[0].get_string(ccs);
         auto *ics = state_p{ccs}.ts().istate;
         auto *buf = ics->strman->alloc_buf(inps.size());
         for (std::size_t i = 0; i < inps.size(); ++i) {
             buf[i] = char(toupper(inps.data()[i]));
         }
-        res.set_string(ics->strman->steal(buf));
+        res.set_string(ics->strman->steal_transient(buf));
     });
 
-    new_cmd_quiet(cs, "escape", "s", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "escape", "s", [](auto &ccs, auto args, auto &res) {
         charbuf s{ccs};
         escape_string(std::back_inserter(s), args[0].get_string(ccs));
         res.set_string(s.str(), ccs);
     });
 
-    new_cmd_quiet(cs, "unescape", "s", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "unescape", "s", [](auto &ccs, auto args, auto &res) {
         charbuf s{ccs};
         unescape_string(std::back_inserter(s), args[0].get_string(ccs));
         res.set_string(s.str(), ccs);
     });
 
-    new_cmd_quiet(cs, "concat", "...", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "concat", "...", [](auto &ccs, auto args, auto &res) {
         res.set_string(concat_values(ccs, args, " "));
     });
 
-    new_cmd_quiet(cs, "concatword", "...", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "concatword", "...", [](auto &ccs, auto args, auto &res) {
         res.set_string(concat_values(ccs, args));
     });
 
-    new_cmd_quiet(cs, "format", "...", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "format", "...", [](auto &ccs, auto args, auto &res) {
         if (args.empty()) {
             return;
         }
@@ -128,7 +128,7 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
         res.set_string(s.str(), ccs);
     });
 
-    new_cmd_quiet(cs, "tohex", "ii", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "tohex", "ii", [](auto &ccs, auto args, auto &res) {
         char buf[32];
         /* use long long as the largest signed integer type */
         auto val = static_cast<long long>(args[0].get_integer());
@@ -153,7 +153,7 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
         abort();
     });
 
-    new_cmd_quiet(cs, "substr", "sii#", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "substr", "sii#", [](auto &ccs, auto args, auto &res) {
         std::string_view s = args[0].get_string(ccs);
         auto start = args[1].get_integer(), count = args[2].get_integer();
         auto numargs = args[3].get_integer();
@@ -167,29 +167,29 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
         }, ccs);
     });
 
-    new_cmd_quiet(cs, "strcmp", "s1...", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "strcmp", "s1...", [](auto &ccs, auto args, auto &res) {
         str_cmp_by(ccs, args, res, std::equal_to<std::string_view>());
     });
-    new_cmd_quiet(cs, "=s", "s1...", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "=s", "s1...", [](auto &ccs, auto args, auto &res) {
         str_cmp_by(ccs, args, res, std::equal_to<std::string_view>());
     });
-    new_cmd_quiet(cs, "!=s", "s1...", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "!=s", "s1...", [](auto &ccs, auto args, auto &res) {
         str_cmp_by(ccs, args, res, std::not_equal_to<std::string_view>());
     });
-    new_cmd_quiet(cs, "<s", "s1...", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "<s", "s1...", [](auto &ccs, auto args, auto &res) {
         str_cmp_by(ccs, args, res, std::less<std::string_view>());
     });
-    new_cmd_quiet(cs, ">s", "s1...", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, ">s", "s1...", [](auto &ccs, auto args, auto &res) {
         str_cmp_by(ccs, args, res, std::greater<std::string_view>());
     });
-    new_cmd_quiet(cs, "<=s", "s1...", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, "<=s", "s1...", [](auto &ccs, auto args, auto &res) {
         str_cmp_by(ccs, args, res, std::less_equal<std::string_view>());
     });
-    new_cmd_quiet(cs, ">=s", "s1...", [](auto &ccs, auto args, auto &res) {
+    new_cmd_pure(cs, ">=s", "s1...", [](auto &ccs, auto args, auto &res) {
         str_cmp_by(ccs, args, res, std::greater_equal<std::string_view>());
     });
 
-    new_cmd_quiet(cs, "strreplace", "ssss", [](
+    new_cmd_pure(cs, "strreplace", "ssss", [](
         auto &ccs, auto args, auto &res
     ) {
         std::string_view s = args[0].get_string(ccs);
@@ -220,7 +220,7 @@ LIBCUBESCRIPT_EXPORT void std_init_string(state &cs) {
         }
     });
 
-    new_cmd_quiet(cs, "strsplice", "ssii", [](
+    new_cmd_pure(cs, "strsplice", "ssii", [](
         auto &ccs, auto args, auto &res
     ) {
         std::string_view s = args[0].get_string(ccs);
@@ -0,0 +1,209 @@
+/* tests conversions of strings to numbers against a plain digit by digit
+ * implementation, on random inputs as well as long runs of digits
+ */
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failed = 0;
+
+/* reference implementation */
+
+namespace ref {
+
+static char const *skip_white(char const *beg, char const *end) {
+    while ((beg != end) && std::isspace(*beg)) {
+        ++beg;
+    }
+    return beg;
+}
+
+static int hexd(char c) {
+    if (c >= 'a') {
+        return c - 'a' + 10;
+    } else if (c >= 'A') {
+        return c - 'A' + 10;
+    }
+    return c - '0';
+}
+
+static bool check_neg(char const *&beg) {
+    bool neg = (*beg == '-');
+    if (neg || (*beg == '+')) {
+        ++beg;
+    }
+    return neg;
+}
+
+static cs::integer_type parse_int(std::string_view input) {
+    using uint_type = std::make_unsigned_t<cs::integer_type>;
+    char const *beg = skip_white(input.data(), input.data() + input.size());
+    char const *end = input.data() + input.size();
+    if (beg == end) {
+        return 0;
+    }
+    bool neg = check_neg(beg);
+    uint_type ret = 0;
+    std::string_view pfx{beg, std::size_t((end - beg) >= 2 ? 2 : 0)};
+    if ((pfx == "0x") || (pfx == "0X")) {
+        for (beg += 2; (beg != end) && std::isxdigit(*beg); ++beg) {
+            ret = uint_type(ret * 16 + uint_type(hexd(*beg)));
+        }
+    } else if ((pfx == "0b") || (pfx == "0B")) {
+        for (beg += 2; (beg != end) && ((*beg == '0') || (*beg == '1')); ++beg) {
+            ret = uint_type(ret * 2 + uint_type(*beg - '0'));
+        }
+    } else {
+        for (; (beg != end) && std::isdigit(*beg); ++beg) {
+            ret = uint_type(ret * 10 + uint_type(*beg - '0'));
+        }
+    }
+    return cs::integer_type(neg ? uint_type(-ret) : ret);
+}
+
+template<bool Hex>
+static bool parse_gen_float(
+    char const *beg, char const *end, cs::float_type &ret
+) {
+    auto isd = [](char c) {
+        return Hex ? std::isxdigit(c) : std::isdigit(c);
+    };
+    double r = 0.0;
+    cs::integer_type wn = 0, fn = 0;
+    for (; (beg != end) && isd(*beg); ++beg, ++wn) {
+        r = r * (Hex ? 16.0 : 10.0) + double(hexd(*beg));
+    }
+    if ((beg != end) && (*beg == '.')) {
+        for (++beg; (beg != end) && isd(*beg); ++beg, ++fn) {
+            r = r * (Hex ? 16.0 : 10.0) + double(hexd(*beg));
+        }
+    }
+    if (!wn && !fn) {
+        return false;
+    }
+    fn = -fn;
+    char e1 = Hex ? 'p' : 'e', e2 = Hex ? 'P' : 'E';
+    if ((beg != end) && ((*beg == e1) || (*beg == e2))) {
+        ++beg;
+        if (beg != end) {
+            bool neg = check_neg(beg);
+            if ((beg != end) && std::isdigit(*beg)) {
+                cs::integer_type exp = 0;
+                for (; (beg != end) && std::isdigit(*beg); ++beg) {
+                    exp = exp * 10 + (*beg - '0');
+                }
+                fn += neg ? -exp : exp;
+            }
+        }
+    }
+    if (Hex) {
+        ret = cs::float_type(std::ldexp(r, fn * 4));
+    } else {
+        ret = cs::float_type(r * std::pow(10, fn));
+    }
+    return true;
+}
+
+static cs::float_type parse_float(std::string_view input) {
+    char const *beg = skip_white(input.data(), input.data() + input.size());
+    char const *end = input.data() + input.size();
+    if (beg == end) {
+        return 0;
+    }
+    bool neg = check_neg(beg);
+    cs::float_type ret = 0;
+    std::string_view pfx{beg, std::size_t((end - beg) >= 2 ? 2 : 0)};
+    bool valid;
+    if ((pfx == "0x") || (pfx == "0X")) {
+        valid = parse_gen_float<true>(beg + 2, end, ret);
+    } else {
+        valid = parse_gen_float<false>(beg, end, ret);
+    }
+    if (!valid) {
+        return 0;
+    }
+    return neg ? -ret : ret;
+}
+
+} /* namespace ref */
+
+static void check(cs::state &s, std::string const &str) {
+    cs::any_value v{str, s};
+    if (v.get_integer() != ref::parse_int(str)) {
+        std::fprintf(stderr, "FAIL: integer '%s'\n", str.c_str());
+        ++failed;
+    }
+    auto f = v.get_float();
+    auto rf = ref::parse_float(str);
+    if (std::memcmp(&f, &rf, sizeof(f))) {
+        std::fprintf(stderr, "FAIL: float '%s'\n", str.c_str());
+        ++failed;
+    }
+}
+
+int main() {
+    cs::state gcs;
+
+    std::mt19937 rng{1234};
+    auto rnd = [&rng](std::size_t n) {
+        return std::size_t(rng() % n);
+    };
+
+    /* mostly digits, with some of everything else that is understood */
+    static constexpr std::string_view digits = "0123456789";
+    static constexpr std::string_view xdigits = "0123456789abcdefABCDEF";
+    static constexpr std::string_view other = ".eEpP+- xX\xC3";
+    for (int i = 0; i < 200000; ++i) {
+        std::string str;
+        switch (rnd(6)) {
+            case 0: str = "0x"; break;
+            case 1: str = "-0X"; break;
+            case 2: str = "0b"; break;
+            case 3: str = " -"; break;
+            default: break;
+        }
+        auto len = rnd(40);
+        for (std::size_t j = 0; j < len; ++j) {
+            auto k = rnd(20);
+            if (k < 12) {
+                str += digits[rnd(digits.size())];
+            } else if (k < 17) {
+                str += xdigits[rnd(xdigits.size())];
+            } else {
+                str += other[rnd(other.size())];
+            }
+        }
+        check(gcs, str);
+    }
+
+    /* runs of digits around the lengths that matter to the conversion */
+    for (std::size_t len = 1; len < 40; ++len) {
+        for (int i = 0; i < 200; ++i) {
+            std::string str, xstr = "0x";
+            for (std::size_t j = 0; j < len; ++j) {
+                str += digits[rnd(digits.size())];
+                xstr += xdigits[rnd(xdigits.size())];
+            }
+            check(gcs, str);
+            check(gcs, xstr);
+            auto dot = rnd(len + 1);
+            check(gcs, str.substr(0, dot) + "." + str.substr(dot));
+            check(gcs, xstr.substr(0, dot + 2) + "." + xstr.substr(dot + 2));
+            check(gcs, str + "e-" + std::to_string(rnd(80)));
+            check(gcs, xstr + "p" + std::to_string(rnd(20)));
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+/* tests conversions of numbers to strings against snprintf with the
+ * configured formats; pass "full" to go through every float there is
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string_view>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failed = 0;
+
+static void check_int(cs::state &s, cs::integer_type v) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), cs::INTEGER_FORMAT, v);
+    cs::any_value val{v};
+    auto str = val.get_string(s);
+    if (str.view() != buf) {
+        std::fprintf(stderr, "FAIL: %s: got %s\n", buf, str.data());
+        ++failed;
+        return;
+    }
+    if (val.force_string(s) != buf) {
+        std::fprintf(stderr, "FAIL: %s: forced\n", buf);
+        ++failed;
+    }
+}
+
+static void check_float(cs::state &s, cs::float_type v) {
+    char buf[512];
+    if (v == std::floor(v)) {
+        std::snprintf(buf, sizeof(buf), cs::ROUND_FLOAT_FORMAT, v);
+    } else {
+        std::snprintf(buf, sizeof(buf), cs::FLOAT_FORMAT, v);
+    }
+    cs::any_value val{v};
+    if (val.get_string(s).view() != buf) {
+        std::fprintf(
+            stderr, "FAIL: %s: got %s\n", buf, val.get_string(s).data()
+        );
+        ++failed;
+    }
+}
+
+/* every value of a float made of the given bits */
+template<typename F, typename U>
+static void check_float_bits(cs::state &s, U step) {
+    U bits = 0;
+    do {
+        F v;
+        std::memcpy(&v, &bits, sizeof(v));
+        check_float(s, cs::float_type(v));
+        if (failed > 10) {
+            return;
+        }
+        bits += step;
+    } while (bits >= step);
+}
+
+int main(int argc, char **argv) {
+    bool full = (argc > 1) && (std::string_view{argv[1]} == "full");
+
+    cs::state gcs;
+
+    using ilim = std::numeric_limits<cs::integer_type>;
+    for (cs::integer_type i = -100000; i <= 100000; ++i) {
+        check_int(gcs, i);
+    }
+    for (cs::integer_type i = 0; i < 1000; ++i) {
+        check_int(gcs, ilim::min() + i);
+        check_int(gcs, ilim::max() - i);
+    }
+    for (cs::integer_type i = 1; i < ilim::max() / 10; i *= 10) {
+        check_int(gcs, i * 10 - 1);
+        check_int(gcs, -i * 10 + 1);
+    }
+
+    using flim = std::numeric_limits<cs::float_type>;
+    check_float(gcs, flim::max());
+    check_float(gcs, flim::lowest());
+    check_float(gcs, flim::min());
+    check_float(gcs, flim::denorm_min());
+    check_float(gcs, flim::infinity());
+    check_float(gcs, -flim::infinity());
+    check_float(gcs, cs::float_type(0.5));
+    check_float(gcs, cs::float_type(-0.0));
+    check_float(gcs, cs::float_type(1e7));
+    check_float(gcs, cs::float_type(9999999.5));
+
+    if constexpr (sizeof(cs::float_type) == sizeof(std::uint32_t)) {
+        /* every float there is when asked to, or a spread of them */
+        check_float_bits<cs::float_type, std::uint32_t>(
+            gcs, full ? 1 : 4099
+        );
+    } else {
+        check_float_bits<float, std::uint32_t>(gcs, full ? 1 : 4099);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+/* tests builtins registered by the user before the standard library,
+ * which must be called instead of anything the compiler has for them
+ */
+
+#include <cstdio>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failed = 0;
+
+static void run(cs::state &s, char const *code) {
+    try {
+        s.compile(code).call(s);
+    } catch (cs::error const &e) {
+        std::fprintf(stderr, "FAIL: %s: %s\n", code, e.what().data());
+        ++failed;
+    }
+}
+
+int main() {
+    cs::state gcs;
+
+    int calls = 0;
+    gcs.new_command("+", [&calls](
+        cs::integer_type a, cs::integer_type b
+    ) {
+        ++calls;
+        return a * 10 + b;
+    });
+    gcs.new_command("<f", [&calls](cs::float_type a, cs::float_type b) {
+        ++calls;
+        return a > b;
+    });
+    cs::std_init_all(gcs);
+
+    run(gcs, "a = 1; assert [= (+ $a 2) 12]");
+    run(gcs, "x = (+ 3 $a); assert [= $x 31]");
+    run(gcs, "a = 1.5; assert (<f $a 1)");
+    /* the rest of the library is untouched */
+    run(gcs, "a = 2; assert [= (* $a 3) 6]");
+    run(gcs, "a = 2; assert [= (- $a 3) -1]");
+
+    if (calls != 3) {
+        std::fprintf(stderr, "FAIL: %d calls instead of 3\n", calls);
+        ++failed;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+/* tests commands registered with argument lists deduced from their
+ * C++ signatures
+ */
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failed = 0;
+
+static void check(bool v, char const *what) {
+    if (!v) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failed;
+    }
+}
+
+static void check_format(
+    cs::state &s, std::string_view name, std::string_view fmt
+) {
+    auto &id = s.get_ident(name)->get();
+    check(static_cast<cs::command &>(id).args() == fmt, name.data());
+}
+
+static cs::integer_type plain_add(cs::integer_type a, cs::integer_type b) {
+    return a + b;
+}
+
+static void run(cs::state &s, char const *code) {
+    try {
+        s.compile(code).call(s);
+    } catch (cs::error const &e) {
+        std::fprintf(stderr, "FAIL: %s: %s\n", code, e.what().data());
+        ++failed;
+    }
+}
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+
+    gcs.new_command("plain_add", plain_add);
+    gcs.new_command("mix", [](
+        cs::state &, int i, float f, std::string_view s
+    ) {
+        return i + int(f) + int(s.size());
+    });
+    gcs.new_command("halve", [](double v) { return v / 2; });
+    gcs.new_command("greet", [](std::string_view who) {
+        return std::string{"hello "} + std::string{who};
+    });
+    gcs.new_command("truthy", [](bool v) { return v; });
+    gcs.new_command("twice", [](cs::state &s, cs::bcode_ref code) {
+        code.call(s);
+        return code.call(s);
+    });
+    gcs.new_command("idname", [](cs::state &s, cs::ident &id) {
+        return cs::string_ref{s, id.name()};
+    });
+    gcs.new_command("passthru", [](cs::any_value v) { return v; });
+    gcs.new_command("count", [](
+        cs::state &, std::string_view, cs::span_type<cs::any_value> rest
+    ) {
+        return int(rest.size());
+    });
+    cs::integer_type sideval = 0;
+    gcs.new_command("side", [&sideval](cs::integer_type v) {
+        sideval = v;
+    });
+
+    check_format(gcs, "plain_add", "ii");
+    check_format(gcs, "mix", "ifs");
+    check_format(gcs, "halve", "f");
+    check_format(gcs, "greet", "s");
+    check_format(gcs, "truthy", "a");
+    check_format(gcs, "twice", "b");
+    check_format(gcs, "idname", "v");
+    check_format(gcs, "passthru", "a");
+    check_format(gcs, "count", "s...");
+    check_format(gcs, "side", "i");
+
+    run(gcs, "assert [= (plain_add 2 3) 5]");
+    run(gcs, "assert [= (plain_add 2) 2]");
+    run(gcs, "assert [= (mix 1 2.5 abc) 6]");
+    run(gcs, "assert [=f (halve 3) 1.5]");
+    run(gcs, "assert [=s (greet world) \"hello world\"]");
+    run(gcs, "assert [= (truthy \"0.0\") 0]");
+    run(gcs, "assert [= (truthy 1.5) 1]");
+    run(gcs, "x = 0; assert [= (twice [x = (+ $x 1); result $x]) 2]");
+    run(gcs, "assert [=s (idname foo) foo]");
+    run(gcs, "assert [=s (passthru [a b]) \"a b\"]");
+    run(gcs, "assert [= (count a) 0]; assert [= (count a b c d) 3]");
+    run(gcs, "side 42");
+    check(sideval == 42, "side effect");
+
+    /* the same through dynamic calls */
+    run(gcs, "c = plain_add; assert [= ($c 1 2) 3]");
+    run(gcs, "c = count; assert [= ($c a b) 1]");
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+/* tests string references to intermediate results, which are not interned
+ * until stored in an alias or a variable
+ */
+
+#include <cstdio>
+#include <string_view>
+
+#include <cubescript/cubescript.hh>
+
+namespace cs = cubescript;
+
+static int failed = 0;
+
+static void check(bool v, char const *what) {
+    if (!v) {
+        std::fprintf(stderr, "FAIL: %s\n", what);
+        ++failed;
+    }
+}
+
+static cs::any_value run(cs::state &s, char const *code) {
+    try {
+        return s.compile(code).call(s);
+    } catch (cs::error const &e) {
+        std::fprintf(stderr, "FAIL: %s: %s\n", code, e.what().data());
+        ++failed;
+    }
+    return cs::any_value{};
+}
+
+int main() {
+    cs::state gcs;
+    cs::std_init_all(gcs);
+
+    cs::string_ref ab{gcs, "ab"};
+
+    /* intermediate results compare equal to the interned string */
+    auto v = run(gcs, "concatword a b");
+    auto vs = v.get_string(gcs);
+    check(vs == ab, "result equals");
+    check(!(vs != ab), "result not unequal");
+    check(vs != cs::string_ref{gcs, "abc"}, "result unequal");
+    check(vs.view() == "ab", "result contents");
+
+    /* as do numbers made into strings */
+    cs::any_value n{cs::integer_type(42)};
+    check(n.get_string(gcs) == cs::string_ref{gcs, "42"}, "number string");
+    check(n.force_string(gcs) == "42", "forced number string");
+
+    /* once stored, they are interned */
+    run(gcs, "x = (concatword a b)");
+    auto &x = static_cast<cs::alias &>(gcs.get_ident("x")->get());
+    auto xs = x.value(gcs).get_string(gcs);
+    check(xs.data() == ab.data(), "alias value interned");
+
+    gcs.new_var("svar", std::string_view{""});
+    run(gcs, "svar (concatword a b)");
+    auto sv = gcs.lookup_value("svar").get_string(gcs);
+    check(sv.data() == ab.data(), "variable value interned");
+
+    /* and work as names of idents, with the lookup cache and without */
+    run(gcs, "ab = 5");
+    check(run(gcs, "result $[ab]").get_integer() == 5, "lookup");
+    check(
+        run(
+            gcs, "r = 0; loop i 3 [r = (+ $r $(concatword a b))]; result $r"
+        ).get_integer() == 15,
+        "dynamic lookup"
+    );
+
+    return failed ? 1 : 0;
+}